@@ -0,0 +1,209 @@
+#ifndef CLICKNET_PLCARCHIVE_H
+#define CLICKNET_PLCARCHIVE_H
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Long-term tonemap archive.
+ *
+ * The tonemaps of a (peer, slot) stream are stored in blocks of up to BLOCK
+ * tonemaps. A block starts from an all-zero tonemap; every tonemap is
+ * stored as the XOR of its nibble-packed carriers with the previous tonemap
+ * of the block (the first one with zero), run-length coded: consecutive
+ * tonemaps of a stable channel differ in a few carriers, so their XOR is
+ * mostly runs of zeros. Decoding tonemap k of a block applies the k + 1
+ * first deltas in place, with no other buffer.
+ *
+ * The data file holds a plc_archive_header and the blocks; the index file
+ * (the data file name with ".idx") a plc_archive_header and one
+ * plc_archive_index per block, appended once the block is written. A reader
+ * finds the blocks of a stream in the index, the block of a time by binary
+ * search on first_ns, and the tonemap in the block from its entry table.
+ *
+ * Run-length code, one control byte c then:
+ *   c = 0LLLLLLL              L + 1 literal bytes (1 to 128)
+ *   c = 10HHHHHH, LLLLLLLL    H:L + 1 zero bytes (1 to 16384)
+ *   c = 11HHHHHH, LLLLLLLL, v H:L + 1 bytes v
+ * The encoder codes runs of 3 zero bytes or 4 other bytes and more, so that
+ * every run is shorter coded than as literals.
+ *
+ * Plain C++ with no Click headers, so that tools/plcarchive.cc shares it.
+ * All fields are in host byte order.
+ */
+
+#define PLC_ARCHIVE_MAGIC       0x41434C50U // "PLCA", data file
+#define PLC_ARCHIVE_INDEX_MAGIC 0x49434C50U // "PLCI", index file
+#define PLC_ARCHIVE_BLOCK_MAGIC 0x42434C50U // "PLCB"
+#define PLC_ARCHIVE_VERSION     1
+#define PLC_ARCHIVE_MAX_BYTES   2048        // Nibble-packed carriers, PLC_MAX_CARRIERS / 2
+#define PLC_ARCHIVE_MAX_RUN     16384
+
+struct plc_archive_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint64_t created_ns;
+};
+
+struct plc_archive_block {
+    uint32_t magic;             // PLC_ARCHIVE_BLOCK_MAGIC
+    uint8_t peer[6];
+    uint8_t slot;
+    uint8_t reserved;
+    uint16_t ncarriers;
+    uint16_t nbytes;            // Of a nibble-packed tonemap
+    uint32_t count;             // Tonemaps
+    uint32_t size;              // Of the coded data after the entries
+    uint64_t first_ns;
+    // plc_archive_entry[count], then the coded data
+};
+
+struct plc_archive_entry {
+    uint32_t dt_ms;             // Since first_ns
+    uint32_t end;               // Of the delta in the coded data
+};
+
+struct plc_archive_index {
+    uint8_t peer[6];
+    uint8_t slot;
+    uint8_t reserved;
+    uint32_t count;
+    uint32_t size;              // Of the whole block
+    uint64_t first_ns;
+    uint64_t last_ns;
+    uint64_t offset;            // Of the block in the data file
+};
+
+// Every run saves at least the control byte of the literals after it, so
+// only the control bytes of the first literals and of every further 128
+// literal bytes are added to the input
+static inline uint32_t
+plc_archive_rle_bound(uint32_t n) {
+    return n + n / 128 + 1;
+}
+
+static inline uint32_t
+plc_archive_rle_literal(uint8_t *out, const uint8_t *in, uint32_t n) {
+    uint32_t o = 0;
+    while (n) {
+        uint32_t m = n < 128 ? n : 128;
+        out[o++] = m - 1;
+        memcpy(out + o, in, m);
+        o += m;
+        in += m;
+        n -= m;
+    }
+    return o;
+}
+
+// Codes n bytes of in into out, which holds plc_archive_rle_bound(n) bytes.
+// Returns the coded length.
+static inline uint32_t
+plc_archive_rle_encode(uint8_t *out, const uint8_t *in, uint32_t n) {
+    uint32_t o = 0, i = 0, lit = 0;
+    while (i < n) {
+        uint32_t r = 1;
+        while (i + r < n && in[i + r] == in[i] && r < PLC_ARCHIVE_MAX_RUN)
+            r++;
+        if (r < (in[i] ? 4U : 3U)) {
+            i += r;
+            continue;
+        }
+        o += plc_archive_rle_literal(out + o, in + lit, i - lit);
+        out[o++] = (in[i] ? 0xC0 : 0x80) | ((r - 1) >> 8);
+        out[o++] = (r - 1) & 0xFF;
+        if (in[i])
+            out[o++] = in[i];
+        i += r;
+        lit = i;
+    }
+    return o + plc_archive_rle_literal(out + o, in + lit, n - lit);
+}
+
+// XORs the n bytes coded in in[len] into cur. Returns false if the code is
+// corrupt.
+static inline bool
+plc_archive_rle_xor(uint8_t *cur, uint32_t n, const uint8_t *in, uint32_t len) {
+    uint32_t o = 0, i = 0;
+    while (i < len) {
+        uint8_t c = in[i++];
+        uint32_t m;
+        if (!(c & 0x80)) {
+            m = c + 1;
+            if (i + m > len || o + m > n)
+                return false;
+            for (uint32_t j = 0; j < m; j++)
+                cur[o + j] ^= in[i + j];
+            i += m;
+        }
+        else {
+            if (i >= len)
+                return false;
+            m = (((c & 0x3F) << 8) | in[i++]) + 1;
+            if (o + m > n)
+                return false;
+            if (c & 0x40) {
+                if (i >= len)
+                    return false;
+                uint8_t v = in[i++];
+                for (uint32_t j = 0; j < m; j++)
+                    cur[o + j] ^= v;
+            }
+        }
+        o += m;
+    }
+    return o == n;
+}
+
+// Checks the header and entry table of a block of size bytes
+static inline const plc_archive_block *
+plc_archive_check_block(const uint8_t *b, uint64_t size) {
+    const plc_archive_block *h = (const plc_archive_block *) b;
+    if (size < sizeof(*h) || h->magic != PLC_ARCHIVE_BLOCK_MAGIC
+        || h->nbytes == 0 || h->nbytes > PLC_ARCHIVE_MAX_BYTES
+        || h->ncarriers == 0 || h->ncarriers > 2 * h->nbytes || h->count == 0
+        || sizeof(*h) + (uint64_t) h->count * sizeof(plc_archive_entry) + h->size > size)
+        return 0;
+    return h;
+}
+
+static inline const plc_archive_entry *
+plc_archive_entries(const plc_archive_block *h) {
+    return (const plc_archive_entry *) (h + 1);
+}
+
+// Tonemap k of a checked block into out[h->nbytes]. Returns false if the
+// block is corrupt.
+static inline bool
+plc_archive_decode(const plc_archive_block *h, uint32_t k, uint8_t *out) {
+    const plc_archive_entry *e = plc_archive_entries(h);
+    const uint8_t *data = (const uint8_t *) (e + h->count);
+    if (k >= h->count)
+        return false;
+    memset(out, 0, h->nbytes);
+    for (uint32_t j = 0, start = 0; j <= k; start = e[j].end, j++)
+        if (e[j].end < start || e[j].end > h->size
+            || !plc_archive_rle_xor(out, h->nbytes, data + start, e[j].end - start))
+            return false;
+    return true;
+}
+
+// Last tonemap of a checked block at or before t_ns, or -1
+static inline int
+plc_archive_find(const plc_archive_block *h, uint64_t t_ns) {
+    const plc_archive_entry *e = plc_archive_entries(h);
+    if (t_ns < h->first_ns)
+        return -1;
+    uint64_t dt_ms = (t_ns - h->first_ns) / 1000000;
+    uint32_t lo = 0, hi = h->count;     // e[lo - 1] <= t < e[hi]
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (e[mid].dt_ms <= dt_ms)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (int) lo - 1;
+}
+
+#endif
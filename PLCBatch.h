@@ -0,0 +1,33 @@
+#ifndef CLICKNET_PLCBATCH_H
+#define CLICKNET_PLCBATCH_H
+#include <click/element.hh>
+#if HAVE_BATCH
+# include <click/packetbatch.hh>
+#endif
+CLICK_DECLS
+
+/*
+ * Batch processing.
+ *
+ * Every element sorts its input with Packet *handle(Packet *): the
+ * management messages that the element consumes are processed and killed
+ * and null is returned, any other packet is returned as is. push() forwards
+ * what handle() returns. When Click is built with batching (FastClick,
+ * HAVE_BATCH), push_batch() runs handle() over the batch once, which takes
+ * the consumed messages out of it, and forwards the remaining packets, the
+ * plain traffic, with a single call.
+ */
+
+#if HAVE_BATCH
+template <typename F>
+static inline void
+plc_push_batch(const Element::Port &out, PacketBatch *batch, F handle)
+{
+    EXECUTE_FOR_EACH_PACKET_DROPPABLE(handle, batch, [](Packet *) {});
+    if (batch)
+        out.push_batch(batch);
+}
+#endif
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,174 @@
+#ifndef CLICKNET_PLCCHANGE_H
+#define CLICKNET_PLCCHANGE_H
+#include <click/element.hh>
+#include <click/packet.hh>
+#include <click/straccum.hh>
+#include <click/etheraddress.hh>
+#include <math.h>
+#include "PLCSnapshot.h"
+#include "plcstore.hh"
+CLICK_DECLS
+
+/*
+ * Change-point detection on the link metrics.
+ *
+ * Every metric that an element decodes (the PHY rates of a peer, the rate
+ * of a tonemap slot, the error shares of a link) is followed by a
+ * PLCChangeDetector of a few doubles: a moving mean and variance (gain 1/8)
+ * and a two-sided CUSUM of the deviations from the mean, in standard
+ * deviations, less a drift. A change is detected when a sum exceeds the
+ * threshold; the detector then restarts from the new value, keeping its
+ * variance, so that a lasting step is reported once. The standard deviation
+ * is floored (a share of the mean and an absolute minimum per metric), so a
+ * metric that never moved does not fire on its first small step.
+ *
+ * An element reports a change as a click_plc_event: kept in a ring for its
+ * "events" handler and, if the element has the optional output 2, pushed
+ * there as a packet holding the bare record, so that downstream elements
+ * react within the poll that saw the change.
+ */
+
+#define PLC_EVENT_VERSION       1
+#define PLC_CHANGE_EVENTS       32  // Kept for the handler
+#define PLC_CHANGE_GAIN         0.125
+#define PLC_CHANGE_MIN_SIGMA    0.02 // Of the mean
+
+// An event, in host byte order
+struct click_plc_event {
+    uint8_t version;            // PLC_EVENT_VERSION
+    uint8_t metric;             // enum plc_metric
+    int8_t direction;           // 1 for a rise, -1 for a drop
+    uint8_t reserved;
+    uint8_t peer[6];
+    uint8_t reserved2[2];
+    uint64_t time_ns;
+    float before;               // Mean before the change
+    float after;                // Value that completed the change
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+struct PLCChangeParams {
+    double threshold;           // In standard deviations
+    double drift;
+    uint32_t warmup;            // Values before the first test
+
+    PLCChangeParams()
+        : threshold(5), drift(0.5), warmup(8) {
+    }
+};
+
+struct PLCChangeDetector {
+    double mean;
+    double var;
+    double up;                  // CUSUM of the rises and the drops
+    double down;
+    uint32_t n;
+
+    PLCChangeDetector() {
+        reset();
+    }
+
+    void reset() {
+        mean = var = up = down = 0;
+        n = 0;
+    }
+
+    // Feeds value x. Returns 1 on a rise, -1 on a drop, 0 otherwise; before
+    // is then the mean before the change.
+    int update(double x, const PLCChangeParams &p, double min_sigma, double &before) {
+        if (n == 0) {
+            mean = x;
+            up = down = 0;
+            n = 1;
+            return 0;
+        }
+        double sigma = sqrt(var);
+        if (sigma < PLC_CHANGE_MIN_SIGMA * fabs(mean))
+            sigma = PLC_CHANGE_MIN_SIGMA * fabs(mean);
+        if (sigma < min_sigma)
+            sigma = min_sigma;
+        if (n >= p.warmup) {
+            double z = (x - mean) / sigma;
+            up = up + z - p.drift > 0 ? up + z - p.drift : 0;
+            down = down - z - p.drift > 0 ? down - z - p.drift : 0;
+            int dir = up > p.threshold ? 1 : (down > p.threshold ? -1 : 0);
+            if (dir) {
+                before = mean;
+                mean = x;
+                up = down = 0;
+                n = 1;
+                return dir;
+            }
+        }
+        double d = x - mean;
+        mean += PLC_CHANGE_GAIN * d;
+        var = (1 - PLC_CHANGE_GAIN) * (var + PLC_CHANGE_GAIN * d * d);
+        n++;
+        return 0;
+    }
+};
+
+// Recent events of an element
+struct PLCChangeLog {
+    uint32_t count;
+    uint32_t reserved;
+    click_plc_event events[PLC_CHANGE_EVENTS];
+};
+
+class PLCChangeEvents { public:
+
+    PLCChangeParams params;
+
+    // Feeds value x of metric for peer to d. On a change, records the event
+    // and pushes it on output port of e, if e has it. Called by the single
+    // writer of the element.
+    int update(Element *e, int port, PLCChangeDetector &d, int metric, const uint8_t *peer,
+               double x, double min_sigma, uint64_t now_ns) {
+        double before;
+        int dir = d.update(x, params, min_sigma, before);
+        if (!dir)
+            return 0;
+
+        click_plc_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.version = PLC_EVENT_VERSION;
+        ev.metric = metric;
+        ev.direction = dir;
+        memcpy(ev.peer, peer, 6);
+        ev.time_ns = now_ns;
+        ev.before = before;
+        ev.after = x;
+        PLCChangeLog &log = _log.begin_write();
+        log.events[log.count % PLC_CHANGE_EVENTS] = ev;
+        log.count++;
+        _log.end_write();
+
+        click_chatter("[%s] %s of %s %s from %.1f to %.1f", e->class_name(), PLCStore::metric_name(metric),
+                      EtherAddress(peer).unparse().c_str(), dir > 0 ? "rises" : "drops", before, x);
+        if (port < e->noutputs())
+            if (WritablePacket *q = Packet::make(0, &ev, sizeof(ev), 0))
+                e->output(port).push(q);
+        return dir;
+    }
+
+    // One line per recent event, oldest first
+    String unparse() const {
+        PLCChangeLog log;
+        if (!_log.read(log))
+            return String("busy\n");
+        StringAccum sa;
+        uint32_t n = log.count < PLC_CHANGE_EVENTS ? log.count : PLC_CHANGE_EVENTS;
+        for (uint32_t i = log.count - n; i < log.count; i++) {
+            const click_plc_event &ev = log.events[i % PLC_CHANGE_EVENTS];
+            sa << Timestamp::make_nsec(ev.time_ns) << " " << PLCStore::metric_name(ev.metric)
+               << " " << EtherAddress(ev.peer).unparse() << (ev.direction > 0 ? " rise " : " drop ")
+               << ev.before << " " << ev.after << "\n";
+        }
+        return sa.take_string();
+    }
+
+private:
+    PLCSnapshot<PLCChangeLog> _log;
+};
+
+CLICK_ENDDECLS
+#endif
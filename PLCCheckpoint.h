@@ -0,0 +1,186 @@
+#ifndef CLICKNET_PLCCHECKPOINT_H
+#define CLICKNET_PLCCHECKPOINT_H
+#include <click/string.hh>
+#include <click/error.hh>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include "PLCSnapshot.h"
+CLICK_DECLS
+
+/*
+ * Warm-start checkpoint of an element snapshot.
+ *
+ * With the CHECKPOINT keyword, an element periodically copies its snapshot
+ * (PLCSnapshot.h) into a memory-mapped file and reloads it in initialize(),
+ * so that cumulative counters can be diffed and per-peer state is available
+ * from the first poll after a restart. The file holds two slots written
+ * alternately; each slot has a header with the element kind, the peer, the
+ * size and a checksum of the payload, so a torn write only loses the newest
+ * slot. A checkpoint is used only if it matches the element, its peer and
+ * the current layout and is younger than the configured maximum age.
+ */
+
+#define PLC_CHECKPOINT_MAGIC    0x43434C50U // "PLCC"
+#define PLC_CHECKPOINT_VERSION  1
+
+struct plc_checkpoint_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t kind;              // enum plc_telemetry_kind
+    uint32_t payload_size;
+    uint32_t checksum;          // FNV-1a of the payload
+    uint64_t saved_ns;
+    uint64_t generation;        // The slot with the highest generation is the newest
+    uint8_t peer[6];            // DST of the element, zero if none
+    uint8_t reserved[2];
+    char element[64];
+};
+
+class PLCCheckpoint { public:
+
+    PLCCheckpoint()
+        : _mem(0), _size(0), _slot_size(0), _generation(0) {
+    }
+    ~PLCCheckpoint() {
+        close();
+    }
+
+    bool active() const                 { return _mem != 0; }
+
+    // Maps filename, creating it if needed; existing content is kept for load()
+    int open(const String &filename, uint16_t kind, const String &element,
+             const uint8_t *peer, uint32_t payload_size, ErrorHandler *errh) {
+        _kind = kind;
+        _payload_size = payload_size;
+        _slot_size = (sizeof(plc_checkpoint_header) + payload_size + 63) & ~63U;
+        _size = 2 * _slot_size;
+        memset(_peer, 0, sizeof(_peer));
+        if (peer)
+            memcpy(_peer, peer, 6);
+        memset(_element, 0, sizeof(_element));
+        strncpy(_element, element.c_str(), sizeof(_element) - 1);
+
+        int fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+            return errh->error("CHECKPOINT %s: %s", filename.c_str(), strerror(errno));
+        struct stat st;
+        if (fstat(fd, &st) < 0 || (st.st_size != (off_t) _size && ftruncate(fd, _size) < 0)) {
+            ::close(fd);
+            return errh->error("CHECKPOINT %s: %s", filename.c_str(), strerror(errno));
+        }
+        void *mem = mmap(0, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mem == MAP_FAILED)
+            return errh->error("CHECKPOINT %s: %s", filename.c_str(), strerror(errno));
+        _mem = (uint8_t *) mem;
+        return 0;
+    }
+
+    // Copies the newest valid slot to payload. Returns false if there is
+    // none, or, with a warning, if it is older than max_age_sec.
+    bool load(void *payload, uint32_t max_age_sec, ErrorHandler *errh) {
+        const plc_checkpoint_header *best = 0;
+        for (int i = 0; i < 2; i++) {
+            const plc_checkpoint_header *h = slot(i);
+            if (valid(h) && (!best || h->generation > best->generation))
+                best = h;
+        }
+        if (!best)
+            return false;
+        _generation = best->generation;
+        uint64_t age_ns = plc_now_ns() - best->saved_ns;
+        if (max_age_sec && age_ns > (uint64_t) max_age_sec * 1000000000) {
+            errh->warning("checkpoint is %u s old, starting cold", (unsigned) (age_ns / 1000000000));
+            return false;
+        }
+        memcpy(payload, best + 1, _payload_size);
+        return true;
+    }
+
+    // Writes payload to the older slot
+    void save(const void *payload) {
+        plc_checkpoint_header *h = slot(++_generation & 1);
+        h->magic = 0;
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        memcpy(h + 1, payload, _payload_size);
+        h->version = PLC_CHECKPOINT_VERSION;
+        h->kind = _kind;
+        h->payload_size = _payload_size;
+        h->checksum = checksum(h + 1, _payload_size);
+        h->saved_ns = plc_now_ns();
+        h->generation = _generation;
+        memcpy(h->peer, _peer, 6);
+        memcpy(h->element, _element, sizeof(h->element));
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        h->magic = PLC_CHECKPOINT_MAGIC;
+        msync(_mem, _size, MS_ASYNC);
+    }
+
+    template <typename T>
+    bool restore(PLCSnapshot<T> &snap, uint32_t max_age_sec, ErrorHandler *errh) {
+        T data;
+        if (!load(&data, max_age_sec, errh))
+            return false;
+        snap.begin_write() = data;
+        snap.end_write();
+        return true;
+    }
+
+    // Called on the timer thread, which need not be the writer of snap
+    template <typename T>
+    void save(const PLCSnapshot<T> &snap) {
+        T data;
+        if (snap.read(data))
+            save(&data);
+    }
+
+    // The state now belongs to another peer: the next saves are for it
+    void set_peer(const uint8_t *peer) {
+        memcpy(_peer, peer, 6);
+    }
+
+    void close() {
+        if (_mem) {
+            munmap(_mem, _size);
+            _mem = 0;
+        }
+    }
+
+private:
+    uint8_t *_mem;
+    uint32_t _size;
+    uint32_t _slot_size;
+    uint32_t _payload_size;
+    uint16_t _kind;
+    uint64_t _generation;
+    uint8_t _peer[6];
+    char _element[64];
+
+    plc_checkpoint_header *slot(int i) const {
+        return (plc_checkpoint_header *) (_mem + i * _slot_size);
+    }
+
+    bool valid(const plc_checkpoint_header *h) const {
+        return h->magic == PLC_CHECKPOINT_MAGIC
+            && h->version == PLC_CHECKPOINT_VERSION
+            && h->kind == _kind
+            && h->payload_size == _payload_size
+            && memcmp(h->peer, _peer, 6) == 0
+            && strncmp(h->element, _element, sizeof(h->element)) == 0
+            && h->checksum == checksum(h + 1, _payload_size);
+    }
+
+    static uint32_t checksum(const void *data, uint32_t len) {
+        const uint8_t *p = (const uint8_t *) data;
+        uint32_t h = 2166136261U;
+        for (uint32_t i = 0; i < len; i++)
+            h = (h ^ p[i]) * 16777619U;
+        return h;
+    }
+};
+
+CLICK_ENDDECLS
+#endif
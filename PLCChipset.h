@@ -0,0 +1,164 @@
+#ifndef CLICKNET_PLCCHIPSET_H
+#define CLICKNET_PLCCHIPSET_H
+#include <click/packet.hh>
+#include <click/string.hh>
+#include <clicknet/ether.h>
+#include "PLCStats.h"
+CLICK_DECLS
+
+/*
+ * Chipset profiles.
+ *
+ * Every profile is a policy type holding the constants of one family of PLC
+ * devices: the vendor OUI and management address used by the MMEs, the
+ * header versions and the PHY constants used to turn a tonemap into a rate.
+ * Elements select a profile per instance with the CHIPSET keyword; the code
+ * that depends on the PHY constants, and the request builders of
+ * PhyRatesReq, TonemapReq and ErrorStatsReq, are instantiated per profile,
+ * so neither the per-reply nor the per-request path looks the chipset up.
+ *
+ * To add a profile, define its policy type and append it to PLCChipsets.
+ */
+
+// INT6400 and compatible HomePlug AV 1.1 devices (the devices of the original tests)
+struct PLCChipsetINT6400 {
+    static constexpr const char *name = "INT6400";
+    static constexpr uint8_t oui[3] = {0x00, 0xB0, 0x52};
+    static constexpr uint8_t mme_dst[6] = {0x00, 0xB0, 0x52, 0x00, 0x00, 0x01};
+    static constexpr uint8_t vendor_version = 0x00;     // Header version of vendor-specific MMEs
+    static constexpr uint8_t std_version = HP_AV_VERSION;    // Header version of standard MMEs
+    static constexpr uint16_t max_carriers = 1155;      // Carriers in 1.8-30 MHz
+    static constexpr uint32_t symbol_ns = 40960 + 5560; // Symbol plus guard interval in ns
+    static constexpr uint32_t fec_num = 16;             // FEC code rate 16/21
+    static constexpr uint32_t fec_den = 21;
+};
+
+// QCA7420 (HomePlug AV500): same timing as AV 1.1, band extended to 68 MHz
+struct PLCChipsetQCA7420 {
+    static constexpr const char *name = "QCA7420";
+    static constexpr uint8_t oui[3] = {0x00, 0xB0, 0x52};
+    static constexpr uint8_t mme_dst[6] = {0x00, 0xB0, 0x52, 0x00, 0x00, 0x01};
+    static constexpr uint8_t vendor_version = 0x00;
+    static constexpr uint8_t std_version = HP_AV_VERSION;
+    static constexpr uint16_t max_carriers = 2690;
+    static constexpr uint32_t symbol_ns = 40960 + 5560;
+    static constexpr uint32_t fec_num = 16;
+    static constexpr uint32_t fec_den = 21;
+};
+
+// QCA7500 (HomePlug AV2): band up to 86 MHz, shorter guard interval, FEC rate 16/18
+struct PLCChipsetQCA7500 {
+    static constexpr const char *name = "QCA7500";
+    static constexpr uint8_t oui[3] = {0x00, 0xB0, 0x52};
+    static constexpr uint8_t mme_dst[6] = {0x00, 0xB0, 0x52, 0x00, 0x00, 0x01};
+    static constexpr uint8_t vendor_version = 0x00;
+    static constexpr uint8_t std_version = HP_AV_VERSION;
+    static constexpr uint16_t max_carriers = 3455;
+    static constexpr uint32_t symbol_ns = 40960 + 4960;
+    static constexpr uint32_t fec_num = 16;
+    static constexpr uint32_t fec_den = 18;
+};
+
+template <typename... Chips> struct PLCChipsetList {};
+typedef PLCChipsetList<PLCChipsetINT6400, PLCChipsetQCA7420, PLCChipsetQCA7500> PLCChipsets;
+typedef PLCChipsetINT6400 PLCDefaultChipset;
+#define PLC_MAX_CARRIERS 4096   // At least max_carriers of every profile
+
+template <typename... Chips>
+static constexpr bool plc_chipsets_fit(PLCChipsetList<Chips...>) {
+    return (true && ... && (Chips::max_carriers <= PLC_MAX_CARRIERS));
+}
+static_assert(plc_chipsets_fit(PLCChipsets()), "PLC_MAX_CARRIERS is below the max_carriers of a chipset");
+
+
+// PHY rate in Mbps of a tonemap carrying bits_per_symbol bits per OFDM symbol:
+// FEC rate times bits per symbol divided by the symbol duration in us.
+template <typename Chip>
+static inline double plc_phy_rate(uint32_t bits_per_symbol) {
+    constexpr double scale = (double) Chip::fec_num / Chip::fec_den * 1000.0 / Chip::symbol_ns;
+    return scale * bits_per_symbol;
+}
+
+
+// Run-time view of a profile, for the code that only needs its constants
+// (building requests, printing). One instance per profile.
+struct PLCChipset {
+    const char *name;
+    const uint8_t *oui;
+    const uint8_t *mme_dst;
+    uint8_t vendor_version;
+    uint8_t std_version;
+    uint16_t max_carriers;
+};
+
+template <typename Chip>
+struct PLCChipsetInfo {
+    static constexpr PLCChipset info = {
+        Chip::name, Chip::oui, Chip::mme_dst, Chip::vendor_version, Chip::std_version, Chip::max_carriers
+    };
+};
+
+
+// Calls f(Chip()) for the profile called name. Returns false if there is none.
+template <typename F>
+static inline bool plc_dispatch_chipset(const String &, F &&, PLCChipsetList<>) {
+    return false;
+}
+
+template <typename F, typename Chip, typename... Rest>
+static inline bool plc_dispatch_chipset(const String &name, F &&f, PLCChipsetList<Chip, Rest...>) {
+    if (name.equals(Chip::name, -1)) {
+        f(Chip());
+        return true;
+    }
+    return plc_dispatch_chipset(name, f, PLCChipsetList<Rest...>());
+}
+
+// Finds the constants of the profile called name, or returns NULL
+static inline const PLCChipset *plc_find_chipset(const String &name) {
+    const PLCChipset *chip = NULL;
+    plc_dispatch_chipset(name, [&](auto c) { chip = &PLCChipsetInfo<decltype(c)>::info; }, PLCChipsets());
+    return chip;
+}
+
+
+// Builds a management message for the device: Ethernet and HomePlug AV
+// headers filled in, payload zeroed. Vendor-specific messages start with the
+// OUI of the chipset. Returns NULL if the packet cannot be allocated.
+// The Ethernet header takes the last bytes of the default headroom, as if it
+// had been pushed onto the payload, which leaves default_headroom - 14 bytes
+// in front of it (TonemapReq and ErrorStatsReq used to leave all of the
+// default headroom in front of the header). The elements called with a
+// chipset known at compile time pass &PLCChipsetInfo<Chip>::info, so that
+// the constants are folded into the request.
+static inline WritablePacket *plc_make_mme(const PLCChipset *chip, const uint8_t *src,
+                                           uint16_t mmtype, bool vendor, uint32_t payload_len) {
+    static_assert(Packet::default_headroom >= sizeof(click_ether));
+    uint32_t len = sizeof(click_ether) + sizeof(click_hp_av_header) + payload_len;
+    WritablePacket *q = Packet::make(Packet::default_headroom - sizeof(click_ether), NULL, len, 0);
+    if (!q)
+        return NULL;
+
+    click_ether *e = (click_ether *) q->data();
+    q->set_ether_header(e);
+    if (src)
+        memcpy(e->ether_shost, src, 6);
+    else
+        memset(e->ether_shost, 0x00, 6);
+    memcpy(e->ether_dhost, chip->mme_dst, 6);
+    e->ether_type = htons(ETHERTYPE_HP_AV);
+
+    click_hp_av_header *hpavh = (click_hp_av_header *) (e + 1);
+    hpavh->version = vendor ? chip->vendor_version : chip->std_version;
+    hpavh->MMType = htons(mmtype);
+
+    uint8_t *payload = (uint8_t *) (hpavh + 1);
+    memset(payload, 0, payload_len);
+    if (vendor)
+        memcpy(payload, chip->oui, 3);
+    q->timestamp_anno().assign_now();
+    return q;
+}
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,46 @@
+#ifndef CLICKNET_PLCHISTOGRAM_H
+#define CLICKNET_PLCHISTOGRAM_H
+#include <click/straccum.hh>
+CLICK_DECLS
+
+/*
+ * Log-bucketed histogram with four sub-buckets per power of two.
+ * Values below 8 have a bucket each; above, bucket b covers the values
+ * [(4 + b % 4) << s, (5 + b % 4) << s) with s = b / 4 - 1, i.e. a relative
+ * width of 25% at most. Recording is a handful of integer instructions.
+ */
+
+#define PLC_HIST_BUCKETS 64
+
+static inline uint32_t plc_log_bucket(uint32_t v) {
+    uint32_t msb = 31 - __builtin_clz(v | 1);
+    uint32_t shift = msb > 2 ? msb - 2 : 0;
+    uint32_t b = (shift << 2) + (v >> shift);
+    return b < PLC_HIST_BUCKETS ? b : PLC_HIST_BUCKETS - 1;
+}
+
+// Smallest value that falls in bucket b
+static inline uint32_t plc_log_bucket_low(uint32_t b) {
+    return b < 8 ? b : (4 + (b & 3)) << ((b >> 2) - 1);
+}
+
+struct PLCLogHistogram {
+    uint32_t count[PLC_HIST_BUCKETS];
+
+    void clear() {
+        memset(count, 0, sizeof(count));
+    }
+    void add(uint32_t v) {
+        count[plc_log_bucket(v)]++;
+    }
+
+    // Appends the non-empty buckets as "low:count" pairs
+    void unparse(StringAccum &sa) const {
+        for (int b = 0; b < PLC_HIST_BUCKETS; b++)
+            if (count[b])
+                sa << ' ' << plc_log_bucket_low(b) << ':' << count[b];
+    }
+};
+
+CLICK_ENDDECLS
+#endif
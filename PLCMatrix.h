@@ -0,0 +1,108 @@
+#ifndef CLICKNET_PLCMATRIX_H
+#define CLICKNET_PLCMATRIX_H
+#include <click/straccum.hh>
+#include "PLCSnapshot.h"
+CLICK_DECLS
+
+/*
+ * All-pairs link matrix, by TEI.
+ *
+ * The frame control of every overheard MPDU gives its source and
+ * destination TEI and the bit-loading estimate (BLE) of the tonemap the
+ * source uses towards the destination, i.e. the capacity of that link as
+ * seen by its transmitter. The matrix keeps, for each of the 256 x 256
+ * (STEI, DTEI) pairs, a moving average of the BLE updated on every MPDU, so
+ * the capacity between any two stations is known without sending an MME.
+ *
+ * The matrix is dense and row-major by STEI: a cell is 8 bytes, eight cells
+ * share a cache line, and the MPDUs of a burst of one transmitter touch the
+ * same row. An update is a shift and an add. Broadcast frames (DTEI 0xFF),
+ * sent with robust modulations, say nothing of the link and are skipped.
+ *
+ * Every row has its own sequence number, as in PLCSnapshot.h, and readers
+ * copy the matrix row by row: a row is copied again only if its transmitter
+ * sent an MPDU during the copy of that row, so readers are not starved by
+ * the traffic. There must be a single writer.
+ */
+
+#define PLC_MATRIX_TEIS         256
+
+struct PLCLinkCell {
+    uint32_t ble;               // Moving average of the BLE in 1/8192 Mbps
+    uint32_t seen;              // Second of the last MPDU, 0 if none
+};
+
+class PLCLinkMatrix { public:
+
+    PLCLinkMatrix()
+        : _cells(0), _seq(0), _shift(4) {
+    }
+    ~PLCLinkMatrix() {
+        delete[] _cells;
+        delete[] _seq;
+    }
+
+    // The average takes 1/2^shift of every new MPDU
+    bool init(uint32_t shift) {
+        _shift = shift;
+        _cells = new PLCLinkCell[PLC_MATRIX_TEIS * PLC_MATRIX_TEIS]();
+        _seq = new uint32_t[PLC_MATRIX_TEIS]();
+        return _cells && _seq;
+    }
+    bool active() const                 { return _cells; }
+
+    // Writer side: an MPDU from stei to dtei with BLE ble_q5 (1/32 Mbps)
+    void update(uint8_t stei, uint8_t dtei, uint32_t ble_q5, uint32_t now_sec) {
+        if (dtei == 0xFF)
+            return;
+        PLCLinkCell &c = _cells[stei << 8 | dtei];
+        int32_t v = ble_q5 << 8;
+        __atomic_store_n(&_seq[stei], _seq[stei] + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        if (c.seen)
+            c.ble += (v - (int32_t) c.ble) >> _shift;
+        else
+            c.ble = v;
+        c.seen = now_sec;
+        __atomic_store_n(&_seq[stei], _seq[stei] + 1, __ATOMIC_RELEASE);
+    }
+
+    // Reader side: copies the matrix into out, row by row. Returns false if
+    // a row stayed busy for too long.
+    bool copy(PLCLinkCell *out) const {
+        for (int r = 0; r < PLC_MATRIX_TEIS; r++) {
+            const PLCLinkCell *row = _cells + r * PLC_MATRIX_TEIS;
+            int i = 0;
+            for (; i < PLC_SNAPSHOT_READ_TRIES; i++) {
+                uint32_t s1 = __atomic_load_n(&_seq[r], __ATOMIC_ACQUIRE);
+                if (s1 & 1)
+                    continue;
+                memcpy(out + r * PLC_MATRIX_TEIS, (const void *) row, sizeof(PLCLinkCell) * PLC_MATRIX_TEIS);
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                if (__atomic_load_n(&_seq[r], __ATOMIC_RELAXED) == s1)
+                    break;
+            }
+            if (i == PLC_SNAPSHOT_READ_TRIES)
+                return false;
+        }
+        return true;
+    }
+
+    static double mbps(const PLCLinkCell &c) {
+        return c.ble / 8192.;
+    }
+
+    // Capacity from stei to dtei through relay: the two hops share the
+    // medium, so a bit takes 1/a + 1/b of the time
+    static double relay_mbps(const PLCLinkCell &a, const PLCLinkCell &b) {
+        return a.ble && b.ble ? 1 / (1 / mbps(a) + 1 / mbps(b)) : 0;
+    }
+
+private:
+    PLCLinkCell *_cells;
+    uint32_t *_seq;             // Per row (STEI), odd while a write is in progress
+    uint32_t _shift;
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,368 @@
+#ifndef CLICKNET_PLCPOLL_H
+#define CLICKNET_PLCPOLL_H
+#include <click/etheraddress.hh>
+#include <click/straccum.hh>
+#include <click/timestamp.hh>
+#include "PLCStats.h"
+#include "PLCView.h"
+#include "PLCChipset.h"
+#include "PLCSnapshot.h"
+CLICK_DECLS
+
+/*
+ * Polling code shared by PhyRatesReq, TonemapReq, ErrorStatsReq and
+ * PLCManager: the state kept per device, the requests, the update of the
+ * state from a reply and its text form. The functions only touch the state
+ * they are given, so that every device can be polled from its own thread.
+ */
+
+struct PhyRatesPeer {
+    uint8_t mac[6];
+    uint8_t tx;                 // Average PHY rate from STA to DA
+    uint8_t rx;                 // Average PHY rate from DA to STA
+};
+
+// Published by PhyRatesReq after every request and reply
+struct PhyRatesSnapshot {
+    uint64_t last_reply_ns;
+    uint32_t requests;
+    uint32_t replies;
+    uint32_t malformed;
+    uint32_t num_stas;
+    PhyRatesPeer peers[PLC_MAX_STAS];
+};
+
+struct TonemapSlotSnapshot {
+    uint64_t updated_ns;
+    uint32_t rate_kbps;         // PHY rate of the last tonemap of the slot
+    uint16_t num_act_carrier;
+    uint8_t num_tms;
+    uint8_t mstatus;
+};
+
+// Published by TonemapReq after every request and reply
+struct TonemapSnapshot {
+    uint32_t requests;
+    uint32_t replies;
+    uint32_t malformed;
+    uint32_t failures;          // Replies with an error status
+    TonemapSlotSnapshot slots[NUMBER_OF_SLOTS];
+};
+
+struct ErrorStatsTx {
+    uint64_t mpdu_ack;
+    uint64_t mpdu_coll;
+    uint64_t mpdu_fail;
+    uint64_t pb_pass;
+    uint64_t pb_fail;
+};
+
+struct ErrorStatsInterval {
+    uint64_t pb_pass;
+    uint64_t pb_fail;
+    uint64_t tbe_pass;
+    uint64_t tbe_fail;
+    uint32_t phyrate;
+    uint32_t reserved;
+};
+
+struct ErrorStatsRx {
+    uint64_t mpdu_ack;
+    uint64_t mpdu_fail;
+    uint64_t pb_pass;
+    uint64_t pb_fail;
+    uint64_t tbe_pass;
+    uint64_t tbe_fail;
+    uint32_t num_intervals;
+    uint32_t reserved;
+    ErrorStatsInterval intervals[PLC_MAX_RX_INTERVALS];
+};
+
+// Published by ErrorStatsReq after every request and reply. The counters
+// are the cumulative values of the last successful reply, the deltas their
+// increase since the reply before it (0 after a change of direction/link).
+struct ErrorStatsSnapshot {
+    uint64_t last_reply_ns;
+    uint32_t requests;
+    uint32_t replies;
+    uint32_t malformed;
+    uint32_t failures;          // Replies with an error status
+    uint8_t mstatus;
+    uint8_t direction;
+    uint8_t link_id;
+    uint8_t tei;
+    uint8_t has_tx;
+    uint8_t has_rx;
+    uint8_t reserved[2];
+    ErrorStatsTx tx;
+    ErrorStatsRx rx;
+    uint64_t delta_ns;          // Time between the last two replies
+    ErrorStatsTx tx_delta;
+    ErrorStatsRx rx_delta;
+};
+
+
+// Requests
+
+static inline WritablePacket *
+plc_make_nw_stats_req(const PLCChipset *chip, const uint8_t *src) {
+    return plc_make_mme(chip, src, NW_STATS_REQ, false, 0);
+}
+
+static inline WritablePacket *
+plc_make_tone_map_req(const PLCChipset *chip, const uint8_t *src, const uint8_t *dst, int slot) {
+    WritablePacket *q = plc_make_mme(chip, src, TONE_MAP_REQ, true, sizeof(click_hp_av_tone_map_req));
+    if (q) {
+        click_hp_av_tone_map_req *tm_req = (click_hp_av_tone_map_req *) (q->data() + PLCMMEView::header_size);
+        memcpy(tm_req->macaddr, dst, 6);
+        tm_req->tmslot = slot;
+    }
+    return q;
+}
+
+static inline WritablePacket *
+plc_make_error_stats_req(const PLCChipset *chip, const uint8_t *src, const uint8_t *dst,
+                         int link_id, int direction) {
+    WritablePacket *q = plc_make_mme(chip, src, ERROR_STATS_REQ, true, sizeof(click_hp_av_error_stats_req));
+    if (q) {
+        click_hp_av_error_stats_req *error_req = (click_hp_av_error_stats_req *) (q->data() + PLCMMEView::header_size);
+        memcpy(error_req->macaddr, dst, 6);
+        error_req->link_id = link_id;
+        error_req->direction = direction;
+        error_req->control = 0;
+    }
+    return q;
+}
+
+
+// Replies. Called between begin_write() and end_write() of the snapshot.
+
+static inline void
+plc_update_phy_rates(PhyRatesSnapshot &st, const PLCNwStatsConfView &nwstats, uint64_t now_ns) {
+    st.replies++;
+    st.last_reply_ns = now_ns;
+    st.num_stas = nwstats.num_stas();
+    for (uint32_t i = 0; i < nwstats.num_stas(); i++) {
+        const cm_sta_info &sta = nwstats.sta(i);
+        memcpy(st.peers[i].mac, sta.DA, 6);
+        st.peers[i].tx = sta.AvgPHYDR_TX;
+        st.peers[i].rx = sta.AvgPHYDR_RX;
+    }
+}
+
+// Counts a tonemap reply. Returns false if it carries no tonemap.
+static inline bool
+plc_count_tonemap_reply(TonemapSnapshot &st, const PLCToneMapRepView &tm_rep) {
+    st.replies++;
+    if (tm_rep.mstatus() != 0)
+        st.failures++;
+    if (tm_rep.tmslot() < NUMBER_OF_SLOTS)
+        st.slots[tm_rep.tmslot()].mstatus = tm_rep.mstatus();
+    return tm_rep.mstatus() == 0;
+}
+
+// PHY rate in Mbps of a tonemap on chipset Chip, 0 if it has no carriers
+template <typename Chip>
+static inline double
+plc_tonemap_rate(const PLCToneMapRepView &tm_rep) {
+    // Only walk the carriers that are present in the reply and exist on the chipset
+    uint32_t ncarriers = plc_min(tm_rep.ncarriers(), Chip::max_carriers);
+    uint32_t sum_bit_per_carrier = 0;
+    for (uint32_t i = 0; i < ncarriers; i++)
+        sum_bit_per_carrier += plc_modulation_bits[tm_rep.modulation(i) & 0x0F];
+    // FEC rate and symbol duration of the chipset
+    return ncarriers ? plc_phy_rate<Chip>(sum_bit_per_carrier) : 0;
+}
+
+static inline void
+plc_update_tonemap_slot(TonemapSnapshot &st, const PLCToneMapRepView &tm_rep, double rate, uint64_t now_ns) {
+    if (tm_rep.tmslot() >= NUMBER_OF_SLOTS)
+        return;
+    TonemapSlotSnapshot &slot = st.slots[tm_rep.tmslot()];
+    slot.updated_ns = now_ns;
+    slot.rate_kbps = (uint32_t) (rate * 1000);
+    slot.num_act_carrier = tm_rep.num_act_carrier();
+    slot.num_tms = tm_rep.num_tms();
+}
+
+static inline void
+plc_copy_tx_stats(ErrorStatsTx &out, const PLCTxLinkStatsView &tx) {
+    out.mpdu_ack = tx.mpdu_ack();
+    out.mpdu_coll = tx.mpdu_coll();
+    out.mpdu_fail = tx.mpdu_fail();
+    out.pb_pass = tx.pb_pass();
+    out.pb_fail = tx.pb_fail();
+}
+
+static inline void
+plc_copy_rx_stats(ErrorStatsRx &out, const PLCRxLinkStatsView &rx) {
+    out.mpdu_ack = rx.mpdu_ack();
+    out.mpdu_fail = rx.mpdu_fail();
+    out.pb_pass = rx.pb_pass();
+    out.pb_fail = rx.pb_fail();
+    out.tbe_pass = rx.tbe_pass();
+    out.tbe_fail = rx.tbe_fail();
+    out.num_intervals = plc_min(rx.num_rx_intervals(), PLC_MAX_RX_INTERVALS);
+    for (uint32_t i = 0; i < out.num_intervals; i++) {
+        PLCRxIntervalView slot = rx.interval(i);
+        out.intervals[i].pb_pass = slot.pb_pass();
+        out.intervals[i].pb_fail = slot.pb_fail();
+        out.intervals[i].tbe_pass = slot.tbe_pass();
+        out.intervals[i].tbe_fail = slot.tbe_fail();
+        out.intervals[i].phyrate = slot.phyrate();
+    }
+}
+
+// Increase of a cumulative counter; a counter that went backwards was reset
+static inline uint64_t
+plc_counter_delta(uint64_t now, uint64_t before) {
+    return now >= before ? now - before : now;
+}
+
+static inline void
+plc_diff_tx_stats(ErrorStatsTx &d, const ErrorStatsTx &now, const ErrorStatsTx &before) {
+    d.mpdu_ack = plc_counter_delta(now.mpdu_ack, before.mpdu_ack);
+    d.mpdu_coll = plc_counter_delta(now.mpdu_coll, before.mpdu_coll);
+    d.mpdu_fail = plc_counter_delta(now.mpdu_fail, before.mpdu_fail);
+    d.pb_pass = plc_counter_delta(now.pb_pass, before.pb_pass);
+    d.pb_fail = plc_counter_delta(now.pb_fail, before.pb_fail);
+}
+
+static inline void
+plc_diff_rx_stats(ErrorStatsRx &d, const ErrorStatsRx &now, const ErrorStatsRx &before) {
+    d.mpdu_ack = plc_counter_delta(now.mpdu_ack, before.mpdu_ack);
+    d.mpdu_fail = plc_counter_delta(now.mpdu_fail, before.mpdu_fail);
+    d.pb_pass = plc_counter_delta(now.pb_pass, before.pb_pass);
+    d.pb_fail = plc_counter_delta(now.pb_fail, before.pb_fail);
+    d.tbe_pass = plc_counter_delta(now.tbe_pass, before.tbe_pass);
+    d.tbe_fail = plc_counter_delta(now.tbe_fail, before.tbe_fail);
+    d.num_intervals = plc_min(now.num_intervals, before.num_intervals);
+    for (uint32_t i = 0; i < d.num_intervals; i++) {
+        d.intervals[i].pb_pass = plc_counter_delta(now.intervals[i].pb_pass, before.intervals[i].pb_pass);
+        d.intervals[i].pb_fail = plc_counter_delta(now.intervals[i].pb_fail, before.intervals[i].pb_fail);
+        d.intervals[i].tbe_pass = plc_counter_delta(now.intervals[i].tbe_pass, before.intervals[i].tbe_pass);
+        d.intervals[i].tbe_fail = plc_counter_delta(now.intervals[i].tbe_fail, before.intervals[i].tbe_fail);
+        d.intervals[i].phyrate = now.intervals[i].phyrate;
+    }
+}
+
+// Stores the counters of an error statistics reply and their increase.
+// Returns true if the deltas are valid, i.e. the previous reply was for the
+// same link.
+static inline bool
+plc_update_error_stats(ErrorStatsSnapshot &st, const PLCErrorStatsRepView &error_rep, uint64_t now_ns) {
+    st.replies++;
+    st.mstatus = error_rep.mstatus();
+    if (error_rep.mstatus() != HPAV_SUC) {
+        st.failures++;
+        return false;
+    }
+    // Deltas only make sense against a reply for the same link of the same peer
+    bool same_link = st.last_reply_ns && st.direction == error_rep.direction()
+        && st.link_id == error_rep.link_id() && st.tei == error_rep.tei();
+    st.delta_ns = same_link ? now_ns - st.last_reply_ns : 0;
+    st.last_reply_ns = now_ns;
+    st.direction = error_rep.direction();
+    st.link_id = error_rep.link_id();
+    st.tei = error_rep.tei();
+    if ((st.has_tx = error_rep.has_tx())) {
+        ErrorStatsTx before = st.tx;
+        plc_copy_tx_stats(st.tx, error_rep.tx());
+        if (same_link)
+            plc_diff_tx_stats(st.tx_delta, st.tx, before);
+        else
+            memset(&st.tx_delta, 0, sizeof(st.tx_delta));
+    }
+    if ((st.has_rx = error_rep.has_rx())) {
+        ErrorStatsRx before = st.rx;
+        plc_copy_rx_stats(st.rx, error_rep.rx());
+        if (same_link)
+            plc_diff_rx_stats(st.rx_delta, st.rx, before);
+        else
+            memset(&st.rx_delta, 0, sizeof(st.rx_delta));
+    }
+    return same_link;
+}
+
+
+// Forget the state of the previous peer after a change of DST; the counts
+// of requests and replies go on
+static inline void
+plc_reset_tonemap_peer(TonemapSnapshot &st) {
+    memset(st.slots, 0, sizeof(st.slots));
+}
+
+static inline void
+plc_reset_error_stats_peer(ErrorStatsSnapshot &st) {
+    size_t from = offsetof(ErrorStatsSnapshot, mstatus);
+    memset((uint8_t *) &st + from, 0, sizeof(st) - from);
+    st.last_reply_ns = 0;
+}
+
+
+// Text form of the snapshots, as printed by the "stats" handlers
+
+static inline void
+plc_unparse_phy_rates(StringAccum &sa, const PhyRatesSnapshot &st) {
+    sa << "requests " << st.requests << "\n"
+       << "replies " << st.replies << "\n"
+       << "malformed " << st.malformed << "\n"
+       << "last_reply " << Timestamp::make_nsec(st.last_reply_ns).unparse() << "\n"
+       << "stations " << st.num_stas << "\n";
+    for (uint32_t i = 0; i < st.num_stas; i++)
+        sa << EtherAddress(st.peers[i].mac).unparse() << " tx " << (int) st.peers[i].tx
+           << " rx " << (int) st.peers[i].rx << "\n";
+}
+
+static inline void
+plc_unparse_tonemap(StringAccum &sa, const TonemapSnapshot &st) {
+    sa << "requests " << st.requests << "\n"
+       << "replies " << st.replies << "\n"
+       << "malformed " << st.malformed << "\n"
+       << "failures " << st.failures << "\n";
+    for (int i = 0; i < NUMBER_OF_SLOTS; i++) {
+        const TonemapSlotSnapshot &slot = st.slots[i];
+        sa << "slot " << i << " status " << (int) slot.mstatus << " rate_kbps " << slot.rate_kbps
+           << " carriers " << slot.num_act_carrier << " tms " << (int) slot.num_tms
+           << " updated " << Timestamp::make_nsec(slot.updated_ns).unparse() << "\n";
+    }
+}
+
+static inline void
+plc_unparse_error_stats(StringAccum &sa, const ErrorStatsSnapshot &st) {
+    sa << "requests " << st.requests << "\n"
+       << "replies " << st.replies << "\n"
+       << "malformed " << st.malformed << "\n"
+       << "failures " << st.failures << "\n"
+       << "status " << (int) st.mstatus << "\n"
+       << "tei " << (int) st.tei << "\n"
+       << "link_id " << (int) st.link_id << "\n"
+       << "last_reply " << Timestamp::make_nsec(st.last_reply_ns).unparse() << "\n";
+    sa << "delta " << Timestamp::make_nsec(st.delta_ns).unparse_interval() << "\n";
+    if (st.has_tx)
+        sa << "tx_delta mpdu_ack " << st.tx_delta.mpdu_ack << " mpdu_coll " << st.tx_delta.mpdu_coll
+           << " mpdu_fail " << st.tx_delta.mpdu_fail << " pb_pass " << st.tx_delta.pb_pass
+           << " pb_fail " << st.tx_delta.pb_fail << "\n";
+    if (st.has_rx)
+        sa << "rx_delta mpdu_ack " << st.rx_delta.mpdu_ack << " mpdu_fail " << st.rx_delta.mpdu_fail
+           << " pb_pass " << st.rx_delta.pb_pass << " pb_fail " << st.rx_delta.pb_fail
+           << " tbe_pass " << st.rx_delta.tbe_pass << " tbe_fail " << st.rx_delta.tbe_fail << "\n";
+    if (st.has_tx)
+        sa << "tx mpdu_ack " << st.tx.mpdu_ack << " mpdu_coll " << st.tx.mpdu_coll
+           << " mpdu_fail " << st.tx.mpdu_fail << " pb_pass " << st.tx.pb_pass
+           << " pb_fail " << st.tx.pb_fail << "\n";
+    if (st.has_rx) {
+        sa << "rx mpdu_ack " << st.rx.mpdu_ack << " mpdu_fail " << st.rx.mpdu_fail
+           << " pb_pass " << st.rx.pb_pass << " pb_fail " << st.rx.pb_fail
+           << " tbe_pass " << st.rx.tbe_pass << " tbe_fail " << st.rx.tbe_fail << "\n";
+        for (uint32_t i = 0; i < st.rx.num_intervals; i++) {
+            const ErrorStatsInterval &slot = st.rx.intervals[i];
+            sa << "rx slot " << i << " phyrate " << slot.phyrate << " pb_pass " << slot.pb_pass
+               << " pb_fail " << slot.pb_fail << " tbe_pass " << slot.tbe_pass
+               << " tbe_fail " << slot.tbe_fail << "\n";
+        }
+    }
+}
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,177 @@
+#ifndef CLICKNET_PLCRECONFIG_H
+#define CLICKNET_PLCRECONFIG_H
+#include <click/sync.hh>
+#include <click/etheraddress.hh>
+CLICK_DECLS
+
+/*
+ * Live reconfiguration.
+ *
+ * Write handlers change what a running element polls (its DST, PRIORITY,
+ * DIRECTION, tonemap slots) and how often, without a hot-swap: the
+ * snapshots, latency histograms, store series and checkpoint of the element
+ * stay as they are. A handler, on any thread, edits a staged copy of the
+ * settings; the element takes the staged copy at its next timer tick,
+ * before it sends the requests of that poll. All the changes written
+ * between two ticks therefore apply together, and never in the middle of a
+ * poll or of the processing of a reply.
+ *
+ * A new DST does not apply to the requests already in flight. The replies
+ * name no peer, so PLCPeerSwitch tells the replies of the previous DST
+ * from those of the new one by counting them: the local modem answers in
+ * order, so after a change, as many replies as requests were sent before it
+ * are from the previous DST and are dropped. A reply lost before the change
+ * makes a reply of the new DST be dropped in its place; so that losses do
+ * not add up, the count is only trusted for PLC_PEER_SWITCH_MS after the
+ * change and then starts over. The timer thread sends the requests and
+ * changes the DST; the thread running push() keeps its own copy of the DST
+ * and resets the per-peer state of the element, so that each side only
+ * writes its own state.
+ */
+
+#define PLC_PEER_SWITCH_MS      1000
+
+template <typename T>
+class PLCStaged { public:
+
+    PLCStaged()
+        : _pending(false) {
+    }
+
+    // Settings in use at initialization
+    void init(const T &v) {
+        _active = _staged = v;
+    }
+
+    // Handler side: calls f on the staged settings, or on a copy of the
+    // active ones if nothing is staged. The result is staged unless f
+    // returns a negative error.
+    template <typename F>
+    int modify(F f) {
+        _lock.acquire();
+        T v = _pending ? _staged : _active;
+        int r = f(v);
+        if (r >= 0) {
+            _staged = v;
+            __atomic_store_n(&_pending, true, __ATOMIC_RELEASE);
+        }
+        _lock.release();
+        return r;
+    }
+
+    // Settings in use, for the read handlers
+    T active() const {
+        _lock.acquire();
+        T v = _active;
+        _lock.release();
+        return v;
+    }
+
+    // Timer side: returns true with the staged settings if there are any,
+    // which become the active ones
+    bool take(T &v) {
+        if (!__atomic_load_n(&_pending, __ATOMIC_ACQUIRE))
+            return false;
+        _lock.acquire();
+        v = _active = _staged;
+        _pending = false;
+        _lock.release();
+        return true;
+    }
+
+private:
+    mutable Spinlock _lock;
+    T _active;
+    T _staged;
+    bool _pending;
+};
+
+class PLCPeerSwitch { public:
+
+    PLCPeerSwitch()
+        : _sent(0), _gen(0), _stale_until(0), _deadline_ns(0),
+          _received(0), _reply_gen(0), _reply_stale_until(0), _reply_deadline_ns(0), _dropped(0) {
+    }
+
+    // DST at initialization
+    void init(const EtherAddress &dst) {
+        _dst = _reply_dst = dst;
+    }
+
+    // Timer side: counts a request
+    void sent() {
+        __atomic_store_n(&_sent, _sent + 1, __ATOMIC_RELAXED);
+    }
+    // Requests sent so far, on any thread
+    uint64_t requests() const {
+        return __atomic_load_n(&_sent, __ATOMIC_RELAXED);
+    }
+
+    // Timer side: the requests sent from now on go to dst
+    void change(const EtherAddress &dst, int64_t now_ns) {
+        _lock.acquire();
+        _dst = dst;
+        _stale_until = _sent;
+        _deadline_ns = now_ns + PLC_PEER_SWITCH_MS * 1000000LL;
+        __atomic_store_n(&_gen, _gen + 1, __ATOMIC_RELEASE);
+        _lock.release();
+    }
+    // False from a change until the push side has taken it, while the state
+    // of the element is still that of the previous DST
+    bool settled() const {
+        return __atomic_load_n(&_reply_gen, __ATOMIC_ACQUIRE) == __atomic_load_n(&_gen, __ATOMIC_ACQUIRE);
+    }
+
+    // Push side, for every reply: returns false if it answers a request sent
+    // to a previous DST. Sets changed on the first reply after a change; the
+    // element then resets its per-peer state.
+    bool reply(int64_t now_ns, bool &changed) {
+        changed = false;
+        _received++;
+        if (__atomic_load_n(&_gen, __ATOMIC_ACQUIRE) != _reply_gen) {
+            _lock.acquire();
+            _reply_dst = _dst;
+            _reply_stale_until = _stale_until;
+            _reply_deadline_ns = _deadline_ns;
+            __atomic_store_n(&_reply_gen, _gen, __ATOMIC_RELEASE);
+            _lock.release();
+            changed = true;
+        }
+        if (_received <= _reply_stale_until) {
+            if (now_ns < _reply_deadline_ns) {
+                __atomic_store_n(&_dropped, _dropped + 1, __ATOMIC_RELAXED);
+                return false;
+            }
+            // Replies were lost: count from here
+            _received = _reply_stale_until + 1;
+        }
+        return true;
+    }
+    // Push side: the DST of the replies
+    const EtherAddress &dst() const {
+        return _reply_dst;
+    }
+    // Replies dropped, on any thread
+    uint64_t dropped() const {
+        return __atomic_load_n(&_dropped, __ATOMIC_RELAXED);
+    }
+
+private:
+    Spinlock _lock;
+    // Timer side
+    uint64_t _sent;
+    uint64_t _gen;              // Changes of DST
+    uint64_t _stale_until;      // Requests sent before the last change
+    int64_t _deadline_ns;
+    EtherAddress _dst;
+    // Push side
+    uint64_t _received;
+    uint64_t _reply_gen;
+    uint64_t _reply_stale_until;
+    int64_t _reply_deadline_ns;
+    EtherAddress _reply_dst;
+    uint64_t _dropped;
+};
+
+CLICK_ENDDECLS
+#endif
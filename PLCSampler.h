@@ -0,0 +1,225 @@
+#ifndef CLICKNET_PLCSAMPLER_H
+#define CLICKNET_PLCSAMPLER_H
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/straccum.hh>
+#include <click/timestamp.hh>
+CLICK_DECLS
+
+/*
+ * High-frequency sampling of the request elements.
+ *
+ * Impulsive noise follows the mains cycle (10 ms at 50 Hz), so ErrorStatsReq
+ * and TonemapReq may poll every few milliseconds. At that rate the replies
+ * cannot be formatted as they arrive: with SAMPLES, every reply is stored as
+ * one fixed 64-byte record in a ring allocated at initialization, a copy of
+ * the counters with no formatting and no allocation, and the handlers format
+ * whole ranges when they are read.
+ *
+ * The index of a record is its number from 1. A reader asks for the records
+ * from an index on and continues from the last index it got plus one; a
+ * reader that falls more than a ring behind sees the gap in the indices.
+ * There must be a single writer.
+ *
+ * PLCTickClock schedules a periodic timer at a fixed period from its
+ * previous expiry rather than from the end of the hook, so that the period
+ * does not drift by the run time of the hook. Ticks missed by more than a
+ * period are skipped and counted rather than run in a burst.
+ */
+
+#define PLC_SAMPLE_ERRORSTATS   1
+#define PLC_SAMPLE_TONEMAP      2
+#define PLC_SAMPLE_HAS_TX       0x01
+#define PLC_SAMPLE_HAS_RX       0x02
+#define PLC_SAMPLE_VALUES       10
+#define PLC_SAMPLE_READ_CHUNK   256
+#define PLC_SAMPLE_MAX_DEPTH    (1U << 24)  // Records, 1 GB
+
+// In host byte order. PLC_SAMPLE_ERRORSTATS values: the increase of the TX
+// MPDUs acked, collided, failed, PBs passed and failed, then of the RX MPDUs
+// acked, failed, PBs passed, failed and turbo error bits failed since the
+// previous reply (saturated). PLC_SAMPLE_TONEMAP values: PHY rate in kbps,
+// active carriers and number of tonemaps of the slot.
+struct click_plc_sample {
+    uint64_t index;
+    uint64_t time_ns;
+    uint32_t delta_us;          // Since the previous reply of the stream, 0 if none
+    uint8_t kind;
+    uint8_t slot;
+    uint8_t status;             // MSTATUS of the reply
+    uint8_t flags;
+    uint32_t v[PLC_SAMPLE_VALUES];
+};
+
+static_assert(sizeof(click_plc_sample) == 64, "the binary sample format is 64 bytes");
+
+static inline uint32_t plc_sample_value(uint64_t x) {
+    return x > 0xFFFFFFFFULL ? 0xFFFFFFFFU : x;
+}
+
+class PLCSampleRing { public:
+
+    PLCSampleRing()
+        : _ring(0), _mask(0), _count(0) {
+    }
+    ~PLCSampleRing() {
+        delete[] _ring;
+    }
+
+    // Allocates at least depth records (at most PLC_SAMPLE_MAX_DEPTH),
+    // rounded up to a power of two
+    bool init(uint32_t depth) {
+        uint32_t n = 2;
+        while (n < depth && n < PLC_SAMPLE_MAX_DEPTH)
+            n <<= 1;
+        delete[] _ring;
+        _ring = new click_plc_sample[n]();
+        _mask = n - 1;
+        return _ring;
+    }
+    bool active() const                 { return _ring; }
+    uint32_t depth() const              { return _mask + 1; }
+
+    // Writer side: the record to fill for the next sample, then publish()
+    click_plc_sample &next() {
+        click_plc_sample &s = _ring[(_count + 1) & _mask];
+        s.index = _count + 1;
+        return s;
+    }
+    void publish() {
+        __atomic_store_n(&_count, _count + 1, __ATOMIC_RELEASE);
+    }
+
+    // Reader side: index of the newest record, 0 if none
+    uint64_t newest() const {
+        return __atomic_load_n(&_count, __ATOMIC_ACQUIRE);
+    }
+
+    // Copies up to max records from index from on (or from the oldest one
+    // still in the ring). Returns the number copied; out[0].index is the
+    // first one.
+    uint32_t read(uint64_t from, click_plc_sample *out, uint32_t max) const {
+        uint64_t n = newest();
+        if (!_ring || n == 0)
+            return 0;
+        if (from + _mask <= n)
+            from = n - _mask + 1;
+        if (from == 0)
+            from = 1;
+        uint32_t k = 0;
+        for (; from + k <= n && k < max; k++)
+            memcpy(&out[k], (const void *) &_ring[(from + k) & _mask], sizeof(click_plc_sample));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        // Drop the records that the writer may have started to overwrite
+        // while they were copied: the writer is at most at count + 1
+        uint64_t c = __atomic_load_n(&_count, __ATOMIC_RELAXED);
+        uint64_t valid = c + 1 > _mask ? c + 1 - _mask : 1;
+        if (valid > from) {
+            uint32_t skip = valid - from < k ? valid - from : k;
+            memmove(out, out + skip, (k - skip) * sizeof(click_plc_sample));
+            k -= skip;
+        }
+        return k;
+    }
+
+    // Read handler argument "[FROM] [FORMAT]": the records from index FROM
+    // (default: all) as CSV lines "index,time,delta_us,slot,status,flags,
+    // values..." or, with FORMAT binary, as the records themselves
+    int unparse(const Element *e, const String &arg, String &result, ErrorHandler *errh) const {
+        uint64_t from = 0;
+        String format = "csv";
+        if (Args(e, errh).push_back_words(arg)
+                         .read_p("FROM", from)
+                         .read_p("FORMAT", WordArg(), format)
+                         .complete() < 0)
+            return -1;
+        bool binary = (format == "binary");
+        if (!binary && format != "csv")
+            return errh->error("FORMAT must be csv or binary");
+        if (!_ring)
+            return errh->error("no samples, SAMPLES is 0");
+        click_plc_sample chunk[PLC_SAMPLE_READ_CHUNK];
+        StringAccum sa;
+        uint32_t k;
+        uint64_t end = newest();
+        while (from <= end && (k = read(from, chunk, PLC_SAMPLE_READ_CHUNK))) {
+            if (binary)
+                sa.append((const char *) chunk, k * sizeof(click_plc_sample));
+            else
+                for (uint32_t i = 0; i < k; i++) {
+                    const click_plc_sample &s = chunk[i];
+                    sa << s.index << ',' << Timestamp::make_nsec(s.time_ns) << ',' << s.delta_us << ','
+                       << (int) s.slot << ',' << (int) s.status << ',' << (int) s.flags;
+                    for (int j = 0; j < PLC_SAMPLE_VALUES; j++)
+                        sa << ',' << s.v[j];
+                    sa << '\n';
+                }
+            from = chunk[k - 1].index + 1;
+        }
+        result = sa.take_string();
+        return 0;
+    }
+
+private:
+    click_plc_sample *_ring;
+    uint64_t _mask;
+    uint64_t _count;            // Records written
+};
+
+class PLCTickClock { public:
+
+    PLCTickClock()
+        : _ticks(0), _skipped(0), _max_late_us(0) {
+    }
+
+    // Expiry of the tick after the one that expired at expiry
+    Timestamp next(const Timestamp &expiry, uint32_t interval_ms) {
+        return Timestamp::make_nsec(next_ns(expiry.nsecval(), Timestamp::now().nsecval(), interval_ms));
+    }
+
+    // The same in nanoseconds; at is 0 before the first tick
+    int64_t next_ns(int64_t at, int64_t now, uint32_t interval_ms) {
+        int64_t period = (int64_t) interval_ms * 1000000;
+        if (at <= 0 || now - at > 1000 * period)
+            at = now;               // First tick, or the clock jumped
+        uint64_t late_us = now > at ? (now - at) / 1000 : 0;
+        if (late_us > _max_late_us)
+            __atomic_store_n(&_max_late_us, late_us, __ATOMIC_RELAXED);
+        at += period;
+        if (at <= now) {
+            uint64_t missed = (now - at) / period + 1;
+            at += missed * period;
+            __atomic_store_n(&_skipped, _skipped + missed, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&_ticks, _ticks + 1, __ATOMIC_RELAXED);
+        return at;
+    }
+
+    uint64_t ticks() const              { return __atomic_load_n(&_ticks, __ATOMIC_RELAXED); }
+    uint64_t skipped() const            { return __atomic_load_n(&_skipped, __ATOMIC_RELAXED); }
+
+    void unparse(StringAccum &sa) const {
+        sa << "ticks " << __atomic_load_n(&_ticks, __ATOMIC_RELAXED) << "\n"
+           << "skipped " << __atomic_load_n(&_skipped, __ATOMIC_RELAXED) << "\n"
+           << "max_late_us " << __atomic_load_n(&_max_late_us, __ATOMIC_RELAXED) << "\n";
+    }
+
+private:
+    uint64_t _ticks;
+    uint64_t _skipped;          // Ticks missed by more than a period
+    uint64_t _max_late_us;
+};
+
+// Text of the "sampling" handlers
+static inline String
+plc_unparse_sampling(uint32_t interval_ms, const PLCTickClock &clock, const PLCSampleRing &samples) {
+    StringAccum sa;
+    sa << "interval_ms " << interval_ms << "\n";
+    clock.unparse(sa);
+    sa << "samples " << samples.newest() << "\n"
+       << "depth " << (samples.active() ? samples.depth() : 0) << "\n";
+    return sa.take_string();
+}
+
+CLICK_ENDDECLS
+#endif
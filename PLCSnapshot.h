@@ -0,0 +1,118 @@
+#ifndef CLICKNET_PLCSNAPSHOT_H
+#define CLICKNET_PLCSNAPSHOT_H
+#include <click/glue.hh>
+#include <click/timestamp.hh>
+CLICK_DECLS
+
+/*
+ * Sequence-locked statistics snapshot.
+ *
+ * The element updates its counters and per-peer state in place between
+ * begin_write() and end_write(); the writer never waits and never takes a
+ * lock. Readers (handlers, possibly on another thread) copy the whole state
+ * and retry if a write happened meanwhile, so they always see a consistent
+ * snapshot. There must be a single writer: the thread running push() and
+ * the element's timers.
+ *
+ * T must be plain data of fixed-width fields only (no pointers, no
+ * Timestamp), so that the same layout can be copied out or exported.
+ */
+
+#define PLC_MAX_STAS            255 // NumSTAs of NW_STATS is 8 bits
+#define PLC_MAX_RX_INTERVALS    16  // Tonemap slot intervals kept per error statistics reply
+#define PLC_SNAPSHOT_READ_TRIES 1024
+
+template <typename T>
+class PLCSnapshot { public:
+
+    struct Block {
+        uint32_t seq;           // Odd while a write is in progress
+        uint32_t size;          // sizeof(T)
+        T data;
+    };
+
+    PLCSnapshot()
+        : _b(&_local) {
+        memset(&_local, 0, sizeof(_local));
+        _local.size = sizeof(T);
+    }
+
+    static constexpr uint32_t block_size = sizeof(Block);
+
+    // Moves the state to mem (block_size bytes, e.g. shared memory). Must be
+    // called before the writer starts.
+    void attach(void *mem) {
+        memcpy(mem, (const void *) _b, sizeof(Block));
+        _b = (Block *) mem;
+    }
+    // Moves the state back to the element's own memory, before mem goes away.
+    // Must be called once the writer has stopped.
+    void detach() {
+        if (_b != &_local) {
+            memcpy((void *) &_local, (const void *) _b, sizeof(Block));
+            _b = &_local;
+        }
+    }
+
+    // Writer side
+    T &begin_write() {
+        __atomic_store_n(&_b->seq, _b->seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        return _b->data;
+    }
+    void end_write() {
+        __atomic_store_n(&_b->seq, _b->seq + 1, __ATOMIC_RELEASE);
+    }
+    // Current state, for the writer only
+    const T &data() const {
+        return _b->data;
+    }
+
+    // Reader side: copies a consistent snapshot to out. extra/extra_out/len
+    // optionally copy a region updated by the writer in the same sections.
+    // Returns false if the writer kept the state busy for too long.
+    bool read(T &out, const void *extra = 0, void *extra_out = 0, size_t len = 0) const {
+        for (int i = 0; i < PLC_SNAPSHOT_READ_TRIES; i++) {
+            uint32_t s1 = __atomic_load_n(&_b->seq, __ATOMIC_ACQUIRE);
+            if (s1 & 1)
+                continue;
+            memcpy(&out, (const void *) &_b->data, sizeof(T));
+            if (len)
+                memcpy(extra_out, extra, len);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&_b->seq, __ATOMIC_RELAXED) == s1)
+                return true;
+        }
+        return false;
+    }
+
+    // Reader side: copies len bytes of a region updated by the writer in the
+    // same sections, consistent in itself but not with the rest of the state.
+    // With a writer that updates the state at a high rate, copying a large
+    // region piece by piece succeeds where one copy of it keeps being torn.
+    bool read_region(const void *region, void *out, size_t len) const {
+        for (int i = 0; i < PLC_SNAPSHOT_READ_TRIES; i++) {
+            uint32_t s1 = __atomic_load_n(&_b->seq, __ATOMIC_ACQUIRE);
+            if (s1 & 1)
+                continue;
+            memcpy(out, region, len);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&_b->seq, __ATOMIC_RELAXED) == s1)
+                return true;
+        }
+        return false;
+    }
+
+private:
+    Block *_b;
+    Block _local;
+};
+
+
+// Nanoseconds since the epoch, as stored in the snapshots
+static inline uint64_t plc_now_ns() {
+    return Timestamp::now().nsecval();
+}
+
+CLICK_ENDDECLS
+#endif
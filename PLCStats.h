@@ -64,6 +64,7 @@ enum mod_carrier {
 };
 
 #define MAX_BITS_PER_CARRIER 10
+#define NUMBER_OF_SLOTS 6 // The number of tonemap slots according to IEEE 1901
 
 ////////////////////////////////////////
 
@@ -229,17 +230,4 @@ enum statistics_status {
 /////////////////////////////////
 
 
-// Raising number x to power n, x^n
-static uint64_t power(uint32_t x, uint32_t n) {
-    uint64_t res = 1;
-    uint64_t a = x;
-    while (n) {
-        if (n & 1)
-            res *= a;
-        a *= a;
-        n >>= 1;
-    }
-    return res;
-}
-
 #endif
@@ -0,0 +1,196 @@
+#ifndef CLICKNET_PLCSYNC_H
+#define CLICKNET_PLCSYNC_H
+#include <click/error.hh>
+#include <click/straccum.hh>
+#include "PLCStats.h"
+#include "PLCView.h"
+#include "PLCHistogram.h"
+#include "PLCSnapshot.h"
+CLICK_DECLS
+
+/*
+ * Beacon-synchronized sending of management messages.
+ *
+ * SniffPackets learns a beacon clock from the sniffer indications: the host
+ * time of the last beacon (arrival time minus systime - beacontime, the
+ * earliest estimate per beacon) and the beacon period (smoothed difference
+ * between consecutive beacontime values). With the SYNC keyword, the request
+ * elements send their requests at SYNC_OFFSET us after a beacon instead of
+ * when their timer fires, so that they can be placed in a quiet part of the
+ * beacon period. One poll out of SYNC_BASELINE is still sent unaligned, and
+ * the time to the reply is measured for both, so that the "latency" handler
+ * shows what the alignment gains.
+ *
+ * Aligned requests leave at most once per beacon period, so with SYNC the
+ * polling period must be at least PLC_SYNC_MIN_INTERVAL_MS. A poll that comes
+ * while the aligned requests of the previous one have not left yet is
+ * skipped and counted rather than moving them.
+ */
+
+#define PLC_BEACON_PERIOD_NS        40000000 // Two mains cycles at 50 Hz
+#define PLC_BEACON_CLOCK_STALE_NS   1000000000
+#define PLC_SYNC_MIN_INTERVAL_MS    (PLC_BEACON_PERIOD_NS / 1000000)
+
+struct PLCBeaconClockState {
+    uint64_t anchor_ns;         // Host time of the last beacon
+    uint64_t updated_ns;
+    uint32_t period_ns;
+    uint32_t last_beacontime;
+    uint32_t beacons;
+    uint32_t reserved;
+};
+
+class PLCBeaconClock { public:
+
+    PLCBeaconClock() {
+        _s.begin_write().period_ns = PLC_BEACON_PERIOD_NS;
+        _s.end_write();
+    }
+
+    // Called by SniffPackets for every indication
+    void update(uint64_t now_ns, uint64_t since_beacon_ns, uint32_t beacontime) {
+        PLCBeaconClockState &s = _s.begin_write();
+        uint64_t anchor = now_ns - since_beacon_ns;
+        if (s.beacons == 0 || beacontime != s.last_beacontime) {
+            uint64_t d = (uint64_t) (uint32_t) (beacontime - s.last_beacontime) * PLC_NTB_NS;
+            // Only consecutive beacons give the period
+            if (s.beacons && d > s.period_ns / 2 && d < s.period_ns + s.period_ns / 2)
+                s.period_ns += ((int64_t) d - s.period_ns) / 8;
+            s.last_beacontime = beacontime;
+            s.beacons++;
+            s.anchor_ns = anchor;
+        }
+        else if (anchor < s.anchor_ns)
+            // Indications of the same beacon period: the least delayed one is closest
+            s.anchor_ns = anchor;
+        s.updated_ns = now_ns;
+        _s.end_write();
+    }
+
+    // Earliest time >= now_ns at offset_ns after a beacon. Returns false if
+    // the clock has not been updated recently.
+    bool next(uint64_t now_ns, uint32_t offset_ns, uint64_t &at_ns) const {
+        PLCBeaconClockState s;
+        if (!_s.read(s) || s.beacons == 0 || now_ns - s.updated_ns > PLC_BEACON_CLOCK_STALE_NS)
+            return false;
+        at_ns = s.anchor_ns + offset_ns % s.period_ns;
+        if (at_ns < now_ns)
+            at_ns += (now_ns - at_ns + s.period_ns - 1) / s.period_ns * s.period_ns;
+        return true;
+    }
+
+    bool read(PLCBeaconClockState &s) const {
+        return _s.read(s);
+    }
+
+private:
+    PLCSnapshot<PLCBeaconClockState> _s;
+};
+
+// Time from request to reply, unaligned (0) and beacon-aligned (1) requests
+struct PLCLatencyStats {
+    uint32_t count[2];
+    uint32_t unmatched;         // Replies without a pending request
+    uint32_t reserved;
+    uint64_t sum_ns[2];
+    PLCLogHistogram hist_us[2];
+};
+
+// Request scheduling and latency measurement shared by the request
+// elements. Requests are identified by a small index (the tonemap slot,
+// 0 for elements with a single request per poll).
+class PLCRequestSync { public:
+
+    PLCRequestSync()
+        : _clock(0), _offset_ns(0), _baseline(8), _polls(0), _skipped(0) {
+        memset(_pending, 0, sizeof(_pending));
+    }
+
+    void configure(const PLCBeaconClock *clock, uint32_t offset_us, uint32_t baseline) {
+        _clock = clock;
+        _offset_ns = offset_us * 1000;
+        _baseline = baseline;
+    }
+
+    bool active() const                 { return _clock; }
+
+    // Checks a polling period, from configure() or a write handler
+    int check_interval(uint32_t interval_ms, ErrorHandler *errh) const {
+        if (interval_ms == 0)
+            return errh->error("INTERVAL must be positive");
+        if (_clock && interval_ms < PLC_SYNC_MIN_INTERVAL_MS)
+            return errh->error("INTERVAL must be at least %u ms with SYNC", PLC_SYNC_MIN_INTERVAL_MS);
+        return 0;
+    }
+
+    // Called when the poll timer fires while the aligned requests of the
+    // previous poll are still waiting for their beacon
+    void skip() {
+        __atomic_store_n(&_skipped, _skipped + 1, __ATOMIC_RELAXED);
+    }
+
+    // Called when the poll timer fires. Returns true with the time at which
+    // the requests should leave, false if they should be sent at once.
+    bool schedule(Timestamp &at) {
+        if (!_clock || (_baseline && ++_polls % _baseline == 0))
+            return false;
+        uint64_t now = plc_now_ns(), at_ns;
+        if (!_clock->next(now, _offset_ns, at_ns))
+            return false;
+        at = Timestamp::make_nsec(at_ns);
+        return true;
+    }
+
+    // Request i left now; the low bit of the time tells whether it was aligned
+    void sent(int i, bool aligned) {
+        __atomic_store_n(&_pending[i], (plc_now_ns() & ~1ULL) | aligned, __ATOMIC_RELEASE);
+    }
+
+    // The reply to request i arrived
+    void replied(int i) {
+        uint64_t sent = i < NUMBER_OF_SLOTS ? __atomic_exchange_n(&_pending[i], 0, __ATOMIC_ACQUIRE) : 0;
+        PLCLatencyStats &st = _latency.begin_write();
+        if (sent) {
+            uint64_t d = plc_now_ns() - (sent & ~1ULL);
+            int aligned = sent & 1;
+            st.count[aligned]++;
+            st.sum_ns[aligned] += d;
+            st.hist_us[aligned].add(d / 1000 < 0xFFFFFFFF ? d / 1000 : 0xFFFFFFFF);
+        }
+        else
+            st.unmatched++;
+        _latency.end_write();
+    }
+
+    String unparse() const {
+        PLCLatencyStats st;
+        if (!_latency.read(st))
+            return String("busy\n");
+        static const char * const names[] = {"unaligned", "aligned"};
+        double mean[2];
+        StringAccum sa;
+        for (int a = 0; a < 2; a++) {
+            mean[a] = st.count[a] ? (double) st.sum_ns[a] / st.count[a] / 1000 : 0;
+            sa << names[a] << " count " << st.count[a] << " mean_us " << mean[a] << "\n  latency_us";
+            st.hist_us[a].unparse(sa);
+            sa << "\n";
+        }
+        if (st.count[0] && st.count[1])
+            sa << "improvement " << 100 * (1 - mean[1] / mean[0]) << "%\n";
+        sa << "unmatched " << st.unmatched << "\n"
+           << "skipped " << __atomic_load_n(&_skipped, __ATOMIC_RELAXED) << "\n";
+        return sa.take_string();
+    }
+
+private:
+    const PLCBeaconClock *_clock;
+    uint32_t _offset_ns;
+    uint32_t _baseline;         // Every _baseline-th poll is sent unaligned, 0 for never
+    uint32_t _polls;
+    uint64_t _skipped;          // Polls that came before the previous aligned requests left
+    uint64_t _pending[NUMBER_OF_SLOTS];
+    PLCSnapshot<PLCLatencyStats> _latency;
+};
+
+CLICK_ENDDECLS
+#endif
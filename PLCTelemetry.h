@@ -0,0 +1,154 @@
+#ifndef CLICKNET_PLCTELEMETRY_H
+#define CLICKNET_PLCTELEMETRY_H
+#include <click/string.hh>
+#include <click/error.hh>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include "PLCSnapshot.h"
+CLICK_DECLS
+
+/*
+ * Shared-memory telemetry segment.
+ *
+ * With the TELEMETRY keyword, an element places its statistics snapshot
+ * (PLCSnapshot.h) in a POSIX shared-memory object instead of its own
+ * memory. Local collectors map the object read-only and sample it at any
+ * rate without going through the router: they read the sequence number,
+ * copy the data, and retry if the sequence was odd or has changed.
+ *
+ * Binary layout (all fields in the host byte order, offsets in bytes;
+ * collectors run on the same host):
+ *   0                     struct plc_telemetry_header
+ *   block_offset          uint32_t seq, uint32_t size, snapshot data
+ *   extra_offset          element-specific region written under the same
+ *                         sequence number (the link table of SniffPackets)
+ * The snapshot data is the element's *Snapshot structure. Any change of
+ * those structures must increase PLC_TELEMETRY_VERSION.
+ */
+
+#define PLC_TELEMETRY_MAGIC     0x54434C50U // "PLCT"
+#define PLC_TELEMETRY_VERSION   1
+#define PLC_TELEMETRY_ALIGN     64
+
+enum plc_telemetry_kind {
+    PLC_TELEMETRY_PHYRATES = 1,     // PhyRatesSnapshot
+    PLC_TELEMETRY_TONEMAP = 2,      // TonemapSnapshot
+    PLC_TELEMETRY_ERRORSTATS = 3,   // ErrorStatsSnapshot
+    PLC_TELEMETRY_SNIFFER = 4,      // SniffSnapshot, extra: SniffLinkStats[]
+};
+
+struct plc_telemetry_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t kind;
+    uint32_t header_size;
+    uint32_t block_offset;
+    uint32_t block_size;
+    uint32_t extra_offset;
+    uint32_t extra_size;
+    uint32_t reserved;
+    uint64_t created_ns;
+    char element[64];           // Name of the element, NUL-terminated
+};
+
+class PLCTelemetrySegment { public:
+
+    PLCTelemetrySegment()
+        : _mem(0), _size(0), _block_offset(0), _extra_offset(0) {
+    }
+    ~PLCTelemetrySegment() {
+        close();
+    }
+
+    bool active() const                 { return _mem != 0; }
+    void *block() const                 { return (char *) _mem + _block_offset; }
+    void *extra() const                 { return (char *) _mem + _extra_offset; }
+
+    // Creates the object name and maps it. An object left by a router that
+    // did not clean up is replaced by a new one, never reused: an existing
+    // object may belong to another user or have another size.
+    int open(const String &name, uint16_t kind, const String &element,
+             uint32_t block_size, uint32_t extra_size, ErrorHandler *errh) {
+        _block_offset = align(sizeof(plc_telemetry_header));
+        _extra_offset = _block_offset + align(block_size);
+        _size = _extra_offset + align(extra_size);
+        _name = name;
+
+        int fd = shm_open(_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0 && errno == EEXIST && shm_unlink(_name.c_str()) == 0) {
+            errh->warning("TELEMETRY %s: replacing an existing object", _name.c_str());
+            fd = shm_open(_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        }
+        if (fd < 0)
+            return errh->error("TELEMETRY %s: %s", _name.c_str(), strerror(errno));
+        if (ftruncate(fd, _size) < 0) {
+            ::close(fd);
+            return errh->error("TELEMETRY %s: %s", _name.c_str(), strerror(errno));
+        }
+        void *mem = mmap(0, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mem == MAP_FAILED)
+            return errh->error("TELEMETRY %s: %s", _name.c_str(), strerror(errno));
+        _mem = mem;
+        memset(_mem, 0, _size);
+
+        plc_telemetry_header *h = (plc_telemetry_header *) _mem;
+        h->version = PLC_TELEMETRY_VERSION;
+        h->kind = kind;
+        h->header_size = sizeof(plc_telemetry_header);
+        h->block_offset = _block_offset;
+        h->block_size = block_size;
+        h->extra_offset = extra_size ? _extra_offset : 0;
+        h->extra_size = extra_size;
+        h->created_ns = plc_now_ns();
+        strncpy(h->element, element.c_str(), sizeof(h->element) - 1);
+        // Readers check the magic last
+        __atomic_store_n(&h->magic, PLC_TELEMETRY_MAGIC, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    // Opens the object and moves snap into it
+    template <typename T>
+    int export_snapshot(const String &name, uint16_t kind, const String &element,
+                        PLCSnapshot<T> &snap, uint32_t extra_size, ErrorHandler *errh) {
+        if (open(name, kind, element, PLCSnapshot<T>::block_size, extra_size, errh) < 0)
+            return -1;
+        snap.attach(block());
+        return 0;
+    }
+
+    // Moves snap back to the element's memory, then closes the object. For
+    // cleanup(), so that the handlers may still read snap.
+    template <typename T>
+    void close(PLCSnapshot<T> &snap) {
+        snap.detach();
+        close();
+    }
+
+    // Unmaps and removes the object; collectors that still map it keep
+    // their (now frozen) copy
+    void close() {
+        if (_mem) {
+            munmap(_mem, _size);
+            shm_unlink(_name.c_str());
+            _mem = 0;
+        }
+    }
+
+private:
+    void *_mem;
+    uint32_t _size;
+    uint32_t _block_offset;
+    uint32_t _extra_offset;
+    String _name;
+
+    static uint32_t align(uint32_t x) {
+        return (x + PLC_TELEMETRY_ALIGN - 1) & ~(PLC_TELEMETRY_ALIGN - 1);
+    }
+};
+
+CLICK_ENDDECLS
+#endif
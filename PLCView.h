@@ -0,0 +1,356 @@
+#ifndef CLICKNET_PLCVIEW_H
+#define CLICKNET_PLCVIEW_H
+#include <click/packet.hh>
+#include <clicknet/ether.h>
+#include "PLCStats.h"
+CLICK_DECLS
+
+/*
+ * Read-only, bounds-checked views over HomePlug AV management messages.
+ *
+ * A view is built on top of the packet bytes, checks the length once and
+ * then gives typed access to the fields without copying. Multi-byte fields
+ * are loaded explicitly as little-endian and bit-fields are extracted with
+ * shifts and masks at compile-time offsets, so the result does not depend
+ * on how the compiler lays out the packed structures of PLCStats.h (e.g. the
+ * bit-field offsets of click_hp_av_fc changed in GCC 4.4). Counts given by
+ * the device (carriers, stations, tonemap intervals) are clamped to what
+ * actually fits in the packet.
+ */
+
+
+// Little-endian loads from unaligned packet bytes
+static inline uint16_t plc_le16(const uint8_t *b) {
+    return (uint16_t) (b[0] | (b[1] << 8));
+}
+
+static inline uint32_t plc_le32(const uint8_t *b) {
+    return (uint32_t) b[0] | ((uint32_t) b[1] << 8) | ((uint32_t) b[2] << 16) | ((uint32_t) b[3] << 24);
+}
+
+static inline uint64_t plc_le64(const uint8_t *b) {
+    return (uint64_t) plc_le32(b) | ((uint64_t) plc_le32(b + 4) << 32);
+}
+
+// Extracts Width bits starting at bit Off (LSB first, as the IEEE 1901 fields
+// are transmitted). Offsets are compile-time constants, so the extraction is
+// a fixed sequence of loads, shifts and one mask.
+template <unsigned Off, unsigned Width>
+static inline uint32_t plc_bits(const uint8_t *b) {
+    static_assert(Width > 0 && (Off % 8) + Width <= 32, "field must fit in 4 bytes");
+    const uint8_t *p = b + Off / 8;
+    uint32_t v = p[0];
+    if ((Off % 8) + Width > 8)
+        v |= (uint32_t) p[1] << 8;
+    if ((Off % 8) + Width > 16)
+        v |= (uint32_t) p[2] << 16;
+    if ((Off % 8) + Width > 24)
+        v |= (uint32_t) p[3] << 24;
+    return (v >> (Off % 8)) & (uint32_t) ((1ULL << Width) - 1);
+}
+
+// Bits per carrier for each enum mod_carrier value, unknown values carry no bits
+static const uint8_t plc_modulation_bits[16] = {0, 1, 2, 3, 4, 6, 8, 10, 0, 0, 0, 0, 0, 0, 0, 0};
+
+// Bit-loading estimate (BLE) of the frame control, decoded once for all 256
+// field values. The IEEE 1901 formula (32 + mant) * 2^(exp - 4) + 2^(exp - 5)
+// Mbps, mant = ble >> 3 and exp = ble & 7, is kept in units of 1/32 Mbps so
+// that every entry is an integer.
+struct PLCBleTable {
+    uint16_t q5[256];
+
+    constexpr PLCBleTable()
+        : q5() {
+        for (int i = 0; i < 256; i++)
+            q5[i] = (uint16_t) (((32 + (i >> 3)) << ((i & 7) + 1)) + (1 << (i & 7)));
+    }
+};
+static constexpr PLCBleTable plc_ble_table;
+
+// Frame length FL_AV is given in units of 1.28 us; 41943 / 2^15 = 1.280002
+static inline uint32_t plc_fl_av_usec(uint32_t fl_av) {
+    return (fl_av * 41943) >> 15;
+}
+
+// The sniffer time stamps count the 25 MHz network time base (NTB)
+#define PLC_NTB_NS 40
+
+static inline uint32_t plc_min(uint32_t a, uint32_t b) {
+    return a < b ? a : b;
+}
+
+
+// Ethernet + HomePlug AV header of a frame
+class PLCMMEView { public:
+
+    static constexpr uint32_t header_size = sizeof(click_ether) + sizeof(click_hp_av_header);
+
+    PLCMMEView(const Packet *p)
+        : _b(p->data()), _len(p->length()) {
+    }
+
+    // True if the frame is long enough to hold the MME header and is of type HP_AV
+    bool is_hpav() const {
+        return _len >= header_size && _b[12] == (ETHERTYPE_HP_AV >> 8) && _b[13] == (ETHERTYPE_HP_AV & 0xFF);
+    }
+    uint8_t version() const             { return _b[sizeof(click_ether)]; }
+    // Same byte order as the MMType constants of PLCStats.h
+    uint16_t mmtype() const             { return (uint16_t) ((_b[15] << 8) | _b[16]); }
+    const uint8_t *src() const          { return _b + 6; }
+    const uint8_t *payload() const      { return _b + header_size; }
+    uint32_t payload_length() const     { return _len - header_size; }
+
+private:
+    const uint8_t *_b;
+    uint32_t _len;
+};
+
+
+// Common part of all MME payload views: fixed-size part known at compile time
+template <typename Wire>
+class PLCPayloadView { public:
+
+    static constexpr uint32_t fixed_size = sizeof(Wire);
+
+    PLCPayloadView(const PLCMMEView &mme)
+        : _b(mme.payload()), _len(mme.payload_length()) {
+    }
+    PLCPayloadView(const uint8_t *b, uint32_t len)
+        : _b(b), _len(len) {
+    }
+
+    bool valid() const                  { return _len >= fixed_size; }
+    const uint8_t *data() const         { return _b; }
+    uint32_t length() const             { return _len; }
+
+protected:
+    const uint8_t *_b;
+    uint32_t _len;
+};
+
+
+/// Tone maps ///
+class PLCToneMapRepView : public PLCPayloadView<click_hp_av_tone_map_rep> { public:
+
+    PLCToneMapRepView(const PLCMMEView &mme)
+        : PLCPayloadView<click_hp_av_tone_map_rep>(mme) {
+    }
+
+    uint8_t mstatus() const             { return _b[3]; }
+    uint8_t tmslot() const              { return _b[4]; }
+    uint8_t num_tms() const             { return _b[5]; }
+    uint16_t num_act_carrier() const    { return plc_le16(_b + 6); }
+
+    // Number of carriers that are both announced and present in the packet
+    uint32_t ncarriers() const {
+        return plc_min(num_act_carrier(), (_len - fixed_size) * 2);
+    }
+    // Modulation (enum mod_carrier) of carrier i < ncarriers()
+    uint8_t modulation(uint32_t i) const {
+        return (_b[fixed_size + (i >> 1)] >> ((i & 1) << 2)) & 0x0F;
+    }
+    // Nibble-packed carriers, two per byte, low nibble first
+    const uint8_t *carriers() const     { return _b + fixed_size; }
+};
+
+
+/// PHY rates ///
+class PLCNwStatsConfView : public PLCPayloadView<click_hp_av_nw_stats_conf> { public:
+
+    PLCNwStatsConfView(const PLCMMEView &mme)
+        : PLCPayloadView<click_hp_av_nw_stats_conf>(mme) {
+    }
+
+    uint16_t fmi() const                { return plc_le16(_b); }
+    uint32_t num_stas() const {
+        return plc_min(_b[2], (_len - fixed_size) / sizeof(cm_sta_info));
+    }
+    // cm_sta_info only holds bytes, so it can be used in place
+    const cm_sta_info &sta(uint32_t i) const {
+        return ((const cm_sta_info *) (_b + fixed_size))[i];
+    }
+};
+
+
+/// Error statistics ///
+class PLCTxLinkStatsView { public:
+
+    static constexpr uint32_t fixed_size = sizeof(tx_link_stats);
+
+    PLCTxLinkStatsView(const uint8_t *b)
+        : _b(b) {
+    }
+
+    uint64_t mpdu_ack() const           { return plc_le64(_b + offsetof(tx_link_stats, mpdu_ack)); }
+    uint64_t mpdu_coll() const          { return plc_le64(_b + offsetof(tx_link_stats, mpdu_coll)); }
+    uint64_t mpdu_fail() const          { return plc_le64(_b + offsetof(tx_link_stats, mpdu_fail)); }
+    uint64_t pb_pass() const            { return plc_le64(_b + offsetof(tx_link_stats, pb_pass)); }
+    uint64_t pb_fail() const            { return plc_le64(_b + offsetof(tx_link_stats, pb_fail)); }
+
+private:
+    const uint8_t *_b;
+};
+
+class PLCRxIntervalView { public:
+
+    PLCRxIntervalView(const uint8_t *b)
+        : _b(b) {
+    }
+
+    uint8_t phyrate() const             { return _b[offsetof(rx_interval_stats, phyrate)]; }
+    uint64_t pb_pass() const            { return plc_le64(_b + offsetof(rx_interval_stats, pb_pass)); }
+    uint64_t pb_fail() const            { return plc_le64(_b + offsetof(rx_interval_stats, pb_fail)); }
+    uint64_t tbe_pass() const           { return plc_le64(_b + offsetof(rx_interval_stats, tbe_pass)); }
+    uint64_t tbe_fail() const           { return plc_le64(_b + offsetof(rx_interval_stats, tbe_fail)); }
+
+private:
+    const uint8_t *_b;
+};
+
+class PLCRxLinkStatsView { public:
+
+    static constexpr uint32_t fixed_size = sizeof(rx_link_stats);
+
+    // len is the number of bytes available from b onwards, at least fixed_size
+    PLCRxLinkStatsView(const uint8_t *b, uint32_t len)
+        : _b(b), _len(len) {
+    }
+
+    uint64_t mpdu_ack() const           { return plc_le64(_b + offsetof(rx_link_stats, mpdu_ack)); }
+    uint64_t mpdu_fail() const          { return plc_le64(_b + offsetof(rx_link_stats, mpdu_fail)); }
+    uint64_t pb_pass() const            { return plc_le64(_b + offsetof(rx_link_stats, pb_pass)); }
+    uint64_t pb_fail() const            { return plc_le64(_b + offsetof(rx_link_stats, pb_fail)); }
+    uint64_t tbe_pass() const           { return plc_le64(_b + offsetof(rx_link_stats, tbe_pass)); }
+    uint64_t tbe_fail() const           { return plc_le64(_b + offsetof(rx_link_stats, tbe_fail)); }
+
+    // Number of tonemap slot intervals announced and present in the packet
+    uint32_t num_rx_intervals() const {
+        return plc_min(_b[offsetof(rx_link_stats, num_rx_intervals)],
+                       (_len - fixed_size) / sizeof(rx_interval_stats));
+    }
+    PLCRxIntervalView interval(uint32_t i) const {
+        return PLCRxIntervalView(_b + fixed_size + i * sizeof(rx_interval_stats));
+    }
+
+private:
+    const uint8_t *_b;
+    uint32_t _len;
+};
+
+class PLCErrorStatsRepView : public PLCPayloadView<click_hp_av_error_stats_rep> { public:
+
+    // The reply is variable-sized: only the header before the union is fixed
+    static constexpr uint32_t header_size = offsetof(click_hp_av_error_stats_rep, tei) + 1;
+
+    PLCErrorStatsRepView(const PLCMMEView &mme)
+        : PLCPayloadView<click_hp_av_error_stats_rep>(mme) {
+    }
+
+    bool valid() const                  { return _len >= header_size; }
+    uint8_t mstatus() const             { return _b[3]; }
+    uint8_t direction() const           { return _b[4]; }
+    uint8_t link_id() const             { return _b[5]; }
+    uint8_t tei() const                 { return _b[6]; }
+
+    // TX statistics come first for HPAV_SD_TX and HPAV_SD_BOTH
+    bool has_tx() const {
+        return (direction() == HPAV_SD_TX || direction() == HPAV_SD_BOTH)
+            && _len >= header_size + PLCTxLinkStatsView::fixed_size;
+    }
+    PLCTxLinkStatsView tx() const {
+        return PLCTxLinkStatsView(_b + header_size);
+    }
+
+    // RX statistics follow the TX statistics for HPAV_SD_BOTH
+    bool has_rx() const {
+        return (direction() == HPAV_SD_RX || direction() == HPAV_SD_BOTH)
+            && _len >= rx_offset() + PLCRxLinkStatsView::fixed_size;
+    }
+    PLCRxLinkStatsView rx() const {
+        return PLCRxLinkStatsView(_b + rx_offset(), _len - rx_offset());
+    }
+
+private:
+    uint32_t rx_offset() const {
+        return header_size + (direction() == HPAV_SD_BOTH ? PLCTxLinkStatsView::fixed_size : 0);
+    }
+};
+
+
+/// Sniffer ///
+class PLCFrameControlView { public:
+
+    static constexpr uint32_t fixed_size = sizeof(click_hp_av_fc);
+
+    PLCFrameControlView(const uint8_t *b)
+        : _b(b) {
+    }
+
+    // Bit offsets follow the field order of click_hp_av_fc
+    uint8_t del_type() const            { return plc_bits<0, 3>(_b); }
+    uint8_t access() const              { return plc_bits<3, 1>(_b); }
+    uint8_t snid() const                { return plc_bits<4, 4>(_b); }
+    uint8_t stei() const                { return _b[1]; }
+    uint8_t dtei() const                { return _b[2]; }
+    uint8_t lid() const                 { return _b[3]; }
+    uint8_t cfs() const                 { return plc_bits<32, 1>(_b); }
+    uint8_t bdf() const                 { return plc_bits<33, 1>(_b); }
+    uint8_t eks() const                 { return plc_bits<36, 4>(_b); }
+    uint8_t ppb() const                 { return _b[5]; }
+    uint8_t ble() const                 { return _b[6]; }
+    // Decoded bit-loading estimate in 1/32 Mbps
+    uint16_t ble_q5() const             { return plc_ble_table.q5[_b[6]]; }
+    uint8_t pbsz() const                { return plc_bits<56, 1>(_b); }
+    uint8_t num_sym() const             { return plc_bits<57, 2>(_b); }
+    uint8_t tmi_av() const              { return plc_bits<59, 5>(_b); }
+    uint16_t fl_av() const              { return plc_bits<64, 12>(_b); }
+    // Frame duration in us
+    uint32_t duration_usec() const      { return plc_fl_av_usec(fl_av()); }
+    uint8_t mpdu_cnt() const            { return plc_bits<76, 2>(_b); }
+    uint8_t burst_cnt() const           { return plc_bits<78, 2>(_b); }
+    uint8_t clst() const                { return plc_bits<80, 3>(_b); }
+    uint8_t rg_len() const              { return plc_bits<83, 6>(_b); }
+    uint8_t mfs_cmd_mgmt() const        { return plc_bits<89, 3>(_b); }
+    uint8_t mfs_cmd_data() const        { return plc_bits<92, 3>(_b); }
+    uint8_t rsr() const                 { return plc_bits<95, 1>(_b); }
+    uint8_t mcf() const                 { return plc_bits<96, 1>(_b); }
+
+private:
+    const uint8_t *_b;
+};
+
+class PLCBeaconView { public:
+
+    static constexpr uint32_t fixed_size = sizeof(click_hp_av_bcn);
+
+    PLCBeaconView(const uint8_t *b)
+        : _b(b) {
+    }
+
+    uint8_t del_type() const            { return plc_bits<0, 3>(_b); }
+    uint8_t snid() const                { return plc_bits<4, 4>(_b); }
+    uint32_t bts() const                { return plc_le32(_b + offsetof(click_hp_av_bcn, bts)); }
+    uint16_t bto(int i) const           { return plc_le16(_b + offsetof(click_hp_av_bcn, bto_0) + 2 * i); }
+
+private:
+    const uint8_t *_b;
+};
+
+class PLCSnifferIndView : public PLCPayloadView<click_hp_av_sniffer_indicate> { public:
+
+    PLCSnifferIndView(const PLCMMEView &mme)
+        : PLCPayloadView<click_hp_av_sniffer_indicate>(mme) {
+    }
+
+    uint8_t type() const                { return _b[offsetof(click_hp_av_sniffer_indicate, type)]; }
+    uint8_t direction() const           { return _b[offsetof(click_hp_av_sniffer_indicate, direction)]; }
+    uint64_t systime() const            { return plc_le64(_b + offsetof(click_hp_av_sniffer_indicate, systime)); }
+    uint32_t beacontime() const         { return plc_le32(_b + offsetof(click_hp_av_sniffer_indicate, beacontime)); }
+    // Time since the last beacon in ns; beacontime holds the low 32 bits of its systime
+    uint64_t since_beacon_ns() const    { return (uint64_t) (uint32_t) (systime() - beacontime()) * PLC_NTB_NS; }
+    PLCFrameControlView fc() const      { return PLCFrameControlView(_b + offsetof(click_hp_av_sniffer_indicate, fc)); }
+    PLCBeaconView bcn() const           { return PLCBeaconView(_b + offsetof(click_hp_av_sniffer_indicate, bcn)); }
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,198 @@
+#ifndef CLICKNET_PLCWATERFALL_H
+#define CLICKNET_PLCWATERFALL_H
+#include <click/straccum.hh>
+#include <click/timestamp.hh>
+#include "PLCView.h"
+CLICK_DECLS
+
+/*
+ * Waterfall of tonemaps: for every tonemap slot, a ring of the last tonemaps
+ * received, each with its time, the peer it describes and the modulation of
+ * every carrier as it arrived (nibble-packed, two carriers per byte).
+ * Storing a reply is one copy; the spectra are only computed when a handler
+ * reads them. The rings are shared by all the peers polled over time, so a
+ * reader keeps the entries of the peer it asks for.
+ *
+ * Every entry has its own sequence number, as in PLCSnapshot.h, and the
+ * index of the reply it holds, so that a reader detects both a concurrent
+ * write and an entry that was overwritten by a newer reply. There must be a
+ * single writer.
+ *
+ * Spectra are given at a resolution of RES carriers per bin: a bin holds the
+ * mean number of bits per carrier of its carriers, the last bin taking the
+ * remaining ones. The binary format of an entry is, in host byte order:
+ *   uint64_t time_ns, uint32_t ncarriers, uint16_t res, uint16_t nbins,
+ *   uint8_t bin[nbins]
+ * where bin[i] is the mean bits per carrier times 16, rounded.
+ */
+
+#define PLC_WATERFALL_READ_TRIES 16
+#define PLC_SPECTRUM_MAX_WIDTH  256 // Bars of the plot
+
+struct PLCWaterfallEntry {
+    uint32_t seq;               // Odd while a write is in progress
+    uint32_t ncarriers;
+    uint64_t index;             // Number of the reply in its slot, from 1
+    uint64_t time_ns;
+    uint8_t peer[6];            // MAC address of the peer
+    uint16_t reserved;
+};
+
+class PLCWaterfall { public:
+
+    PLCWaterfall()
+        : _mem(0), _count(0), _nslots(0), _depth(0), _carrier_bytes(0), _entry_size(0) {
+    }
+    ~PLCWaterfall() {
+        clear();
+    }
+
+    // Allocates depth entries of up to max_carriers carriers for every slot
+    bool init(int nslots, uint32_t depth, uint32_t max_carriers) {
+        clear();
+        _nslots = nslots;
+        _depth = depth;
+        _carrier_bytes = (max_carriers + 1) / 2;
+        _entry_size = (sizeof(PLCWaterfallEntry) + _carrier_bytes + 7) & ~7U;
+        _mem = new uint8_t[(size_t) _entry_size * depth * nslots]();
+        _count = new uint64_t[nslots]();
+        return _mem && _count;
+    }
+    void clear() {
+        delete[] _mem;
+        delete[] _count;
+        _mem = 0;
+        _count = 0;
+    }
+
+    bool active() const                 { return _mem; }
+    uint32_t depth() const              { return _depth; }
+    uint32_t max_carriers() const       { return _carrier_bytes * 2; }
+
+    // Writer side: stores the carriers of a tonemap reply of slot from peer
+    void add(int slot, const uint8_t *peer, uint64_t time_ns, const uint8_t *carriers, uint32_t ncarriers) {
+        if (!_mem || slot < 0 || slot >= _nslots)
+            return;
+        uint64_t index = _count[slot] + 1;
+        PLCWaterfallEntry *e = entry(slot, index);
+        uint32_t nbytes = (ncarriers + 1) / 2;
+        if (nbytes > _carrier_bytes) {
+            nbytes = _carrier_bytes;
+            ncarriers = nbytes * 2;
+        }
+        __atomic_store_n(&e->seq, e->seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        e->ncarriers = ncarriers;
+        e->index = index;
+        e->time_ns = time_ns;
+        memcpy(e->peer, peer, 6);
+        memcpy(e + 1, carriers, nbytes);
+        __atomic_store_n(&e->seq, e->seq + 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&_count[slot], index, __ATOMIC_RELEASE);
+    }
+
+    // Reader side: number of the newest reply of slot, 0 if none
+    uint64_t newest(int slot) const {
+        return slot >= 0 && slot < _nslots ? __atomic_load_n(&_count[slot], __ATOMIC_ACQUIRE) : 0;
+    }
+    // Oldest reply of slot that is still in the ring
+    uint64_t oldest(int slot) const {
+        uint64_t n = newest(slot);
+        return n > _depth ? n - _depth + 1 : 1;
+    }
+
+    // Copies reply index of slot; carriers must hold max_carriers() / 2
+    // bytes. Returns false if it is no longer (or not yet) in the ring.
+    bool read(int slot, uint64_t index, PLCWaterfallEntry &out, uint8_t *carriers) const {
+        if (!_mem || index == 0 || index > newest(slot) || index < oldest(slot))
+            return false;
+        const PLCWaterfallEntry *e = entry(slot, index);
+        for (int i = 0; i < PLC_WATERFALL_READ_TRIES; i++) {
+            uint32_t s1 = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+            if (s1 & 1)
+                continue;
+            memcpy(&out, (const void *) e, sizeof(out));
+            memcpy(carriers, e + 1, (plc_min(out.ncarriers, max_carriers()) + 1) / 2);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) == s1)
+                return out.index == index;
+        }
+        return false;
+    }
+
+private:
+    uint8_t *_mem;
+    uint64_t *_count;           // Replies stored per slot
+    int _nslots;
+    uint32_t _depth;
+    uint32_t _carrier_bytes;
+    uint32_t _entry_size;
+
+    PLCWaterfallEntry *entry(int slot, uint64_t index) const {
+        return (PLCWaterfallEntry *) (_mem + ((size_t) slot * _depth + index % _depth) * _entry_size);
+    }
+};
+
+
+// Mean bits per carrier times 16 of bin b at res carriers per bin
+static inline uint32_t plc_spectrum_bin(const uint8_t *carriers, uint32_t ncarriers, uint32_t res, uint32_t b) {
+    uint32_t first = b * res, last = plc_min(first + res, ncarriers);
+    uint32_t sum = 0;
+    for (uint32_t i = first; i < last; i++)
+        sum += plc_modulation_bits[(carriers[i >> 1] >> ((i & 1) << 2)) & 0x0F];
+    return last > first ? (sum * 16 + (last - first) / 2) / (last - first) : 0;
+}
+
+static inline uint32_t plc_spectrum_nbins(uint32_t ncarriers, uint32_t res) {
+    return (ncarriers + res - 1) / res;
+}
+
+// One CSV line: time in seconds, then the mean bits per carrier of every bin
+static inline void plc_unparse_spectrum_csv(StringAccum &sa, const PLCWaterfallEntry &e,
+                                            const uint8_t *carriers, uint32_t res) {
+    sa << Timestamp::make_nsec(e.time_ns);
+    uint32_t nbins = plc_spectrum_nbins(e.ncarriers, res);
+    for (uint32_t b = 0; b < nbins; b++) {
+        uint32_t v = plc_spectrum_bin(carriers, e.ncarriers, res, b);
+        if (res == 1)
+            sa << ',' << (v >> 4);
+        else
+            sa.snprintf(8, ",%.2f", v / 16.);
+    }
+    sa << '\n';
+}
+
+static inline void plc_unparse_spectrum_binary(StringAccum &sa, const PLCWaterfallEntry &e,
+                                               const uint8_t *carriers, uint32_t res) {
+    uint32_t nbins = plc_spectrum_nbins(e.ncarriers, res);
+    uint16_t res16 = res, nbins16 = nbins;
+    sa.append((const char *) &e.time_ns, 8);
+    sa.append((const char *) &e.ncarriers, 4);
+    sa.append((const char *) &res16, 2);
+    sa.append((const char *) &nbins16, 2);
+    if (char *x = sa.extend(nbins))
+        for (uint32_t b = 0; b < nbins; b++)
+            x[b] = plc_spectrum_bin(carriers, e.ncarriers, res, b);
+}
+
+// Bar chart of the frequency response over width bars
+static inline void plc_unparse_spectrum_plot(StringAccum &sa, const PLCWaterfallEntry &e,
+                                             const uint8_t *carriers, uint32_t width) {
+    width = width < 1 ? 1 : plc_min(width, PLC_SPECTRUM_MAX_WIDTH);
+    uint32_t res = e.ncarriers > width ? (e.ncarriers + width - 1) / width : 1;
+    uint32_t nbins = plc_spectrum_nbins(e.ncarriers, res);
+    uint32_t bins[PLC_SPECTRUM_MAX_WIDTH];
+    for (uint32_t b = 0; b < nbins; b++)
+        bins[b] = plc_spectrum_bin(carriers, e.ncarriers, res, b);
+    for (int i = MAX_BITS_PER_CARRIER; i > 0; i--) {
+        for (uint32_t b = 0; b < nbins; b++)
+            sa << (bins[b] >= (uint32_t) i * 16 - 8 ? '|' : ' ');
+        sa << '\n';
+    }
+    for (uint32_t b = 1; b < nbins; b++)
+        sa << '-';
+    sa << ">\nFrequency, " << res << " carriers per bar\n";
+}
+
+CLICK_ENDDECLS
+#endif
@@ -3,6 +3,8 @@
  *
  * This click element periodically sends error/collision statistics requests for a specific destination and priority
  * and dumps the statistics.
+ * With SAMPLES, every reply is also kept as a binary record for polling at
+ * intervals down to the mains cycle (PLCSampler.h).
  * Christina Vlachou, 2016
 */
 #include <iostream>
@@ -18,6 +20,7 @@
 #include <click/packet_anno.hh>
 #include <clicknet/llc.h>
 #include <click/handlercall.hh>
+#include <click/confparse.hh>
 
 
 CLICK_DECLS
@@ -25,7 +28,9 @@ CLICK_DECLS
 #define TIMER_INTERVAL 1000 // timer interval in ms
 
 ErrorStatsReq::ErrorStatsReq()
-     :_expire_timer_ms(this)
+     :_expire_timer_ms(this), _send_req(&ErrorStatsReq::sendErrorStatsReq<PLCDefaultChipset>), _store(0), _correlator(0), _stations(0),
+      _checkpoint_interval(10), _checkpoint_maxage(3600), _checkpoint_ms(0), _sync_timer(this),
+      _interval_ms(TIMER_INTERVAL), _requests_base(0), _verbose(true), _samples_depth(0)
 {
 }
 
@@ -44,10 +49,26 @@ ErrorStatsReq::cast(const char *name)
 }
 
 int
-ErrorStatsReq::initialize(ErrorHandler *)
+ErrorStatsReq::initialize(ErrorHandler *errh)
 {
+    if (_telemetry_name
+        && _telemetry.export_snapshot(_telemetry_name, PLC_TELEMETRY_ERRORSTATS, name(), _stats, 0, errh) < 0)
+        return -1;
+    if (_checkpoint_name) {
+        if (_checkpoint.open(_checkpoint_name, PLC_TELEMETRY_ERRORSTATS, name(), _dst.data(), sizeof(ErrorStatsSnapshot), errh) < 0)
+            return -1;
+        if (_checkpoint.restore(_stats, _checkpoint_maxage, errh))
+            click_chatter("[ErrorStatsReq] Restored state from %s", _checkpoint_name.c_str());
+    }
+    if (_samples_depth && !_samples.init(_samples_depth))
+        return errh->error("out of memory");
+    ErrorStatsTarget t = {_dst, _prio, _dir, _interval_ms};
+    _target.init(t);
+    _switch.init(_dst);
+    _requests_base = _stats.data().requests;
     _expire_timer_ms.initialize(this);
-    _expire_timer_ms.schedule_after_msec(TIMER_INTERVAL);
+    _sync_timer.initialize(this);
+    _expire_timer_ms.schedule_after_msec(_interval_ms);
     return 0;
 }
 
@@ -55,107 +76,322 @@ ErrorStatsReq::initialize(ErrorHandler *)
 int
 ErrorStatsReq::configure(Vector<String> &conf, ErrorHandler *errh)
 {
-    return Args(conf, this, errh).read_m("SRC", _src)
-                                 .read_m("DST", _dst)
-                                 .read_m("DIRECTION", _dir)
-                                 .read_m("PRIORITY", _prio)
-                                 .complete();
+    String chipset = PLCDefaultChipset::name;
+    SniffPackets *sync = 0;
+    uint32_t sync_offset = 0, sync_baseline = 8;
+    if (Args(conf, this, errh).read_m("SRC", _src)
+                              .read_m("DST", _dst)
+                              .read_m("DIRECTION", _dir)
+                              .read_m("PRIORITY", _prio)
+                              .read("CHIPSET", WordArg(), chipset)
+                              .read("TELEMETRY", WordArg(), _telemetry_name)
+                              .read("STORE", ElementCastArg("PLCStore"), _store)
+                              .read("CORRELATOR", ElementCastArg("PLCCorrelator"), _correlator)
+                              .read("STATIONS", ElementCastArg("PLCStationTable"), _stations)
+                              .read("CHECKPOINT", FilenameArg(), _checkpoint_name)
+                              .read("CHECKPOINT_INTERVAL", _checkpoint_interval)
+                              .read("CHECKPOINT_MAXAGE", _checkpoint_maxage)
+                              .read("SYNC", ElementCastArg("SniffPackets"), sync)
+                              .read("SYNC_OFFSET", sync_offset)
+                              .read("SYNC_BASELINE", sync_baseline)
+                              .read("INTERVAL", _interval_ms)
+                              .read("CHANGE_THRESHOLD", _changes.params.threshold)
+                              .read("CHANGE_DRIFT", _changes.params.drift)
+                              .read("CHANGE_WARMUP", _changes.params.warmup)
+                              .read("SAMPLES", _samples_depth)
+                              .read("VERBOSE", _verbose)
+                              .complete() < 0)
+        return -1;
+    if (_changes.params.threshold <= 0)
+        return errh->error("CHANGE_THRESHOLD must be positive");
+    if (sync_offset >= 1000000)
+        return errh->error("SYNC_OFFSET must be below 1000000 us");
+    if (_samples_depth > PLC_SAMPLE_MAX_DEPTH)
+        return errh->error("SAMPLES must be at most %u", PLC_SAMPLE_MAX_DEPTH);
+    // Aligned requests leave once per beacon period, whatever INTERVAL is
+    if (_samples_depth && sync)
+        return errh->error("SAMPLES cannot be used with SYNC");
+    _sync.configure(sync ? sync->beacon_clock() : 0, sync_offset, sync_baseline);
+    if (_sync.check_interval(_interval_ms, errh) < 0)
+        return -1;
+    // Select the request builder of the chipset once
+    if (!plc_dispatch_chipset(chipset, [&](auto chip) {
+            _send_req = &ErrorStatsReq::sendErrorStatsReq<decltype(chip)>;
+        }, PLCChipsets()))
+        return errh->error("unknown CHIPSET %s", chipset.c_str());
+    return 0;
 }
 
 void
 ErrorStatsReq::run_timer(Timer *t)
 {   
+    if (t == &_sync_timer) {
+        send_requests(true);
+        return;
+    }
+    // Settings written by the handlers since the last tick
+    ErrorStatsTarget target;
+    if (_target.take(target))
+        apply(target);
     // Get statistics for PLC rates. Send the management message with request.
-    sendErrorStatsReq();
-    t->schedule_after_msec(TIMER_INTERVAL);
+    Timestamp at;
+    if (_sync_timer.scheduled())
+        _sync.skip();
+    else if (_sync.schedule(at))
+        _sync_timer.schedule_at(at);
+    else
+        send_requests(false);
+    _checkpoint_ms += _interval_ms;
+    // Not while the state is still that of the previous DST
+    if (_checkpoint.active() && _checkpoint_ms >= _checkpoint_interval * 1000 && _switch.settled()) {
+        _checkpoint.save(_stats);
+        _checkpoint_ms = 0;
+    }
+    // A period after the previous tick, not after this hook
+    t->schedule_at(_clock.next(t->expiry(), _interval_ms));
+}
+
+void
+ErrorStatsReq::send_requests(bool aligned)
+{
+    _sync.sent(0, aligned);
+    (this->*_send_req)();
+}
+
+void
+ErrorStatsReq::apply(const ErrorStatsTarget &t)
+{
+    if (t.dst != _dst) {
+        click_chatter("[ErrorStatsReq] Now polling %s", t.dst.unparse().c_str());
+        // The counters are those of the new peer from its first reply on
+        _checkpoint.set_peer(t.dst.data());
+    }
+    // Another link: the push side resets the state of the previous one
+    if (t.dst != _dst || t.prio != _prio || t.dir != _dir)
+        _switch.change(t.dst, Timestamp::now().nsecval());
+    _dst = t.dst;
+    _prio = t.prio;
+    _dir = t.dir;
+    _interval_ms = t.interval_ms;
 }
 
+// Push side, on the first reply after a change of DST, PRIORITY or DIRECTION
+void
+ErrorStatsReq::reset_peer()
+{
+    plc_reset_error_stats_peer(_stats.begin_write());
+    _stats.end_write();
+    _change_tx_coll.reset();
+    _change_tx_pb_fail.reset();
+    _change_rx_pb_fail.reset();
+}
 
 void
-ErrorStatsReq::push(int port,Packet *p)
-{	
-    click_ether *e = (click_ether *) p->data();
-    if(e->ether_type == htons(ETHERTYPE_HP_AV)) {
-        click_hp_av_header *hpavh = (click_hp_av_header *) (e + 1);
-        if(ntohs(hpavh->MMType) == ERROR_STATS_REP) {
-            processErrorStatsRep((click_hp_av_error_stats_rep*)(hpavh+1));
-            p->kill();
+ErrorStatsReq::cleanup(CleanupStage stage)
+{
+    // Keep the replies received since the last periodic checkpoint
+    if (stage >= CLEANUP_INITIALIZED && _checkpoint.active() && _switch.settled())
+        _checkpoint.save(_stats);
+    _checkpoint.close();
+    // Unmap and remove the telemetry object
+    _telemetry.close(_stats);
+}
+
+
+Packet *
+ErrorStatsReq::handle(Packet *p)
+{
+    PLCMMEView mme(p);
+    if(mme.is_hpav() && mme.mmtype() == ERROR_STATS_REP) {
+        PLCErrorStatsRepView error_rep(mme);
+        bool changed;
+        bool current = _switch.reply(Timestamp::now().nsecval(), changed);
+        if (changed)
+            reset_peer();
+        if (!current) {
+            // Answers a request sent for the previous link
+            if (_verbose)
+                click_chatter("[ErrorStatsReq] Dropped a reply for the previous DST");
+        }
+        else if (error_rep.valid()) {
+            _sync.replied(0);
+            processErrorStatsRep(error_rep);
+        }
+        else {
+            click_chatter("[ErrorStatsReq] Truncated error statistics reply of %u bytes", error_rep.length());
+            _stats.begin_write().malformed++;
+            _stats.end_write();
         }
-        else
-            output(0).push(p);
+        p->kill();
+        return 0;
     }
-    else
+    return p;
+}
+
+void
+ErrorStatsReq::push(int, Packet *p)
+{
+    if ((p = handle(p)))
         output(0).push(p);
 }
 
+#if HAVE_BATCH
 void
-ErrorStatsReq::sendErrorStatsReq(){
-    const unsigned char dst[6] = {0x00, 0xB0, 0x52, 0x00, 0x00, 0x01};
+ErrorStatsReq::push_batch(int, PacketBatch *batch)
+{
+    plc_push_batch(output(0), batch, [this](Packet *p) { return handle(p); });
+}
+#endif
 
-    static_assert(Packet::default_headroom >= sizeof(click_ether));
-    WritablePacket *q = Packet::make(Packet::default_headroom,
-            NULL, sizeof(click_ether) + sizeof(click_hp_av_header) + sizeof(click_hp_av_error_stats_req), 0);
+template <typename Chip>
+void
+ErrorStatsReq::sendErrorStatsReq(){
+    WritablePacket *q = plc_make_error_stats_req(&PLCChipsetInfo<Chip>::info, NULL, _dst.data(), _prio, _dir);
     if (!q) {
         click_chatter("[ErrorStatsReq] cannot make packet!");
         return;
     }
-
-    click_ether *e = (click_ether *) q->data();
-    q->set_ether_header(e);
-    memset(e->ether_shost, 0x00, 6);
-    memcpy(e->ether_dhost, dst, 6);
-    e->ether_type = htons(ETHERTYPE_HP_AV);
-
-    click_hp_av_header *hpav = (click_hp_av_header *) (e + 1);
-    hpav->MMType = htons(ERROR_STATS_REQ);
-    hpav->version = 0;
-
-    click_hp_av_error_stats_req *error_req = (click_hp_av_error_stats_req *) (hpav + 1);
-    memcpy(error_req->macaddr, &_dst, 6);
-    error_req->link_id = _prio;
-    error_req->direction = _dir;
-    error_req->control = 0;
-    const unsigned char oui[3] = {0x00, 0xB0, 0x52};
-    memcpy(error_req->oui, oui, 3);
-
-    q->timestamp_anno().assign_now();
+    // Counted in the snapshot by the push side, its only writer
+    _switch.sent();
     output(1).push(q); 
 }
 
 void 
-ErrorStatsReq::print_tx_stats(tx_link_stats *tx) {
+ErrorStatsReq::print_tx_stats(const PLCTxLinkStatsView &tx) {
     click_chatter("[ErrorStatsReq] Printing statistics for Transmission.");
-    click_chatter("[ErrorStatsReq] MPDUs ACKed: %u.", tx->mpdu_ack);
-    click_chatter("[ErrorStatsReq] MPDUs Collided: %u.", tx->mpdu_coll);
-    click_chatter("[ErrorStatsReq] MPDUs Failed: %u.", tx->mpdu_fail);
-    click_chatter("[ErrorStatsReq] PBs Passed FEC block: %u.", tx->pb_pass);
-    click_chatter("[ErrorStatsReq] PBs Failed FEC block: %u.", tx->pb_fail);
+    click_chatter("[ErrorStatsReq] MPDUs ACKed: %llu.", (unsigned long long) tx.mpdu_ack());
+    click_chatter("[ErrorStatsReq] MPDUs Collided: %llu.", (unsigned long long) tx.mpdu_coll());
+    click_chatter("[ErrorStatsReq] MPDUs Failed: %llu.", (unsigned long long) tx.mpdu_fail());
+    click_chatter("[ErrorStatsReq] PBs Passed FEC block: %llu.", (unsigned long long) tx.pb_pass());
+    click_chatter("[ErrorStatsReq] PBs Failed FEC block: %llu.", (unsigned long long) tx.pb_fail());
 }
 
 void 
-ErrorStatsReq::print_rx_stats(rx_link_stats *rx) {
+ErrorStatsReq::print_rx_stats(const PLCRxLinkStatsView &rx) {
     click_chatter("[ErrorStatsReq] Printing statistics for Reception.");
-    click_chatter("[ErrorStatsReq] MPDUs ACKed: %u.", rx->mpdu_ack);
-    click_chatter("[ErrorStatsReq] MPDUs Failed: %u.", rx->mpdu_fail);
-    click_chatter("[ErrorStatsReq] PBs Passed FEC block: %u.", rx->pb_pass);
-    click_chatter("[ErrorStatsReq] PBs Failed FEC block: %u.", rx->pb_fail);
-    click_chatter("[ErrorStatsReq] Turbo Error bits Passed: %u.", rx->tbe_pass);
-    click_chatter("[ErrorStatsReq] Turbo Error bits Failed: %u.", rx->tbe_fail);
+    click_chatter("[ErrorStatsReq] MPDUs ACKed: %llu.", (unsigned long long) rx.mpdu_ack());
+    click_chatter("[ErrorStatsReq] MPDUs Failed: %llu.", (unsigned long long) rx.mpdu_fail());
+    click_chatter("[ErrorStatsReq] PBs Passed FEC block: %llu.", (unsigned long long) rx.pb_pass());
+    click_chatter("[ErrorStatsReq] PBs Failed FEC block: %llu.", (unsigned long long) rx.pb_fail());
+    click_chatter("[ErrorStatsReq] Turbo Error bits Passed: %llu.", (unsigned long long) rx.tbe_pass());
+    click_chatter("[ErrorStatsReq] Turbo Error bits Failed: %llu.", (unsigned long long) rx.tbe_fail());
     // Printing stats per tonemap slot. Useful for analyzing noise/capacity per slot.
-    for (int i = 0; i < rx->num_rx_intervals; i++) {
+    for (uint32_t i = 0; i < rx.num_rx_intervals(); i++) {
+        PLCRxIntervalView slot = rx.interval(i);
         click_chatter("[ErrorStatsReq] Stats for Tonemap Slot %d ", i);
-        click_chatter("[ErrorStatsReq]      PHY Rate: %u", rx->rx_interval_stats[i].phyrate);
-        click_chatter("[ErrorStatsReq]      PBs Passed: %u", rx->rx_interval_stats[i].pb_pass);
-        click_chatter("[ErrorStatsReq]      PBs Failed: %u", rx->rx_interval_stats[i].pb_fail);
-        click_chatter("[ErrorStatsReq]      Turbo Error bits Passed: %u", rx->rx_interval_stats[i].tbe_pass);
-        click_chatter("[ErrorStatsReq]      Turbo Error bits Failed: %u", rx->rx_interval_stats[i].tbe_fail);
+        click_chatter("[ErrorStatsReq]      PHY Rate: %u", slot.phyrate());
+        click_chatter("[ErrorStatsReq]      PBs Passed: %llu", (unsigned long long) slot.pb_pass());
+        click_chatter("[ErrorStatsReq]      PBs Failed: %llu", (unsigned long long) slot.pb_fail());
+        click_chatter("[ErrorStatsReq]      Turbo Error bits Passed: %llu", (unsigned long long) slot.tbe_pass());
+        click_chatter("[ErrorStatsReq]      Turbo Error bits Failed: %llu", (unsigned long long) slot.tbe_fail());
     }
 
 }
 
 void
-ErrorStatsReq::processErrorStatsRep(click_hp_av_error_stats_rep *error_rep){
-    switch(error_rep->mstatus) {
+ErrorStatsReq::record_deltas(const ErrorStatsSnapshot &st, const Timestamp &now) {
+    uint64_t peer = PLCStore::peer_key(_switch.dst());
+    if (st.has_tx) {
+        _store->record(PLC_METRIC_TX_ACK, peer, now, st.tx_delta.mpdu_ack);
+        _store->record(PLC_METRIC_TX_COLL, peer, now, st.tx_delta.mpdu_coll);
+        _store->record(PLC_METRIC_TX_FAIL, peer, now, st.tx_delta.mpdu_fail);
+        _store->record(PLC_METRIC_TX_PB_FAIL, peer, now, st.tx_delta.pb_fail);
+    }
+    if (st.has_rx) {
+        _store->record(PLC_METRIC_RX_PB_PASS, peer, now, st.rx_delta.pb_pass);
+        _store->record(PLC_METRIC_RX_PB_FAIL, peer, now, st.rx_delta.pb_fail);
+    }
+}
+
+// Hands the PB counters of every tonemap interval to the correlator
+void
+ErrorStatsReq::correlate(const ErrorStatsRx &delta, const Timestamp &now) {
+    uint64_t pb_pass[PLC_MAX_RX_INTERVALS], pb_fail[PLC_MAX_RX_INTERVALS];
+    for (uint32_t i = 0; i < delta.num_intervals; i++) {
+        pb_pass[i] = delta.intervals[i].pb_pass;
+        pb_fail[i] = delta.intervals[i].pb_fail;
+    }
+    _correlator->add_window(pb_pass, pb_fail, delta.num_intervals, now);
+}
+
+// Collided MPDUs and failed PBs as shares of the last deltas, so that the
+// detectors follow the quality of the link rather than its load
+void
+ErrorStatsReq::detect_changes(const ErrorStatsSnapshot &st, const Timestamp &now) {
+    if (st.has_tx) {
+        const ErrorStatsTx &d = st.tx_delta;
+        if (uint64_t attempts = d.mpdu_ack + d.mpdu_coll + d.mpdu_fail)
+            _changes.update(this, 2, _change_tx_coll, PLC_METRIC_TX_COLL, _switch.dst().data(),
+                            1e6 * d.mpdu_coll / attempts, 1000, now.nsecval());
+        if (uint64_t pbs = d.pb_pass + d.pb_fail)
+            _changes.update(this, 2, _change_tx_pb_fail, PLC_METRIC_TX_PB_FAIL, _switch.dst().data(),
+                            1e6 * d.pb_fail / pbs, 1000, now.nsecval());
+    }
+    if (st.has_rx) {
+        const ErrorStatsRx &d = st.rx_delta;
+        if (uint64_t pbs = d.pb_pass + d.pb_fail)
+            _changes.update(this, 2, _change_rx_pb_fail, PLC_METRIC_RX_PB_FAIL, _switch.dst().data(),
+                            1e6 * d.pb_fail / pbs, 1000, now.nsecval());
+    }
+}
+
+// Copies the deltas of the last reply into the sample ring, unformatted
+void
+ErrorStatsReq::sample(const ErrorStatsSnapshot &st, bool deltas, const Timestamp &now) {
+    click_plc_sample &s = _samples.next();
+    s.time_ns = now.nsecval();
+    s.delta_us = deltas ? st.delta_ns / 1000 : 0;
+    s.kind = PLC_SAMPLE_ERRORSTATS;
+    s.slot = st.link_id;
+    s.status = st.mstatus;
+    s.flags = 0;
+    memset(s.v, 0, sizeof(s.v));
+    if (deltas && st.has_tx) {
+        s.flags |= PLC_SAMPLE_HAS_TX;
+        s.v[0] = plc_sample_value(st.tx_delta.mpdu_ack);
+        s.v[1] = plc_sample_value(st.tx_delta.mpdu_coll);
+        s.v[2] = plc_sample_value(st.tx_delta.mpdu_fail);
+        s.v[3] = plc_sample_value(st.tx_delta.pb_pass);
+        s.v[4] = plc_sample_value(st.tx_delta.pb_fail);
+    }
+    if (deltas && st.has_rx) {
+        s.flags |= PLC_SAMPLE_HAS_RX;
+        s.v[5] = plc_sample_value(st.rx_delta.mpdu_ack);
+        s.v[6] = plc_sample_value(st.rx_delta.mpdu_fail);
+        s.v[7] = plc_sample_value(st.rx_delta.pb_pass);
+        s.v[8] = plc_sample_value(st.rx_delta.pb_fail);
+        s.v[9] = plc_sample_value(st.rx_delta.tbe_fail);
+    }
+    _samples.publish();
+}
+
+void
+ErrorStatsReq::processErrorStatsRep(const PLCErrorStatsRepView &error_rep){
+    // The reply names the TEI of the station we asked about
+    if (_stations && error_rep.mstatus() == HPAV_SUC)
+        _stations->learn(error_rep.tei(), _switch.dst().data());
+
+
+    ErrorStatsSnapshot &st = _stats.begin_write();
+    Timestamp now = Timestamp::now();
+    st.requests = _requests_base + _switch.requests();
+    bool deltas = plc_update_error_stats(st, error_rep, now.nsecval());
+    if (deltas) {
+        if (_store)
+            record_deltas(st, now);
+        if (_correlator && st.has_rx)
+            correlate(st.rx_delta, now);
+    }
+    _stats.end_write();
+    if (_samples.active())
+        sample(st, deltas, now);
+    // Events may be pushed downstream; not while readers wait for the snapshot
+    if (deltas)
+        detect_changes(st, now);
+
+    if (!_verbose)
+        return;
+    switch(error_rep.mstatus()) {
     case HPAV_SUC:
         click_chatter("[ErrorStatsReq] Status of received MME: Success\n");
         break;
@@ -172,26 +408,137 @@ ErrorStatsReq::processErrorStatsRep(click_hp_av_error_stats_rep *error_rep){
         click_chatter("[ErrorStatsReq] Status of received MME: Invalid MAC address\n");
         break;
     }
+    if (error_rep.direction() > HPAV_SD_BOTH) {
+        click_chatter("[ErrorStatsReq] Unknown direction.");
+        return;
+    }
+    if (error_rep.has_tx())
+        print_tx_stats(error_rep.tx());
+    if (error_rep.has_rx())
+        print_rx_stats(error_rep.rx());
 
 
-    if (error_rep->direction == HPAV_SD_TX) {
-        print_tx_stats(&(error_rep->tx));
-    }
-    else if  (error_rep->direction == HPAV_SD_RX) {
-        print_rx_stats(&(error_rep->rx));
-    }
-    else if (error_rep->direction == HPAV_SD_BOTH) {
-        print_tx_stats(&(error_rep->txboth));
-        print_rx_stats(&(error_rep->rxboth));
+    return;
+}
+
+String
+ErrorStatsReq::read_stats() const
+{
+    ErrorStatsSnapshot st;
+    if (!_stats.read(st))
+        return String("busy\n");
+    st.requests = _requests_base + _switch.requests();
+
+    StringAccum sa;
+    sa << "dst " << _target.active().dst.unparse() << "\n";
+    plc_unparse_error_stats(sa, st);
+    sa << "stale " << _switch.dropped() << "\n";
+    return sa.take_string();
+}
+
+enum { h_dst, h_priority, h_direction, h_interval };
+
+String
+ErrorStatsReq::read_target(int what) const
+{
+    ErrorStatsTarget t = _target.active();
+    switch (what) {
+    case h_dst:
+        return t.dst.unparse();
+    case h_priority:
+        return String(t.prio);
+    case h_direction:
+        return String(t.dir);
+    default:
+        return String(t.interval_ms);
     }
-    else
-        click_chatter("[ErrorStatsReq] Unknown direction.");
+}
+
+// Stages the new value; it is used from the next poll on
+int
+ErrorStatsReq::reconfigure(int what, const String &str, ErrorHandler *errh)
+{
+    String s = cp_uncomment(str);
+    return _target.modify([&](ErrorStatsTarget &t) {
+        switch (what) {
+        case h_dst:
+            return Args(this, errh).push_back_words(s).read_mp("DST", t.dst).complete();
+        case h_priority:
+            if (Args(this, errh).push_back_words(s).read_mp("PRIORITY", t.prio).complete() < 0)
+                return -1;
+            return t.prio >= 0 && t.prio <= 3 ? 0 : errh->error("PRIORITY must be between 0 and 3");
+        case h_direction:
+            if (Args(this, errh).push_back_words(s).read_mp("DIRECTION", t.dir).complete() < 0)
+                return -1;
+            return t.dir >= 0 && t.dir <= HPAV_SD_BOTH ? 0 : errh->error("DIRECTION must be between 0 and %d", HPAV_SD_BOTH);
+        default:
+            if (Args(this, errh).push_back_words(s).read_mp("INTERVAL", t.interval_ms).complete() < 0)
+                return -1;
+            return _sync.check_interval(t.interval_ms, errh);
+        }
+    });
+}
 
+static String
+stats_handler(Element *e, void *)
+{
+    return ((ErrorStatsReq *) e)->read_stats();
+}
 
-    return;
+static String
+latency_handler(Element *e, void *)
+{
+    return ((ErrorStatsReq *) e)->read_latency();
+}
+
+static String
+events_handler(Element *e, void *)
+{
+    return ((ErrorStatsReq *) e)->read_events();
+}
+
+static int
+samples_handler(int, String &data, Element *e, const Handler *, ErrorHandler *errh)
+{
+    return ((ErrorStatsReq *) e)->read_samples(data, data, errh);
+}
+
+static String
+sampling_handler(Element *e, void *)
+{
+    return ((ErrorStatsReq *) e)->read_sampling();
+}
+
+static String
+read_target_handler(Element *e, void *user_data)
+{
+    return ((ErrorStatsReq *) e)->read_target((intptr_t) user_data);
+}
+
+static int
+reconfigure_handler(const String &str, Element *e, void *user_data, ErrorHandler *errh)
+{
+    return ((ErrorStatsReq *) e)->reconfigure((intptr_t) user_data, str, errh);
+}
+
+void
+ErrorStatsReq::add_handlers()
+{
+    static const char * const names[] = {"dst", "priority", "direction", "interval"};
+    add_read_handler("stats", stats_handler);
+    add_read_handler("latency", latency_handler);
+    add_read_handler("events", events_handler);
+    add_read_handler("sampling", sampling_handler);
+    set_handler("samples", Handler::f_read | Handler::f_read_param, samples_handler);
+    for (int i = h_dst; i <= h_interval; i++) {
+        add_read_handler(names[i], read_target_handler, i);
+        add_write_handler(names[i], reconfigure_handler, i);
+    }
 }
 
 
 CLICK_ENDDECLS
 EXPORT_ELEMENT(ErrorStatsReq)
+ELEMENT_REQUIRES(userlevel)
+ELEMENT_LIBS(-lrt)
 
@@ -6,9 +6,31 @@
 #include <click/sync.hh>
 #include <click/timer.hh>
 #include "PLCStats.h"
+#include "PLCView.h"
+#include "PLCChipset.h"
+#include "PLCSnapshot.h"
+#include "PLCBatch.h"
+#include "PLCPoll.h"
+#include "PLCTelemetry.h"
+#include "PLCCheckpoint.h"
+#include "PLCSync.h"
+#include "PLCReconfig.h"
+#include "PLCChange.h"
+#include "PLCSampler.h"
+#include "plcstore.hh"
+#include "sniffpackets.hh"
+#include "plccorrelator.hh"
+#include "plcstationtable.hh"
 
 CLICK_DECLS
 
+// Settings that the write handlers change at run time
+struct ErrorStatsTarget {
+    EtherAddress dst;
+    int prio;
+    int dir;
+    uint32_t interval_ms;
+};
 
 class ErrorStatsReq : public Element { public:
 
@@ -21,22 +43,72 @@ class ErrorStatsReq : public Element { public:
     int _dir;
 
     const char *class_name() const	{ return "ErrorStatsReq"; }
-    const char *port_count() const	{ return "1/2"; }
+    const char *port_count() const	{ return "1/2-3"; }
     const char *processing() const	{ return PUSH; }
     void *cast(const char *name);
     void run_timer(Timer *);
     int initialize(ErrorHandler *errh);
+    void cleanup(CleanupStage);
     int configure(Vector<String> &, ErrorHandler *);
     void push(int,Packet *);
-    //void add_handlers();
+#if HAVE_BATCH
+    void push_batch(int port, PacketBatch *batch);
+#endif
+    void add_handlers();
+    String read_stats() const;
+    bool read_snapshot(ErrorStatsSnapshot &st) const  { return _stats.read(st); }
+    String read_latency() const        { return _sync.unparse(); }
+    String read_target(int what) const;
+    String read_events() const          { return _changes.unparse(); }
+    int read_samples(const String &arg, String &result, ErrorHandler *errh) const {
+        return _samples.unparse(this, arg, result, errh);
+    }
+    String read_sampling() const        { return plc_unparse_sampling(_target.active().interval_ms, _clock, _samples); }
+    int reconfigure(int what, const String &str, ErrorHandler *errh);
 
 private:
     Timer _expire_timer_ms;
+    // sendErrorStatsReq instantiated for the configured chipset
+    void (ErrorStatsReq::*_send_req)();
+    PLCSnapshot<ErrorStatsSnapshot> _stats;
+    String _telemetry_name;
+    PLCTelemetrySegment _telemetry;
+    PLCStore *_store;
+    PLCCorrelator *_correlator;
+    PLCStationTable *_stations;
+    String _checkpoint_name;
+    uint32_t _checkpoint_interval;  // Seconds
+    uint32_t _checkpoint_maxage;    // Seconds, 0 for no limit
+    uint32_t _checkpoint_ms;        // Polled since the last checkpoint
+    PLCCheckpoint _checkpoint;
+    PLCRequestSync _sync;
+    Timer _sync_timer;             // Sends the requests of a poll at the aligned time
+    uint32_t _interval_ms;
+    PLCStaged<ErrorStatsTarget> _target;
+    PLCPeerSwitch _switch;
+    uint32_t _requests_base;       // Requests restored from the checkpoint
+    PLCChangeEvents _changes;
+    PLCChangeDetector _change_tx_coll;  // Shares of the last deltas, in ppm
+    PLCChangeDetector _change_tx_pb_fail;
+    PLCChangeDetector _change_rx_pb_fail;
+    bool _verbose;
+    uint32_t _samples_depth;
+    PLCSampleRing _samples;
+    PLCTickClock _clock;
+
+    Packet *handle(Packet *p);
+    void send_requests(bool aligned);
+    void apply(const ErrorStatsTarget &t);
+    void reset_peer();
 
-    void sendErrorStatsReq();
-    void print_tx_stats(tx_link_stats *);
-    void print_rx_stats(rx_link_stats *);
-    void processErrorStatsRep(click_hp_av_error_stats_rep *); 
+    template <typename Chip> void sendErrorStatsReq();
+    void print_tx_stats(const PLCTxLinkStatsView &);
+    void print_rx_stats(const PLCRxLinkStatsView &);
+    void processErrorStatsRep(const PLCErrorStatsRepView &);
+    void record_deltas(const ErrorStatsSnapshot &, const Timestamp &);
+    void correlate(const ErrorStatsRx &, const Timestamp &);
+    void detect_changes(const ErrorStatsSnapshot &, const Timestamp &);
+    void sample(const ErrorStatsSnapshot &, bool deltas, const Timestamp &);
   
 
 };
@@ -13,8 +13,10 @@
 #include "phyratesreq.hh"
 #include <clicknet/ether.h>
 #include "PLCStats.h"
+#include "PLCView.h"
 #include <click/etheraddress.hh>
 #include <click/confparse.hh>
+#include <click/args.hh>
 #include <click/bitvector.hh>
 #include <click/straccum.hh>
 #include <click/router.hh>
@@ -26,7 +28,9 @@ CLICK_DECLS
 #define TIMER_INTERVAL 1000 // timer interval in ms
 
 PhyRatesReq::PhyRatesReq()
-    :_expire_timer_ms(this)
+    :_expire_timer_ms(this), _send_req(&PhyRatesReq::send_mm_plc<PLCDefaultChipset>), _store(0), _stations(0),
+      _checkpoint_interval(10), _checkpoint_maxage(3600), _checkpoint_ms(0), _sync_timer(this),
+      _interval_ms(TIMER_INTERVAL), _change_npeers(0)
 {
 }
 
@@ -46,10 +50,59 @@ PhyRatesReq::cast(const char *name)
 
 
 int
-PhyRatesReq::initialize(ErrorHandler *)
+PhyRatesReq::configure(Vector<String> &conf, ErrorHandler *errh)
 {
+    String chipset = PLCDefaultChipset::name;
+    SniffPackets *sync = 0;
+    uint32_t sync_offset = 0, sync_baseline = 8;
+    if (Args(conf, this, errh).read("CHIPSET", WordArg(), chipset)
+                              .read("TELEMETRY", WordArg(), _telemetry_name)
+                              .read("STORE", ElementCastArg("PLCStore"), _store)
+                              .read("STATIONS", ElementCastArg("PLCStationTable"), _stations)
+                              .read("CHECKPOINT", FilenameArg(), _checkpoint_name)
+                              .read("CHECKPOINT_INTERVAL", _checkpoint_interval)
+                              .read("CHECKPOINT_MAXAGE", _checkpoint_maxage)
+                              .read("SYNC", ElementCastArg("SniffPackets"), sync)
+                              .read("SYNC_OFFSET", sync_offset)
+                              .read("SYNC_BASELINE", sync_baseline)
+                              .read("INTERVAL", _interval_ms)
+                              .read("CHANGE_THRESHOLD", _changes.params.threshold)
+                              .read("CHANGE_DRIFT", _changes.params.drift)
+                              .read("CHANGE_WARMUP", _changes.params.warmup)
+                              .complete() < 0)
+        return -1;
+    if (_changes.params.threshold <= 0)
+        return errh->error("CHANGE_THRESHOLD must be positive");
+    if (sync_offset >= 1000000)
+        return errh->error("SYNC_OFFSET must be below 1000000 us");
+    _sync.configure(sync ? sync->beacon_clock() : 0, sync_offset, sync_baseline);
+    if (_sync.check_interval(_interval_ms, errh) < 0)
+        return -1;
+    // Select the request builder of the chipset once
+    if (!plc_dispatch_chipset(chipset, [&](auto chip) {
+            _send_req = &PhyRatesReq::send_mm_plc<decltype(chip)>;
+        }, PLCChipsets()))
+        return errh->error("unknown CHIPSET %s", chipset.c_str());
+    return 0;
+}
+
+
+int
+PhyRatesReq::initialize(ErrorHandler *errh)
+{
+    if (_telemetry_name
+        && _telemetry.export_snapshot(_telemetry_name, PLC_TELEMETRY_PHYRATES, name(), _stats, 0, errh) < 0)
+        return -1;
+    if (_checkpoint_name) {
+        if (_checkpoint.open(_checkpoint_name, PLC_TELEMETRY_PHYRATES, name(), 0, sizeof(PhyRatesSnapshot), errh) < 0)
+            return -1;
+        if (_checkpoint.restore(_stats, _checkpoint_maxage, errh))
+            click_chatter("[PhyRatesReq] Restored state from %s", _checkpoint_name.c_str());
+    }
+    _target.init(_interval_ms);
     _expire_timer_ms.initialize(this);
-    _expire_timer_ms.schedule_after_msec(TIMER_INTERVAL);
+    _sync_timer.initialize(this);
+    _expire_timer_ms.schedule_after_msec(_interval_ms);
     return 0;
 }
 
@@ -57,62 +110,88 @@ PhyRatesReq::initialize(ErrorHandler *)
 void
 PhyRatesReq::run_timer(Timer *t)
 {
+    if (t == &_sync_timer) {
+        send_requests(true);
+        return;
+    }
+    // INTERVAL written by the handler since the last tick
+    _target.take(_interval_ms);
     // Get statistics for PLC rates. Send the management message with request.
-    send_mm_plc();
-    t->schedule_after_msec(TIMER_INTERVAL);
+    Timestamp at;
+    if (_sync_timer.scheduled())
+        _sync.skip();
+    else if (_sync.schedule(at))
+        _sync_timer.schedule_at(at);
+    else
+        send_requests(false);
+    _checkpoint_ms += _interval_ms;
+    if (_checkpoint.active() && _checkpoint_ms >= _checkpoint_interval * 1000) {
+        _checkpoint.save(_stats);
+        _checkpoint_ms = 0;
+    }
+    t->schedule_after_msec(_interval_ms);
+}
+
+void
+PhyRatesReq::send_requests(bool aligned)
+{
+    _sync.sent(0, aligned);
+    (this->*_send_req)();
+}
+
+void
+PhyRatesReq::cleanup(CleanupStage stage)
+{
+    // Keep the replies received since the last periodic checkpoint
+    if (stage >= CLEANUP_INITIALIZED && _checkpoint.active())
+        _checkpoint.save(_stats);
+    _checkpoint.close();
+    // Unmap and remove the telemetry object
+    _telemetry.close(_stats);
 }
 
 
+template <typename Chip>
 void
 PhyRatesReq::send_mm_plc()
 {
-    const unsigned char dst[6] = {0x00, 0xB0, 0x52, 0x00, 0x00, 0x01};
-    static_assert(Packet::default_headroom >= sizeof(click_ether));
-    WritablePacket *q = Packet::make(Packet::default_headroom - sizeof(click_ether),
-                                     NULL, sizeof(click_ether) + sizeof(click_hp_av_header), 0);
+    WritablePacket *q = plc_make_nw_stats_req(&PLCChipsetInfo<Chip>::info, NULL);
     if (!q) {
         click_chatter("[PhyRatesReq] cannot make packet!");
         return;
     }
-
-    click_ether *e = (click_ether *) q->data();
-    q->set_ether_header(e);
-    memset(e->ether_shost, 0x00, 6);
-    memcpy(e->ether_dhost, dst, 6);
-    e->ether_type = htons(ETHERTYPE_HP_AV);
-
-    click_hp_av_header *hpavh = (click_hp_av_header *) (e + 1);
-    hpavh->version = 1;
-    hpavh->MMType = htons(NW_STATS_REQ);
-    q->timestamp_anno().assign_now();
+    _stats.begin_write().requests++;
+    _stats.end_write();
     output(1).push(q);
 }
 
 
 
 // We received a reply from the PLC interface. 
-void
-PhyRatesReq::push(int port, Packet *p)
+Packet *
+PhyRatesReq::handle(Packet *p)
 {
     // Process the incoming packet and check if it is HP_AV
-    click_ether *ethh = (click_ether *) p->data();
-    if (ethh->ether_type != htons(ETHERTYPE_HP_AV)) {
-        output(0).push(p);
-        return;
+    PLCMMEView mme(p);
+    if (!mme.is_hpav()) {
+        return p;
     }    
 
-    // Process the incoming HP_AV Management message
-    click_hp_av_header *hpavh = (click_hp_av_header *) (ethh + 1);
-    //click_chatter("[PhyRatesReq] ")%u type ",hpavh->MMType);
-
     // Forward the packet if it is not the correct one
-    if (hpavh->MMType != htons(NW_STATS_REP)) {
-        output(0).push(p);
-        return;
+    if (mme.mmtype() != NW_STATS_REP) {
+        return p;
     }
 
 
-    click_hp_av_nw_stats_conf *nwstats = (click_hp_av_nw_stats_conf *) (hpavh + 1);
+    PLCNwStatsConfView nwstats(mme);
+    if (!nwstats.valid()) {
+        click_chatter("[PhyRatesReq] Truncated NW_STATS reply of %u bytes", nwstats.length());
+        _stats.begin_write().malformed++;
+        _stats.end_write();
+        p->kill();
+        return 0;
+    }
+    _sync.replied(0);
     int rxstats;
     int txstats;
 
@@ -120,21 +199,137 @@ PhyRatesReq::push(int port, Packet *p)
     Timestamp now;
     now.assign_now();
 
-    click_chatter("[PhyRatesReq] Time %s, Number of STAs in network %d", now.unparse().c_str(), (int) nwstats->sta.NumSTAs);
+    click_chatter("[PhyRatesReq] Time %s, Number of STAs in network %d", now.unparse().c_str(), (int) nwstats.num_stas());
+
+    plc_update_phy_rates(_stats.begin_write(), nwstats, now.nsecval());
+    _stats.end_write();
+    if (_stations)
+        _stations->refresh(nwstats);
+
+    if (_store)
+        for (uint32_t i = 0; i < nwstats.num_stas(); i++) {
+            const cm_sta_info &sta = nwstats.sta(i);
+            _store->record(PLC_METRIC_PHY_TX, PLCStore::peer_key(sta.DA), now, sta.AvgPHYDR_TX);
+            _store->record(PLC_METRIC_PHY_RX, PLCStore::peer_key(sta.DA), now, sta.AvgPHYDR_RX);
+        }
+
+    for (uint32_t i = 0; i < nwstats.num_stas(); i++) {
+        const cm_sta_info &sta = nwstats.sta(i);
+        if (PhyRatesChange *c = change_peer(sta.DA)) {
+            _changes.update(this, 2, c->tx, PLC_METRIC_PHY_TX, sta.DA, sta.AvgPHYDR_TX, 1, now.nsecval());
+            _changes.update(this, 2, c->rx, PLC_METRIC_PHY_RX, sta.DA, sta.AvgPHYDR_RX, 1, now.nsecval());
+        }
+    }
 
-    for (int i = 0; i < (int) nwstats->sta.NumSTAs; i++) {
-        EtherAddress station = EtherAddress(nwstats->sta.infos[i].DA);
-        rxstats = nwstats->sta.infos[i].AvgPHYDR_RX;
-        txstats =  nwstats->sta.infos[i].AvgPHYDR_TX;
+    for (uint32_t i = 0; i < nwstats.num_stas(); i++) {
+        const cm_sta_info &sta = nwstats.sta(i);
+        EtherAddress station = EtherAddress(sta.DA);
+        rxstats = sta.AvgPHYDR_RX;
+        txstats = sta.AvgPHYDR_TX;
         click_chatter("[PhyRatesReq] MAC address: %s , Avg PHY rate from STA to DA: %d", station.unparse().c_str(), txstats);
         click_chatter("[PhyRatesReq] MAC address: %s , Avg PHY rate from DA to STA: %d", station.unparse().c_str(), rxstats);
     }
     p->kill();
+    return 0;
 }
 
+// Detectors of a peer, new ones for a peer not seen before
+PhyRatesChange *
+PhyRatesReq::change_peer(const uint8_t *mac)
+{
+    for (uint32_t i = 0; i < _change_npeers; i++)
+        if (memcmp(_change_peers[i].mac, mac, 6) == 0)
+            return &_change_peers[i];
+    if (_change_npeers == PLC_MAX_STAS)
+        return 0;
+    PhyRatesChange *c = &_change_peers[_change_npeers++];
+    memcpy(c->mac, mac, 6);
+    return c;
+}
 
+void
+PhyRatesReq::push(int, Packet *p)
+{
+    if ((p = handle(p)))
+        output(0).push(p);
+}
+
+#if HAVE_BATCH
+void
+PhyRatesReq::push_batch(int, PacketBatch *batch)
+{
+    plc_push_batch(output(0), batch, [this](Packet *p) { return handle(p); });
+}
+#endif
+
+
+String
+PhyRatesReq::read_stats() const
+{
+    PhyRatesSnapshot st;
+    if (!_stats.read(st))
+        return String("busy\n");
+
+    StringAccum sa;
+    plc_unparse_phy_rates(sa, st);
+    return sa.take_string();
+}
+
+static String
+stats_handler(Element *e, void *)
+{
+    return ((PhyRatesReq *) e)->read_stats();
+}
+
+static String
+latency_handler(Element *e, void *)
+{
+    return ((PhyRatesReq *) e)->read_latency();
+}
+
+static String
+events_handler(Element *e, void *)
+{
+    return ((PhyRatesReq *) e)->read_events();
+}
+
+// Stages the new interval; it is used from the next poll on
+int
+PhyRatesReq::reconfigure(const String &str, ErrorHandler *errh)
+{
+    String s = cp_uncomment(str);
+    return _target.modify([&](uint32_t &interval_ms) {
+        if (Args(this, errh).push_back_words(s).read_mp("INTERVAL", interval_ms).complete() < 0)
+            return -1;
+        return _sync.check_interval(interval_ms, errh);
+    });
+}
+
+static String
+interval_handler(Element *e, void *)
+{
+    return ((PhyRatesReq *) e)->read_interval();
+}
+
+static int
+reconfigure_handler(const String &str, Element *e, void *, ErrorHandler *errh)
+{
+    return ((PhyRatesReq *) e)->reconfigure(str, errh);
+}
+
+void
+PhyRatesReq::add_handlers()
+{
+    add_read_handler("stats", stats_handler);
+    add_read_handler("latency", latency_handler);
+    add_read_handler("interval", interval_handler);
+    add_write_handler("interval", reconfigure_handler);
+    add_read_handler("events", events_handler);
+}
 
 
 CLICK_ENDDECLS
 EXPORT_ELEMENT(PhyRatesReq)
+ELEMENT_REQUIRES(userlevel)
+ELEMENT_LIBS(-lrt)
 ELEMENT_MT_SAFE(PhyRatesReq)
@@ -3,27 +3,81 @@
 #include <click/element.hh>
 #include <click/sync.hh>
 #include <click/timer.hh>
+#include "PLCChipset.h"
+#include "PLCSnapshot.h"
+#include "PLCBatch.h"
+#include "PLCPoll.h"
+#include "PLCTelemetry.h"
+#include "PLCCheckpoint.h"
+#include "PLCSync.h"
+#include "PLCReconfig.h"
+#include "PLCChange.h"
+#include "plcstore.hh"
+#include "sniffpackets.hh"
+#include "plcstationtable.hh"
 CLICK_DECLS
 
+// Change detectors of the PHY rates of a peer
+struct PhyRatesChange {
+    uint8_t mac[6];
+    PLCChangeDetector tx;
+    PLCChangeDetector rx;
+};
+
 class PhyRatesReq : public Element { public:
 
     PhyRatesReq();
     ~PhyRatesReq();
 
     const char *class_name() const      { return "PhyRatesReq"; }
-    const char *port_count() const      { return "1/2"; }
+    const char *port_count() const      { return "1/2-3"; }
     const char *processing() const      { return PUSH; }
     const char *flow_code() const       { return "xyyy/xx"; }
     const char *flags() const           { return "L2"; }
     void *cast(const char *name);
+    int configure(Vector<String> &, ErrorHandler *);
     int initialize(ErrorHandler *errh);
+    void cleanup(CleanupStage);
     void push(int port, Packet *p);
+#if HAVE_BATCH
+    void push_batch(int port, PacketBatch *batch);
+#endif
     void run_timer(Timer *);
+    void add_handlers();
+    String read_stats() const;
+    bool read_snapshot(PhyRatesSnapshot &st) const    { return _stats.read(st); }
+    String read_latency() const        { return _sync.unparse(); }
+    String read_interval() const        { return String(_target.active()); }
+    String read_events() const          { return _changes.unparse(); }
+    int reconfigure(const String &str, ErrorHandler *errh);
 
 
 private:
     Timer _expire_timer_ms;
-    void send_mm_plc();
+    // send_mm_plc instantiated for the configured chipset
+    void (PhyRatesReq::*_send_req)();
+    PLCSnapshot<PhyRatesSnapshot> _stats;
+    String _telemetry_name;
+    PLCTelemetrySegment _telemetry;
+    PLCStore *_store;
+    PLCStationTable *_stations;
+    String _checkpoint_name;
+    uint32_t _checkpoint_interval;  // Seconds
+    uint32_t _checkpoint_maxage;    // Seconds, 0 for no limit
+    uint32_t _checkpoint_ms;        // Polled since the last checkpoint
+    PLCCheckpoint _checkpoint;
+    PLCRequestSync _sync;
+    Timer _sync_timer;             // Sends the requests of a poll at the aligned time
+    uint32_t _interval_ms;
+    PLCStaged<uint32_t> _target;   // INTERVAL written by the handler
+    PLCChangeEvents _changes;
+    PhyRatesChange _change_peers[PLC_MAX_STAS];
+    uint32_t _change_npeers;
+
+    Packet *handle(Packet *p);
+    void send_requests(bool aligned);
+    template <typename Chip> void send_mm_plc();
+    PhyRatesChange *change_peer(const uint8_t *mac);
     static void expire_hook(Timer *, void *);
 
 };
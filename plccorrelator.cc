@@ -0,0 +1,278 @@
+/*
+ * plccorrelator.{cc,hh} -- Cross-layer correlation of sniffed MPDUs and PB errors
+ *
+ * SniffPackets adds the airtime of every overheard MPDU to a cumulative
+ * counter per (beacon-period slot, transmitter). ErrorStatsReq closes a
+ * window with every reply: the airtime counters are diffed against their
+ * previous sample and stored in a ring together with the PB passes and
+ * failures of every tonemap interval. Running sums over the ring are updated
+ * by adding the new window and subtracting the one it replaces, so that the
+ * blame and correlation of every (slot, transmitter) pair are available at
+ * any time for a constant cost per reply.
+ */
+
+#include <click/config.h>
+#include "plccorrelator.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/glue.hh>
+#include <math.h>
+CLICK_DECLS
+
+PLCCorrelator::PLCCorrelator()
+    : _period_ns(40000000), _nslots(NUMBER_OF_SLOTS), _nwindows(32),
+      _mpdus(0), _unsynced(0), _ring_airtime(0), _ring_pass(0), _ring_fail(0),
+      _ring_head(0), _pairs(0)
+{
+}
+
+PLCCorrelator::~PLCCorrelator()
+{
+}
+
+void *
+PLCCorrelator::cast(const char *name)
+{
+    if (strcmp(name, "PLCCorrelator") == 0)
+        return this;
+    else
+        return Element::cast(name);
+}
+
+int
+PLCCorrelator::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    uint32_t period_us = _period_ns / 1000;
+    if (Args(conf, this, errh).read("BEACON_PERIOD", period_us)
+                              .read("SLOTS", _nslots)
+                              .read("WINDOWS", _nwindows)
+                              .complete() < 0)
+        return -1;
+    if (period_us == 0 || period_us > 1000000)
+        return errh->error("BEACON_PERIOD must be between 1 and 1000000 us");
+    if (_nslots == 0 || _nslots > PLC_CORR_MAX_SLOTS)
+        return errh->error("SLOTS must be between 1 and %d", PLC_CORR_MAX_SLOTS);
+    if (_nwindows == 0 || _nwindows > 4096)
+        return errh->error("WINDOWS must be between 1 and 4096");
+    _period_ns = period_us * 1000;
+    return 0;
+}
+
+int
+PLCCorrelator::initialize(ErrorHandler *errh)
+{
+    _ring_airtime = new uint32_t[_nwindows * _nslots * 256];
+    _ring_pass = new uint32_t[_nwindows * _nslots];
+    _ring_fail = new uint32_t[_nwindows * _nslots];
+    _pairs = new CorrPairSums[_nslots * 256];
+    if (!_ring_airtime || !_ring_pass || !_ring_fail || !_pairs)
+        return errh->error("out of memory");
+    memset(_pairs, 0, sizeof(CorrPairSums) * _nslots * 256);
+    memset(_live_airtime, 0, sizeof(_live_airtime));
+    memset(_seen_airtime, 0, sizeof(_seen_airtime));
+    return 0;
+}
+
+void
+PLCCorrelator::cleanup(CleanupStage)
+{
+    delete[] _ring_airtime;
+    delete[] _ring_pass;
+    delete[] _ring_fail;
+    delete[] _pairs;
+    _ring_airtime = _ring_pass = _ring_fail = 0;
+    _pairs = 0;
+}
+
+void
+PLCCorrelator::add_mpdu(uint64_t since_beacon_ns, uint8_t stei, uint32_t duration_us)
+{
+    if (since_beacon_ns >= _period_ns) {
+        // A beacon was missed, the phase is unknown
+        __atomic_store_n(&_unsynced, _unsynced + 1, __ATOMIC_RELAXED);
+        return;
+    }
+    uint32_t slot = since_beacon_ns * _nslots / _period_ns;
+    uint32_t *a = &_live_airtime[slot][stei];
+    __atomic_store_n(a, *a + duration_us, __ATOMIC_RELAXED);
+    __atomic_store_n(&_mpdus, _mpdus + 1, __ATOMIC_RELAXED);
+}
+
+// Adds (sign 1) or removes (sign -1) window w to/from the running sums
+void
+PLCCorrelator::apply_window(uint32_t w, CorrelatorSnapshot &st, int sign)
+{
+    const uint32_t *air = _ring_airtime + w * _nslots * 256;
+    for (uint32_t s = 0; s < _nslots; s++) {
+        uint32_t pass = _ring_pass[w * _nslots + s];
+        uint32_t fail = _ring_fail[w * _nslots + s];
+        if (pass + fail == 0)
+            continue;
+        // At most 2^24 and 2^48; over 4096 windows, at most 2^36 and 2^60
+        int64_t y = (((uint64_t) fail << PLC_CORR_Y_SHIFT) + (pass + fail) / 2) / (pass + fail);
+        CorrSlotSums &ss = st.slots[s];
+        ss.windows += sign;
+        ss.pb_pass += (int64_t) sign * pass;
+        ss.pb_fail += (int64_t) sign * fail;
+        ss.sy += sign * y;
+        ss.syy += sign * y * y;
+
+        const uint32_t *a = air + s * 256;
+        uint64_t total = 0;
+        for (int t = 0; t < 256; t++)
+            total += a[t];
+        if (total == 0)
+            continue;
+        CorrPairSums *p = _pairs + s * 256;
+        for (int t = 0; t < 256; t++)
+            if (a[t]) {
+                // x < 2^25: x * x < 2^50, x * y < 2^49
+                int64_t x = a[t];
+                p[t].sx += sign * x;
+                p[t].sxx += sign * x * x;
+                p[t].sxy += sign * x * y;
+                // Rounded the same way when the window leaves
+                p[t].blame += sign * llround(ldexp((double) fail * a[t] / total, PLC_CORR_BLAME_SHIFT));
+            }
+    }
+}
+
+void
+PLCCorrelator::add_window(const uint64_t *pb_pass, const uint64_t *pb_fail, uint32_t nintervals,
+                          const Timestamp &now)
+{
+    if (!_pairs)
+        return;
+    uint32_t w = _ring_head;
+    CorrelatorSnapshot &st = _stats.begin_write();
+    if (st.ring_windows == _nwindows)
+        apply_window(w, st, -1);
+    else
+        st.ring_windows++;
+
+    uint32_t *air = _ring_airtime + w * _nslots * 256;
+    for (uint32_t s = 0; s < _nslots; s++) {
+        for (int t = 0; t < 256; t++) {
+            uint32_t live = __atomic_load_n(&_live_airtime[s][t], __ATOMIC_RELAXED);
+            uint32_t diff = live - _seen_airtime[s][t];
+            air[s * 256 + t] = diff < PLC_CORR_MAX_AIRTIME_US ? diff : PLC_CORR_MAX_AIRTIME_US;
+            _seen_airtime[s][t] = live;
+        }
+        // Slots without a tonemap interval carry no PBs; the clamp keeps
+        // pass + fail within 32 bits
+        bool known = s < nintervals;
+        _ring_pass[w * _nslots + s] = known ? (uint32_t) (pb_pass[s] < 0x7FFFFFFF ? pb_pass[s] : 0x7FFFFFFF) : 0;
+        _ring_fail[w * _nslots + s] = known ? (uint32_t) (pb_fail[s] < 0x7FFFFFFF ? pb_fail[s] : 0x7FFFFFFF) : 0;
+    }
+    apply_window(w, st, 1);
+    st.windows++;
+    st.last_window_ns = now.nsecval();
+    _stats.end_write();
+    _ring_head = (w + 1) % _nwindows;
+}
+
+bool
+PLCCorrelator::read_pairs(CorrelatorSnapshot &st, CorrPairSums *pairs) const
+{
+    return _stats.read(st, _pairs, pairs, sizeof(CorrPairSums) * _nslots * 256);
+}
+
+int
+PLCCorrelator::read_blame(const String &arg, String &result, ErrorHandler *errh) const
+{
+    int only = -1, top = 5;
+    if (Args(this, errh).push_back_words(arg)
+                        .read_p("SLOT", only)
+                        .read_p("TOP", top)
+                        .complete() < 0)
+        return -1;
+    if (only >= (int) _nslots)
+        return errh->error("SLOT must be below %u", _nslots);
+
+    CorrelatorSnapshot st;
+    CorrPairSums *pairs = new CorrPairSums[_nslots * 256];
+    if (!pairs || !read_pairs(st, pairs)) {
+        delete[] pairs;
+        return errh->error("busy");
+    }
+
+    StringAccum sa;
+    for (uint32_t s = 0; s < _nslots; s++) {
+        if (only >= 0 && s != (uint32_t) only)
+            continue;
+        const CorrSlotSums &ss = st.slots[s];
+        uint64_t pbs = ss.pb_pass + ss.pb_fail;
+        sa << "slot " << s << " windows " << ss.windows << " pb_pass " << ss.pb_pass
+           << " pb_fail " << ss.pb_fail << " fail_rate " << (pbs ? (double) ss.pb_fail / pbs : 0.) << "\n";
+        if (ss.windows == 0)
+            continue;
+
+        // Selection of the TOP most blamed transmitters
+        const CorrPairSums *p = pairs + s * 256;
+        bool shown[256] = {};
+        for (int k = 0; k < top; k++) {
+            int best = -1;
+            for (int t = 0; t < 256; t++)
+                if (!shown[t] && p[t].blame > (1 << (PLC_CORR_BLAME_SHIFT - 1))
+                    && (best < 0 || p[t].blame > p[best].blame))
+                    best = t;
+            if (best < 0)
+                break;
+            shown[best] = true;
+
+            // Moments from the exact integer sums; y in units of 2^-24
+            double n = ss.windows;
+            double mx = p[best].sx / n, my = ss.sy / n;
+            double vx = p[best].sxx / n - mx * mx;
+            double vy = ss.syy / n - my * my;
+            double cov = p[best].sxy / n - mx * my;
+            double r = vx > 0 && vy > 0 ? cov / sqrt(vx * vy) : 0;
+            double blame = ldexp((double) p[best].blame, -PLC_CORR_BLAME_SHIFT);
+            sa << "  tei " << best << " airtime_ms " << p[best].sx / 1000.
+               << " blame " << blame
+               << " share " << (ss.pb_fail ? 100 * blame / ss.pb_fail : 0.)
+               << " corr " << r << "\n";
+        }
+    }
+    delete[] pairs;
+    result = sa.take_string();
+    return 0;
+}
+
+String
+PLCCorrelator::read_stats() const
+{
+    CorrelatorSnapshot st;
+    if (!_stats.read(st))
+        return String("busy\n");
+
+    StringAccum sa;
+    sa << "mpdus " << __atomic_load_n(&_mpdus, __ATOMIC_RELAXED) << "\n"
+       << "unsynced " << __atomic_load_n(&_unsynced, __ATOMIC_RELAXED) << "\n"
+       << "windows " << st.windows << "\n"
+       << "ring_windows " << st.ring_windows << "\n"
+       << "last_window " << Timestamp::make_nsec(st.last_window_ns).unparse() << "\n";
+    return sa.take_string();
+}
+
+static int
+blame_handler(int, String &data, Element *e, const Handler *, ErrorHandler *errh)
+{
+    return ((PLCCorrelator *) e)->read_blame(data, data, errh);
+}
+
+static String
+stats_handler(Element *e, void *)
+{
+    return ((PLCCorrelator *) e)->read_stats();
+}
+
+void
+PLCCorrelator::add_handlers()
+{
+    set_handler("blame", Handler::f_read | Handler::f_read_param, blame_handler);
+    add_read_handler("stats", stats_handler);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(PLCCorrelator)
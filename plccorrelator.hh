@@ -0,0 +1,138 @@
+#ifndef CLICK_PLCCORRELATOR_HH
+#define CLICK_PLCCORRELATOR_HH
+#include <click/element.hh>
+#include <click/straccum.hh>
+#include <click/timestamp.hh>
+#include "PLCStats.h"
+#include "PLCSnapshot.h"
+CLICK_DECLS
+
+/*
+=c
+
+PLCCorrelator([I<keywords> BEACON_PERIOD, SLOTS, WINDOWS])
+
+=s PLC
+
+Attributes PB failures to beacon-period slots and to overheard transmitters
+
+=d
+
+Joins the MPDUs overheard by SniffPackets with the per-tonemap-slot error
+statistics received by ErrorStatsReq (both given CORRELATOR pointing to this
+element). The beacon period of BEACON_PERIOD us (default 40000, two mains
+cycles at 50 Hz) is divided into SLOTS equal slots (default 6, at most 16);
+slot I is matched with tonemap interval I of the reception statistics. Every
+MPDU adds its duration to the airtime of its transmitter (STEI) in the slot
+given by its time since the last beacon.
+
+Each error statistics reply closes a window: the PB passes and failures per
+slot since the previous reply, and the airtime per slot and transmitter over
+the same time. The element keeps the last WINDOWS windows (default 32) and
+running sums over them, updated incrementally when a window enters or leaves,
+so the cost per reply does not depend on WINDOWS. The sums are kept in
+integers (error rates and blamed failures in fixed point), so that a window
+leaving subtracts exactly what it added and they do not drift. The airtime of
+a transmitter in a slot is capped at 32 s per window. The failures of a slot in a
+window are blamed on the transmitters in proportion to their airtime there;
+the correlation between the airtime of a transmitter and the PB error rate of
+the slot across the windows tells apart a busy neighbour from a harmful one.
+
+=h blame read-only with parameter
+
+"[SLOT] [TOP]": for every slot (or only SLOT), the windows, PB passes,
+failures and error rate, followed by the TOP transmitters (default 5) with
+the most blamed failures, their airtime in ms, blamed failures, share of the
+failures and correlation.
+
+=h stats read-only
+
+Counters of the joined MPDUs and windows.
+*/
+
+#define PLC_CORR_MAX_SLOTS PLC_MAX_RX_INTERVALS
+#define PLC_CORR_Y_SHIFT        24  // PB error rates in fixed point
+#define PLC_CORR_BLAME_SHIFT    16  // Blamed failures in fixed point
+// Airtime per window, slot and transmitter; larger values are clamped so
+// that the sums of squares over 4096 windows fit in 63 bits
+#define PLC_CORR_MAX_AIRTIME_US (1U << 25)
+
+// The running sums are integers: every window adds terms rounded once, and
+// subtracts exactly the same terms when it leaves, so the sums do not
+// drift however long the element runs.
+
+// Running sums of a slot over the windows of the ring
+struct CorrSlotSums {
+    uint32_t windows;           // Windows in which the slot carried PBs
+    uint32_t reserved;
+    uint64_t pb_pass;
+    uint64_t pb_fail;
+    int64_t sy;                 // PB error rate << PLC_CORR_Y_SHIFT
+    int64_t syy;
+};
+
+// Running sums of a (slot, transmitter) pair over the same windows
+struct CorrPairSums {
+    int64_t sx;                 // Airtime in us
+    int64_t sxx;
+    int64_t sxy;                // Airtime times error rate << PLC_CORR_Y_SHIFT
+    int64_t blame;              // Failures attributed by airtime share << PLC_CORR_BLAME_SHIFT
+};
+
+// Published after every window, with the pair sums
+struct CorrelatorSnapshot {
+    uint64_t last_window_ns;
+    uint32_t windows;           // Windows closed since initialization
+    uint32_t ring_windows;      // Windows currently in the sums
+    CorrSlotSums slots[PLC_CORR_MAX_SLOTS];
+};
+
+class PLCCorrelator : public Element { public:
+
+    PLCCorrelator();
+    ~PLCCorrelator();
+
+    const char *class_name() const      { return "PLCCorrelator"; }
+    const char *port_count() const      { return PORTS_0_0; }
+    void *cast(const char *name);
+    int configure(Vector<String> &, ErrorHandler *);
+    int initialize(ErrorHandler *errh);
+    void cleanup(CleanupStage);
+    void add_handlers();
+
+    // Called by SniffPackets for every overheard MPDU
+    void add_mpdu(uint64_t since_beacon_ns, uint8_t stei, uint32_t duration_us);
+    // Called by ErrorStatsReq with the increase of the PB counters of every
+    // tonemap interval since its previous reply; closes the current window
+    void add_window(const uint64_t *pb_pass, const uint64_t *pb_fail, uint32_t nintervals,
+                    const Timestamp &now);
+
+    int read_blame(const String &arg, String &result, ErrorHandler *errh) const;
+    String read_stats() const;
+
+private:
+    uint32_t _period_ns;
+    uint32_t _nslots;
+    uint32_t _nwindows;
+
+    // Cumulative airtime per slot and transmitter, written by the sniffer
+    // thread only; a window is the difference between two samples of it
+    uint32_t _live_airtime[PLC_CORR_MAX_SLOTS][256];
+    uint32_t _mpdus;
+    uint32_t _unsynced;         // MPDUs more than a beacon period after the last beacon
+
+    // Written by the thread of ErrorStatsReq only
+    uint32_t _seen_airtime[PLC_CORR_MAX_SLOTS][256];
+    uint32_t *_ring_airtime;    // [_nwindows][_nslots][256]
+    uint32_t *_ring_pass;       // [_nwindows][_nslots]
+    uint32_t *_ring_fail;
+    uint32_t _ring_head;
+    PLCSnapshot<CorrelatorSnapshot> _stats;
+    CorrPairSums *_pairs;       // [_nslots][256], written under _stats
+
+    void apply_window(uint32_t w, CorrelatorSnapshot &st, int sign);
+    bool read_pairs(CorrelatorSnapshot &, CorrPairSums *) const;
+};
+
+CLICK_ENDDECLS
+#endif
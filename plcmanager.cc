@@ -0,0 +1,278 @@
+/*
+ * plcmanager.{cc,hh} -- Statistics of several PLC devices in one element
+ *
+ * One shard per PLC interface: its own timer, moved to the thread of the
+ * interface, and its own snapshots. The requests, the parsing of the
+ * replies and the text output are the ones of PhyRatesReq, TonemapReq and
+ * ErrorStatsReq (PLCPoll.h), so a device behaves as the three elements
+ * together would.
+ */
+
+#include <click/config.h>
+#include "plcmanager.hh"
+#include <click/args.hh>
+#include <click/confparse.hh>
+#include <click/error.hh>
+#include <click/glue.hh>
+#include <click/straccum.hh>
+CLICK_DECLS
+
+PLCManager::PLCManager()
+    : _interval_ms(1000)
+{
+}
+
+PLCManager::~PLCManager()
+{
+}
+
+void *
+PLCManager::cast(const char *name)
+{
+    if (strcmp(name, "PLCManager") == 0)
+        return this;
+    else
+        return Element::cast(name);
+}
+
+int
+PLCManager::parse_device(Device *d, const String &spec, ErrorHandler *errh)
+{
+    Vector<String> conf;
+    cp_argvec(spec, conf);
+    String chipset = PLCDefaultChipset::name;
+    if (Args(conf, this, errh).read_m("SRC", d->src)
+                              .read("DST", d->dst).read_status(d->has_dst)
+                              .read("PRIORITY", d->prio)
+                              .read("DIRECTION", d->dir)
+                              .read("CHIPSET", WordArg(), chipset)
+                              .read("THREAD", d->thread)
+                              .complete() < 0)
+        return -1;
+    if (!plc_dispatch_chipset(chipset, [&](auto chip) {
+            typedef decltype(chip) Chip;
+            d->chip = &PLCChipsetInfo<Chip>::info;
+            d->tonemap_rate = &plc_tonemap_rate<Chip>;
+        }, PLCChipsets()))
+        return errh->error("unknown CHIPSET %s", chipset.c_str());
+    return 0;
+}
+
+int
+PLCManager::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    Vector<String> specs;
+    if (Args(conf, this, errh).read_all("DEVICE", AnyArg(), specs)
+                              .read("INTERVAL", _interval_ms)
+                              .complete() < 0)
+        return -1;
+    if (specs.size() != ninputs() || 2 * ninputs() != noutputs())
+        return errh->error("need one DEVICE per input and two outputs per input");
+    if (_interval_ms == 0)
+        return errh->error("INTERVAL must be positive");
+
+    for (int i = 0; i < specs.size(); i++) {
+        Device *d = new Device(this, i);
+        _devices.push_back(d);
+        PrefixErrorHandler perrh(errh, String("DEVICE ") + String(i) + ": ");
+        if (parse_device(d, cp_unquote(specs[i]), &perrh) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+int
+PLCManager::initialize(ErrorHandler *)
+{
+    for (int i = 0; i < _devices.size(); i++) {
+        Device *d = _devices[i];
+        d->timer.initialize(this);
+        if (d->thread >= 0)
+            d->timer.move_thread(d->thread);
+        d->timer.schedule_after_msec(_interval_ms);
+    }
+    return 0;
+}
+
+void
+PLCManager::cleanup(CleanupStage)
+{
+    for (int i = 0; i < _devices.size(); i++)
+        delete _devices[i];
+    _devices.clear();
+}
+
+void
+PLCManager::timer_hook(Timer *t, void *user_data)
+{
+    Device *d = (Device *) user_data;
+    d->owner->poll(d);
+    t->reschedule_after_msec(d->owner->_interval_ms);
+}
+
+void
+PLCManager::send(Device *d, WritablePacket *q)
+{
+    if (!q) {
+        click_chatter("[PLCManager] cannot make packet!");
+        return;
+    }
+    output(2 * d->port + 1).push(q);
+}
+
+// Runs on the timer thread, which need not be the one receiving the
+// replies: the requests are counted apart from the snapshots
+void
+PLCManager::poll(Device *d)
+{
+    __atomic_fetch_add(&d->phy_requests, 1, __ATOMIC_RELAXED);
+    send(d, plc_make_nw_stats_req(d->chip, d->src.data()));
+    if (!d->has_dst)
+        return;
+
+    for (int s = 0; s < NUMBER_OF_SLOTS; s++) {
+        __atomic_fetch_add(&d->tonemap_requests, 1, __ATOMIC_RELAXED);
+        send(d, plc_make_tone_map_req(d->chip, d->src.data(), d->dst.data(), s));
+    }
+    __atomic_fetch_add(&d->error_requests, 1, __ATOMIC_RELAXED);
+    send(d, plc_make_error_stats_req(d->chip, d->src.data(), d->dst.data(), d->prio, d->dir));
+}
+
+Packet *
+PLCManager::handle(int port, Packet *p)
+{
+    Device *d = _devices[port];
+    PLCMMEView mme(p);
+    if (!mme.is_hpav())
+        return p;
+
+    uint64_t now = plc_now_ns();
+    switch (mme.mmtype()) {
+    case NW_STATS_REP: {
+        PLCNwStatsConfView nwstats(mme);
+        PhyRatesSnapshot &st = d->phy.begin_write();
+        if (nwstats.valid())
+            plc_update_phy_rates(st, nwstats, now);
+        else
+            st.malformed++;
+        d->phy.end_write();
+        break;
+    }
+    case TONE_MAP_REP: {
+        PLCToneMapRepView tm_rep(mme);
+        TonemapSnapshot &st = d->tonemap.begin_write();
+        if (!tm_rep.valid())
+            st.malformed++;
+        else if (plc_count_tonemap_reply(st, tm_rep))
+            plc_update_tonemap_slot(st, tm_rep, d->tonemap_rate(tm_rep), now);
+        d->tonemap.end_write();
+        break;
+    }
+    case ERROR_STATS_REP: {
+        PLCErrorStatsRepView error_rep(mme);
+        ErrorStatsSnapshot &st = d->errors.begin_write();
+        if (error_rep.valid())
+            plc_update_error_stats(st, error_rep, now);
+        else
+            st.malformed++;
+        d->errors.end_write();
+        break;
+    }
+    default:
+        return p;
+    }
+    p->kill();
+    return 0;
+}
+
+void
+PLCManager::push(int port, Packet *p)
+{
+    if ((p = handle(port, p)))
+        output(2 * port).push(p);
+}
+
+#if HAVE_BATCH
+void
+PLCManager::push_batch(int port, PacketBatch *batch)
+{
+    plc_push_batch(output(2 * port), batch, [this, port](Packet *p) { return handle(port, p); });
+}
+#endif
+
+int
+PLCManager::read_stats(const String &arg, String &result, ErrorHandler *errh) const
+{
+    int only = -1;
+    if (Args(this, errh).push_back_words(arg)
+                        .read_p("DEVICE", only)
+                        .complete() < 0)
+        return -1;
+    if (only >= _devices.size())
+        return errh->error("no device %d", only);
+
+    StringAccum sa;
+    for (int i = 0; i < _devices.size(); i++) {
+        if (only >= 0 && i != only)
+            continue;
+        const Device *d = _devices[i];
+        PhyRatesSnapshot phy;
+        TonemapSnapshot tonemap;
+        ErrorStatsSnapshot errors;
+        if (!d->phy.read(phy) || !d->tonemap.read(tonemap) || !d->errors.read(errors))
+            return errh->error("device %d busy", i);
+        phy.requests = __atomic_load_n(&d->phy_requests, __ATOMIC_RELAXED);
+        tonemap.requests = __atomic_load_n(&d->tonemap_requests, __ATOMIC_RELAXED);
+        errors.requests = __atomic_load_n(&d->error_requests, __ATOMIC_RELAXED);
+        sa << "device " << i << " src " << d->src.unparse() << "\n"
+           << "phyrates:\n";
+        plc_unparse_phy_rates(sa, phy);
+        if (d->has_dst) {
+            sa << "dst " << d->dst.unparse() << "\n"
+               << "tonemap:\n";
+            plc_unparse_tonemap(sa, tonemap);
+            sa << "errorstats:\n";
+            plc_unparse_error_stats(sa, errors);
+        }
+    }
+    result = sa.take_string();
+    return 0;
+}
+
+String
+PLCManager::read_devices() const
+{
+    StringAccum sa;
+    for (int i = 0; i < _devices.size(); i++) {
+        const Device *d = _devices[i];
+        sa << i << " src " << d->src.unparse() << " chipset " << d->chip->name;
+        if (d->has_dst)
+            sa << " dst " << d->dst.unparse() << " priority " << d->prio << " direction " << d->dir;
+        sa << " thread " << d->timer.home_thread_id() << "\n";
+    }
+    return sa.take_string();
+}
+
+static int
+stats_handler(int, String &data, Element *e, const Handler *, ErrorHandler *errh)
+{
+    return ((PLCManager *) e)->read_stats(data, data, errh);
+}
+
+static String
+devices_handler(Element *e, void *)
+{
+    return ((PLCManager *) e)->read_devices();
+}
+
+void
+PLCManager::add_handlers()
+{
+    set_handler("stats", Handler::f_read | Handler::f_read_param, stats_handler);
+    add_read_handler("devices", devices_handler);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(PLCManager)
+ELEMENT_REQUIRES(userlevel)
+ELEMENT_MT_SAFE(PLCManager)
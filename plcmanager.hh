@@ -0,0 +1,139 @@
+#ifndef CLICK_PLCMANAGER_HH
+#define CLICK_PLCMANAGER_HH
+#include <click/element.hh>
+#include <click/etheraddress.hh>
+#include <click/timer.hh>
+#include "PLCStats.h"
+#include "PLCView.h"
+#include "PLCChipset.h"
+#include "PLCSnapshot.h"
+#include "PLCBatch.h"
+#include "PLCPoll.h"
+CLICK_DECLS
+
+/*
+=c
+
+PLCManager(DEVICE SPEC, ... [, I<keywords> INTERVAL])
+
+=s PLC
+
+Polls the statistics of several PLC devices
+
+=d
+
+Does the work of PhyRatesReq, TonemapReq and ErrorStatsReq for several PLC
+interfaces at once. Every DEVICE keyword describes one device, in port
+order: input N receives the packets of device N, output 2N forwards those
+that are not replies to the requests, and output 2N+1 emits the requests for
+device N. SPEC is a list of keywords:
+
+=over 8
+
+=item SRC
+
+Ethernet address of the interface. Mandatory.
+
+=item DST
+
+Ethernet address of a peer. If given, its tonemaps and error statistics are
+polled as well as the PHY rates of all stations.
+
+=item PRIORITY, DIRECTION
+
+As for ErrorStatsReq. Default 1 and 1.
+
+=item CHIPSET
+
+As for TonemapReq.
+
+=item THREAD
+
+Click thread that polls the device. It should be the thread that runs the
+FromDevice of the interface (see StaticThreadSched), so that each device is
+handled by one thread only. Default: the thread of the element.
+
+=back
+
+Every device has its own timer and state; the state of a device is written
+only by the thread receiving its replies and read by the handlers through
+sequence locks, so devices never wait for each other. The requests sent by
+the timer are counted apart, so the timer may run on another thread. INTERVAL is the polling period in ms
+(default 1000).
+
+=h stats read-only with parameter
+
+"[N]": the state of device N, or of all devices.
+
+=h devices read-only
+
+The configured devices.
+
+=a PhyRatesReq, TonemapReq, ErrorStatsReq
+*/
+
+class PLCManager : public Element { public:
+
+    PLCManager();
+    ~PLCManager();
+
+    const char *class_name() const      { return "PLCManager"; }
+    const char *port_count() const      { return "1-/2-"; }
+    const char *processing() const      { return PUSH; }
+    void *cast(const char *name);
+    int configure(Vector<String> &, ErrorHandler *);
+    int initialize(ErrorHandler *errh);
+    void cleanup(CleanupStage);
+    void push(int port, Packet *p);
+#if HAVE_BATCH
+    void push_batch(int port, PacketBatch *batch);
+#endif
+    void add_handlers();
+
+    int read_stats(const String &arg, String &result, ErrorHandler *errh) const;
+    String read_devices() const;
+
+private:
+    // State of one device. The snapshots are written only by the thread
+    // receiving the replies, the request counters only by the timer. Each
+    // device is allocated separately and aligned so that devices do not
+    // share cache lines.
+    struct Device {
+        PLCManager *owner;
+        int port;
+        EtherAddress src;
+        EtherAddress dst;
+        bool has_dst;
+        int prio;
+        int dir;
+        int thread;
+        const PLCChipset *chip;
+        double (*tonemap_rate)(const PLCToneMapRepView &);
+        Timer timer;
+        PLCSnapshot<PhyRatesSnapshot> phy;
+        PLCSnapshot<TonemapSnapshot> tonemap;
+        PLCSnapshot<ErrorStatsSnapshot> errors;
+        uint32_t phy_requests;
+        uint32_t tonemap_requests;
+        uint32_t error_requests;
+
+        Device(PLCManager *m, int p)
+            : owner(m), port(p), has_dst(false), prio(1), dir(1), thread(-1),
+              chip(&PLCChipsetInfo<PLCDefaultChipset>::info),
+              tonemap_rate(&plc_tonemap_rate<PLCDefaultChipset>), timer(timer_hook, this),
+              phy_requests(0), tonemap_requests(0), error_requests(0) {
+        }
+    } __attribute__((aligned(64)));
+
+    Vector<Device *> _devices;
+    uint32_t _interval_ms;
+
+    int parse_device(Device *d, const String &spec, ErrorHandler *errh);
+    Packet *handle(int port, Packet *p);
+    void poll(Device *d);
+    void send(Device *d, WritablePacket *q);
+    static void timer_hook(Timer *, void *);
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,412 @@
+/*
+ * plcpcapng.{cc,hh} -- Writes the raw HomePlug AV management frames to a pcapng file
+ *
+ * The packet thread only copies the frames into preallocated chunks; a
+ * writer thread writes the full chunks with writev, so the file system never
+ * delays the router. Frames are dropped when all chunks wait for the writer.
+ */
+
+#include <click/config.h>
+#include "plcpcapng.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/glue.hh>
+#include <click/straccum.hh>
+#include <click/packet_anno.hh>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+CLICK_DECLS
+
+// pcapng block types and options
+#define PCAPNG_SHB              0x0A0D0D0A
+#define PCAPNG_IDB              0x00000001
+#define PCAPNG_EPB              0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_LINKTYPE_ETHERNET 1
+#define PCAPNG_OPT_ENDOFOPT     0
+#define PCAPNG_OPT_IF_NAME      2
+#define PCAPNG_OPT_IF_TSRESOL   9
+#define PCAPNG_EPB_OVERHEAD     32  // Block header, fields and trailing length
+
+#define PCAPNG_MAX_IOV          64  // Chunks per writev
+#define PCAPNG_PAGE             4096
+
+static inline uint32_t pcapng_pad(uint32_t len) {
+    return (len + 3) & ~3U;
+}
+
+static inline uint8_t *pcapng_put32(uint8_t *b, uint32_t v) {
+    memcpy(b, &v, 4);
+    return b + 4;
+}
+
+static inline uint8_t *pcapng_put16(uint8_t *b, uint16_t v) {
+    memcpy(b, &v, 2);
+    return b + 2;
+}
+
+static inline uint8_t *pcapng_put_option(uint8_t *b, uint16_t code, const void *data, uint16_t len) {
+    pcapng_put16(b, code);
+    pcapng_put16(b + 2, len);
+    memcpy(b + 4, data, len);
+    memset(b + 4 + len, 0, pcapng_pad(len) - len);
+    return b + 4 + pcapng_pad(len);
+}
+
+// Writes all of iov, continuing after partial writes
+static int
+pcapng_writev(int fd, struct iovec *iov, int n)
+{
+    while (n > 0) {
+        ssize_t w = writev(fd, iov, n);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        while (n > 0 && (size_t) w >= iov->iov_len) {
+            w -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (uint8_t *) iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+    return 0;
+}
+
+PLCPcapng::PLCPcapng()
+    : _all(true), _snaplen(0), _chunk_size(1 << 20), _nchunks(16), _flush_ms(1000), _fd(-1),
+      _chunks(0), _filled(0), _written(0), _flush_timer(this),
+      _running(false), _stop(false),
+      _packets(0), _dropped(0), _bytes(0), _writes(0), _write_errors(0)
+{
+    memset(_mmtypes, 0, sizeof(_mmtypes));
+    pthread_mutex_init(&_lock, 0);
+    pthread_cond_init(&_cond, 0);
+}
+
+PLCPcapng::~PLCPcapng()
+{
+    pthread_cond_destroy(&_cond);
+    pthread_mutex_destroy(&_lock);
+}
+
+void *
+PLCPcapng::cast(const char *name)
+{
+    if (strcmp(name, "PLCPcapng") == 0)
+        return this;
+    else
+        return Element::cast(name);
+}
+
+int
+PLCPcapng::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    Vector<uint32_t> mmtypes;
+    bool vendor = false;
+    _ifname = name();
+    if (Args(conf, this, errh).read_mp("FILENAME", FilenameArg(), _filename)
+                              .read_all("MMTYPE", mmtypes)
+                              .read("VENDOR", vendor)
+                              .read("SNAPLEN", _snaplen)
+                              .read("IFNAME", _ifname)
+                              .read("CHUNK", _chunk_size)
+                              .read("CHUNKS", _nchunks)
+                              .read("FLUSH", _flush_ms)
+                              .complete() < 0)
+        return -1;
+    if (_chunk_size < 65536 || _chunk_size > (1U << 30))
+        return errh->error("CHUNK must be between 65536 and 2^30 bytes");
+    if (_nchunks < 2)
+        return errh->error("CHUNKS must be at least 2");
+    if (_ifname.length() > 255)
+        return errh->error("IFNAME too long");
+
+    _all = !mmtypes.size() && !vendor;
+    for (int i = 0; i < mmtypes.size(); i++) {
+        if (mmtypes[i] > 0xFFFF)
+            return errh->error("bad MMTYPE %#x", mmtypes[i]);
+        _mmtypes[mmtypes[i] >> 3] |= 1 << (mmtypes[i] & 7);
+    }
+    // Vendor-specific MMTypes 0xA000-0xBFFF; their high byte is the low
+    // byte in the order of PLCStats.h
+    if (vendor)
+        for (uint32_t t = 0; t < 0x10000; t++)
+            if ((t & 0xE0) == 0xA0)
+                _mmtypes[t >> 3] |= 1 << (t & 7);
+    return 0;
+}
+
+int
+PLCPcapng::write_header(ErrorHandler *errh)
+{
+    uint8_t buf[512];
+    uint8_t *b = buf;
+
+    // Section header block, section length unknown
+    b = pcapng_put32(b, PCAPNG_SHB);
+    b = pcapng_put32(b, 28);
+    b = pcapng_put32(b, PCAPNG_BYTE_ORDER_MAGIC);
+    b = pcapng_put16(b, 1);                 // Version 1.0
+    b = pcapng_put16(b, 0);
+    b = pcapng_put32(b, 0xFFFFFFFF);
+    b = pcapng_put32(b, 0xFFFFFFFF);
+    b = pcapng_put32(b, 28);
+
+    // Interface description block
+    uint8_t *idb = b;
+    uint8_t tsresol = 9;                    // Nanoseconds
+    b = pcapng_put32(b, PCAPNG_IDB);
+    b = pcapng_put32(b, 0);                 // Length, set below
+    b = pcapng_put16(b, PCAPNG_LINKTYPE_ETHERNET);
+    b = pcapng_put16(b, 0);
+    b = pcapng_put32(b, _snaplen);
+    b = pcapng_put_option(b, PCAPNG_OPT_IF_NAME, _ifname.data(), _ifname.length());
+    b = pcapng_put_option(b, PCAPNG_OPT_IF_TSRESOL, &tsresol, 1);
+    b = pcapng_put_option(b, PCAPNG_OPT_ENDOFOPT, 0, 0);
+    uint32_t idb_len = b + 4 - idb;
+    pcapng_put32(idb + 4, idb_len);
+    b = pcapng_put32(b, idb_len);
+
+    struct iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len = b - buf;
+    if (pcapng_writev(_fd, &iov, 1) < 0)
+        return errh->error("%s: %s", _filename.c_str(), strerror(errno));
+    return 0;
+}
+
+int
+PLCPcapng::initialize(ErrorHandler *errh)
+{
+    _fd = open(_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (_fd < 0)
+        return errh->error("%s: %s", _filename.c_str(), strerror(errno));
+    if (write_header(errh) < 0)
+        return -1;
+
+    if (!(_chunks = new Chunk[_nchunks]()))
+        return errh->error("out of memory");
+    for (uint32_t i = 0; i < _nchunks; i++)
+        if (posix_memalign((void **) &_chunks[i].data, PCAPNG_PAGE, _chunk_size) != 0) {
+            _chunks[i].data = 0;
+            return errh->error("out of memory");
+        }
+
+    if (pthread_create(&_thread, 0, writer_thread, this) != 0)
+        return errh->error("cannot start the writer thread");
+    _running = true;
+    _flush_timer.initialize(this);
+    _flush_timer.schedule_after_msec(_flush_ms);
+    return 0;
+}
+
+void
+PLCPcapng::cleanup(CleanupStage)
+{
+    if (_running) {
+        hand_off();
+        pthread_mutex_lock(&_lock);
+        _stop = true;
+        pthread_cond_signal(&_cond);
+        pthread_mutex_unlock(&_lock);
+        pthread_join(_thread, 0);
+        _running = false;
+    }
+    if (_chunks) {
+        for (uint32_t i = 0; i < _nchunks; i++)
+            free(_chunks[i].data);
+        delete[] _chunks;
+        _chunks = 0;
+    }
+    if (_fd >= 0) {
+        close(_fd);
+        _fd = -1;
+    }
+}
+
+bool
+PLCPcapng::capture(const PLCMMEView &mme) const
+{
+    if (!mme.is_hpav())
+        return false;
+    uint16_t t = mme.mmtype();
+    return _all || (_mmtypes[t >> 3] & (1 << (t & 7)));
+}
+
+// Hands the current chunk to the writer if it holds anything
+void
+PLCPcapng::hand_off()
+{
+    if (_filled - __atomic_load_n(&_written, __ATOMIC_ACQUIRE) >= _nchunks
+        || _chunks[_filled % _nchunks].length == 0)
+        return;
+    __atomic_store_n(&_filled, _filled + 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&_lock);
+    pthread_cond_signal(&_cond);
+    pthread_mutex_unlock(&_lock);
+}
+
+void
+PLCPcapng::append(const Packet *p)
+{
+    uint32_t caplen = p->length();
+    if (_snaplen && caplen > _snaplen)
+        caplen = _snaplen;
+    uint32_t size = PCAPNG_EPB_OVERHEAD + pcapng_pad(caplen);
+    if (size > _chunk_size) {
+        __atomic_store_n(&_dropped, _dropped + 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // The current chunk is free unless the writer still holds all of them
+    if (_filled - __atomic_load_n(&_written, __ATOMIC_ACQUIRE) >= _nchunks) {
+        __atomic_store_n(&_dropped, _dropped + 1, __ATOMIC_RELAXED);
+        return;
+    }
+    Chunk *c = &_chunks[_filled % _nchunks];
+    if (c->length + size > _chunk_size) {
+        hand_off();
+        if (_filled - __atomic_load_n(&_written, __ATOMIC_ACQUIRE) >= _nchunks) {
+            __atomic_store_n(&_dropped, _dropped + 1, __ATOMIC_RELAXED);
+            return;
+        }
+        c = &_chunks[_filled % _nchunks];
+    }
+
+    Timestamp ts = p->timestamp_anno();
+    if (!ts)
+        ts = Timestamp::now();
+    uint64_t ns = ts.nsecval();
+
+    uint8_t *b = c->data + c->length;
+    b = pcapng_put32(b, PCAPNG_EPB);
+    b = pcapng_put32(b, size);
+    b = pcapng_put32(b, 0);                 // Interface
+    b = pcapng_put32(b, ns >> 32);
+    b = pcapng_put32(b, (uint32_t) ns);
+    b = pcapng_put32(b, caplen);
+    b = pcapng_put32(b, p->length());
+    memcpy(b, p->data(), caplen);
+    memset(b + caplen, 0, pcapng_pad(caplen) - caplen);
+    b += pcapng_pad(caplen);
+    pcapng_put32(b, size);
+    c->length += size;
+    __atomic_store_n(&_packets, _packets + 1, __ATOMIC_RELAXED);
+}
+
+void
+PLCPcapng::push(int, Packet *p)
+{
+    if (capture(PLCMMEView(p)))
+        append(p);
+    if (noutputs())
+        output(0).push(p);
+    else
+        p->kill();
+}
+
+#if HAVE_BATCH
+void
+PLCPcapng::push_batch(int, PacketBatch *batch)
+{
+    FOR_EACH_PACKET(batch, p)
+        if (capture(PLCMMEView(p)))
+            append(p);
+    if (noutputs())
+        output(0).push_batch(batch);
+    else
+        batch->kill();
+}
+#endif
+
+void
+PLCPcapng::run_timer(Timer *)
+{
+    // Do not keep a slowly filling chunk in memory for long
+    hand_off();
+    _flush_timer.reschedule_after_msec(_flush_ms);
+}
+
+void *
+PLCPcapng::writer_thread(void *arg)
+{
+    ((PLCPcapng *) arg)->writer();
+    return 0;
+}
+
+void
+PLCPcapng::writer()
+{
+    struct iovec iov[PCAPNG_MAX_IOV];
+    pthread_mutex_lock(&_lock);
+    while (1) {
+        uint64_t filled;
+        while ((filled = __atomic_load_n(&_filled, __ATOMIC_ACQUIRE)) == _written && !_stop)
+            pthread_cond_wait(&_cond, &_lock);
+        if (filled == _written)
+            break;
+        pthread_mutex_unlock(&_lock);
+
+        // All pending chunks in one system call
+        int n = filled - _written < PCAPNG_MAX_IOV ? filled - _written : PCAPNG_MAX_IOV;
+        uint64_t bytes = 0;
+        for (int i = 0; i < n; i++) {
+            Chunk &c = _chunks[(_written + i) % _nchunks];
+            iov[i].iov_base = c.data;
+            iov[i].iov_len = c.length;
+            bytes += c.length;
+        }
+        if (pcapng_writev(_fd, iov, n) < 0)
+            __atomic_fetch_add(&_write_errors, 1, __ATOMIC_RELAXED);
+        else
+            __atomic_fetch_add(&_bytes, bytes, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&_writes, 1, __ATOMIC_RELAXED);
+        for (int i = 0; i < n; i++)
+            _chunks[(_written + i) % _nchunks].length = 0;
+        __atomic_store_n(&_written, _written + n, __ATOMIC_RELEASE);
+
+        pthread_mutex_lock(&_lock);
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+String
+PLCPcapng::read_stats() const
+{
+    uint64_t filled = __atomic_load_n(&_filled, __ATOMIC_RELAXED);
+    uint64_t written = __atomic_load_n(&_written, __ATOMIC_RELAXED);
+    StringAccum sa;
+    sa << "packets " << __atomic_load_n(&_packets, __ATOMIC_RELAXED)
+       << " dropped " << __atomic_load_n(&_dropped, __ATOMIC_RELAXED) << "\n"
+       << "bytes " << __atomic_load_n(&_bytes, __ATOMIC_RELAXED)
+       << " writes " << __atomic_load_n(&_writes, __ATOMIC_RELAXED)
+       << " chunks " << written
+       << " pending " << (filled - written)
+       << " errors " << __atomic_load_n(&_write_errors, __ATOMIC_RELAXED) << "\n";
+    return sa.take_string();
+}
+
+static String
+stats_handler(Element *e, void *)
+{
+    return ((PLCPcapng *) e)->read_stats();
+}
+
+void
+PLCPcapng::add_handlers()
+{
+    add_read_handler("stats", stats_handler);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(PLCPcapng)
+ELEMENT_REQUIRES(userlevel)
+ELEMENT_LIBS(-lpthread)
@@ -0,0 +1,130 @@
+#ifndef CLICK_PLCPCAPNG_HH
+#define CLICK_PLCPCAPNG_HH
+#include <click/element.hh>
+#include <click/timer.hh>
+#include <pthread.h>
+#include "PLCStats.h"
+#include "PLCView.h"
+#include "PLCBatch.h"
+CLICK_DECLS
+
+/*
+=c
+
+PLCPcapng(FILENAME [, I<keywords> MMTYPE, VENDOR, SNAPLEN, IFNAME, CHUNK, CHUNKS, FLUSH])
+
+=s PLC
+
+Writes HomePlug AV management frames to a pcapng file
+
+=d
+
+Copies the HP_AV frames that pass through it, raw, into the pcapng file
+FILENAME; all packets are then emitted on output 0 if it is connected, or
+killed. The file starts with a section header block and one interface
+description block (Ethernet, nanosecond time stamps, named IFNAME, default
+the name of the element); every frame is an enhanced packet block stamped
+with the timestamp annotation of the packet, or the current time if it has
+none.
+
+The blocks are built in CHUNKS (default 16) page-aligned buffers of CHUNK
+bytes (default 1048576). Full buffers, and every FLUSH ms (default 1000) the
+buffer being filled, are handed to a writer thread that writes all pending
+buffers with one writev. If the writer falls so far behind that no
+buffer is free, the frames are dropped and counted instead of delaying the
+router. The element must run on a single thread.
+
+Keyword arguments are:
+
+=over 8
+
+=item MMTYPE
+
+An MMType to capture, in the byte order of PLCStats.h (e.g. 0x31a0 for
+ERROR_STATS_REP). May be given several times. Default: all.
+
+=item VENDOR
+
+Boolean. If true, captures the vendor-specific MMTypes (0xA000-0xBFFF) in
+addition to those given by MMTYPE. Default false.
+
+=item SNAPLEN
+
+Maximum number of bytes stored per frame, 0 for the whole frame. Default 0.
+
+=back
+
+=h stats read-only
+
+Captured and dropped frames, bytes written, buffers written and write errors.
+
+=a SniffPackets
+*/
+
+class PLCPcapng : public Element { public:
+
+    PLCPcapng();
+    ~PLCPcapng();
+
+    const char *class_name() const      { return "PLCPcapng"; }
+    const char *port_count() const      { return "1/0-1"; }
+    const char *processing() const      { return PUSH; }
+    void *cast(const char *name);
+    int configure(Vector<String> &, ErrorHandler *);
+    int initialize(ErrorHandler *errh);
+    void cleanup(CleanupStage);
+    void push(int port, Packet *p);
+#if HAVE_BATCH
+    void push_batch(int port, PacketBatch *batch);
+#endif
+    void run_timer(Timer *);
+    void add_handlers();
+
+    String read_stats() const;
+
+private:
+    struct Chunk {
+        uint8_t *data;
+        uint32_t length;
+    };
+
+    String _filename;
+    String _ifname;
+    uint8_t _mmtypes[65536 / 8];    // Bitmap of the MMTypes to capture
+    bool _all;
+    uint32_t _snaplen;
+    uint32_t _chunk_size;
+    uint32_t _nchunks;
+    uint32_t _flush_ms;
+    int _fd;
+
+    Chunk *_chunks;
+    // Chunks handed to the writer (producer) and written (writer). Chunk
+    // _filled % _nchunks is being filled; it is free if fewer than _nchunks
+    // chunks are in flight.
+    uint64_t _filled;
+    uint64_t _written;
+    Timer _flush_timer;
+
+    pthread_t _thread;
+    pthread_mutex_t _lock;
+    pthread_cond_t _cond;
+    bool _running;
+    bool _stop;
+
+    uint64_t _packets;
+    uint64_t _dropped;
+    uint64_t _bytes;                // Written by the writer thread
+    uint64_t _writes;
+    uint64_t _write_errors;
+
+    bool capture(const PLCMMEView &mme) const;
+    void append(const Packet *p);
+    void hand_off();
+    int write_header(ErrorHandler *errh);
+    static void *writer_thread(void *arg);
+    void writer();
+};
+
+CLICK_ENDDECLS
+#endif
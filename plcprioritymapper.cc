@@ -0,0 +1,378 @@
+/*
+ * plcprioritymapper.{cc,hh} -- Maps traffic classes to PLC channel access priorities
+ *
+ * The IP packets towards the PLC interface are marked (VLAN priority or IP
+ * precedence) with the channel access priority of their class. The
+ * collisions and failures of every priority, polled with ERROR_STATS_REQs,
+ * move the latency-sensitive class away from a congested priority.
+ */
+
+#include <click/config.h>
+#include "plcprioritymapper.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/glue.hh>
+#include <click/straccum.hh>
+#include <clicknet/ether.h>
+#include <clicknet/ip.h>
+CLICK_DECLS
+
+#define TIMER_INTERVAL 1000 // timer interval in ms
+
+// 802.1D priority that the HomePlug AV default mapping puts on every CAP
+static const uint8_t plc_cap_priority[PLC_NUM_CAPS] = {1, 0, 5, 7};
+
+static const char * const plc_class_names[PLC_NUM_CLASSES] = {"bulk", "default", "latency"};
+
+PLCPriorityMapper::PLCPriorityMapper()
+    : _chip(&PLCChipsetInfo<PLCDefaultChipset>::info), _mode(MODE_VLAN), _vlan_id(0),
+      _latency_floor(HPAV_LID_CSMA_CAP_2), _interval_ms(TIMER_INTERVAL), _threshold_ppm(100000),
+      _hysteresis_ppm(50000), _min_mpdus(20), _timer(this), _unmarked(0)
+{
+    memset(_packets, 0, sizeof(_packets));
+    memset(_replies, 0, sizeof(_replies));
+}
+
+PLCPriorityMapper::~PLCPriorityMapper()
+{
+}
+
+void *
+PLCPriorityMapper::cast(const char *name)
+{
+    if (strcmp(name, "PLCPriorityMapper") == 0)
+        return this;
+    else
+        return Element::cast(name);
+}
+
+int
+PLCPriorityMapper::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    String chipset = PLCDefaultChipset::name;
+    String mode = "VLAN";
+    Vector<uint32_t> latency, bulk;
+    uint32_t vlan_id = 0;
+    uint32_t latency_cap = HPAV_LID_CSMA_CAP_3, latency_floor = HPAV_LID_CSMA_CAP_2;
+    uint32_t default_cap = HPAV_LID_CSMA_CAP_1, bulk_cap = HPAV_LID_CSMA_CAP_0;
+    double threshold = 10, hysteresis = 5;
+    if (Args(conf, this, errh).read_mp("DST", _dst)
+                              .read("MODE", WordArg(), mode)
+                              .read("VLAN_ID", vlan_id)
+                              .read_all("LATENCY", latency)
+                              .read_all("BULK", bulk)
+                              .read("LATENCY_CAP", latency_cap)
+                              .read("LATENCY_FLOOR", latency_floor)
+                              .read("DEFAULT_CAP", default_cap)
+                              .read("BULK_CAP", bulk_cap)
+                              .read("INTERVAL", _interval_ms)
+                              .read("THRESHOLD", threshold)
+                              .read("HYSTERESIS", hysteresis)
+                              .read("MIN_MPDUS", _min_mpdus)
+                              .read("CHIPSET", WordArg(), chipset)
+                              .complete() < 0)
+        return -1;
+
+    if (mode.equals("VLAN", 4))
+        _mode = MODE_VLAN;
+    else if (mode.equals("TOS", 3))
+        _mode = MODE_TOS;
+    else
+        return errh->error("MODE must be VLAN or TOS");
+    if (vlan_id > 4095)
+        return errh->error("VLAN_ID must be below 4096");
+    _vlan_id = vlan_id;
+    if (latency_cap > 3 || latency_floor > latency_cap || default_cap > 3 || bulk_cap > 3)
+        return errh->error("CAPs must be between 0 and 3, LATENCY_FLOOR at most LATENCY_CAP");
+    _cap[PLC_CLASS_LATENCY] = latency_cap;
+    _cap[PLC_CLASS_DEFAULT] = default_cap;
+    _cap[PLC_CLASS_BULK] = bulk_cap;
+    _latency_floor = latency_floor;
+    if (threshold < 0 || threshold > 100 || hysteresis < 0 || hysteresis > 100)
+        return errh->error("THRESHOLD and HYSTERESIS must be percentages");
+    _threshold_ppm = (uint32_t) (threshold * 10000);
+    _hysteresis_ppm = (uint32_t) (hysteresis * 10000);
+    if (_interval_ms == 0)
+        return errh->error("INTERVAL must be positive");
+    if (!(_chip = plc_find_chipset(chipset)))
+        return errh->error("unknown CHIPSET %s", chipset.c_str());
+
+    if (!latency.size()) {
+        static const uint32_t ef_cs5_cs6_cs7[] = {46, 40, 48, 56};
+        for (int i = 0; i < 4; i++)
+            latency.push_back(ef_cs5_cs6_cs7[i]);
+    }
+    if (!bulk.size())
+        bulk.push_back(8);      // CS1
+    memset(_class_of, PLC_CLASS_DEFAULT, sizeof(_class_of));
+    for (int i = 0; i < bulk.size(); i++) {
+        if (bulk[i] > 63)
+            return errh->error("bad BULK DSCP %u", bulk[i]);
+        _class_of[bulk[i]] = PLC_CLASS_BULK;
+    }
+    for (int i = 0; i < latency.size(); i++) {
+        if (latency[i] > 63)
+            return errh->error("bad LATENCY DSCP %u", latency[i]);
+        _class_of[latency[i]] = PLC_CLASS_LATENCY;
+    }
+    return 0;
+}
+
+int
+PLCPriorityMapper::initialize(ErrorHandler *)
+{
+    set_map(_stats.begin_write(), _cap[PLC_CLASS_LATENCY]);
+    _stats.end_write();
+    _timer.initialize(this);
+    _timer.schedule_after_msec(_interval_ms);
+    return 0;
+}
+
+void
+PLCPriorityMapper::run_timer(Timer *t)
+{
+    // Transmission statistics of every CAP towards DST
+    for (int cap = 0; cap < PLC_NUM_CAPS; cap++) {
+        WritablePacket *q = plc_make_error_stats_req(_chip, NULL, _dst.data(), cap, HPAV_SD_TX);
+        if (!q) {
+            click_chatter("[PLCPriorityMapper] cannot make packet!");
+            break;
+        }
+        _stats.begin_write().requests++;
+        _stats.end_write();
+        output(2).push(q);
+    }
+    t->schedule_after_msec(_interval_ms);
+}
+
+// The latency-sensitive class on latency_cap, the others off it
+void
+PLCPriorityMapper::set_map(PriorityMapSnapshot &st, int latency_cap)
+{
+    st.map[PLC_CLASS_LATENCY] = latency_cap;
+    for (int cls = PLC_CLASS_BULK; cls <= PLC_CLASS_DEFAULT; cls++) {
+        int cap = _cap[cls];
+        if (cap == latency_cap)
+            cap = latency_cap ? latency_cap - 1 : HPAV_LID_CSMA_CAP_1;
+        st.map[cls] = cap;
+    }
+    _map = st.map[PLC_CLASS_BULK] | st.map[PLC_CLASS_DEFAULT] << 8 | st.map[PLC_CLASS_LATENCY] << 16;
+}
+
+// Averages the collided and failed shares of the attempts of the last
+// window. A CAP with too few attempts says nothing about its contention; its
+// estimate decays, so that the latency-sensitive class tries it again.
+void
+PLCPriorityMapper::update_cap(PriorityMapSnapshot &st, int cap, uint64_t now_ns)
+{
+    const ErrorStatsTx &d = _replies[cap].tx_delta;
+    PriorityCapStats &c = st.caps[cap];
+    c.attempts = d.mpdu_ack + d.mpdu_coll + d.mpdu_fail;
+    if (c.attempts < _min_mpdus) {
+        c.coll_ppm -= c.coll_ppm / 16;
+        c.fail_ppm -= c.fail_ppm / 16;
+        return;
+    }
+    uint32_t coll = (uint32_t) (d.mpdu_coll * 1000000 / c.attempts);
+    uint32_t fail = (uint32_t) (d.mpdu_fail * 1000000 / c.attempts);
+    if (c.measured) {
+        c.coll_ppm = (3 * (uint64_t) c.coll_ppm + coll) / 4;
+        c.fail_ppm = (3 * (uint64_t) c.fail_ppm + fail) / 4;
+    }
+    else {
+        c.coll_ppm = coll;
+        c.fail_ppm = fail;
+        c.measured = 1;
+    }
+    c.updated_ns = now_ns;
+}
+
+void
+PLCPriorityMapper::rebalance(PriorityMapSnapshot &st)
+{
+    int cur = st.map[PLC_CLASS_LATENCY], want = _cap[PLC_CLASS_LATENCY], next = cur;
+    uint32_t congestion[PLC_NUM_CAPS];
+    for (int i = 0; i < PLC_NUM_CAPS; i++)
+        congestion[i] = st.caps[i].coll_ppm + st.caps[i].fail_ppm;
+
+    if (cur != want && congestion[want] <= _threshold_ppm)
+        next = want;
+    else if (congestion[cur] > _threshold_ppm) {
+        int best = cur;
+        for (int i = _latency_floor; i < PLC_NUM_CAPS; i++)
+            if (congestion[i] < congestion[best])
+                best = i;
+        if (congestion[best] + _hysteresis_ppm < congestion[cur])
+            next = best;
+    }
+    if (next != cur) {
+        click_chatter("[PLCPriorityMapper] Latency-sensitive traffic moves from CAP %d (%u ppm) to CAP %d (%u ppm)",
+                      cur, congestion[cur], next, congestion[next]);
+        st.remaps++;
+        set_map(st, next);
+    }
+}
+
+Packet *
+PLCPriorityMapper::mark(Packet *p)
+{
+    const click_ether *eth = (const click_ether *) p->data();
+    uint32_t offset = sizeof(click_ether);
+    bool tagged = p->length() >= sizeof(click_ether_vlan) && eth->ether_type == htons(ETHERTYPE_8021Q);
+    uint16_t type = eth->ether_type;
+    if (tagged) {
+        type = ((const click_ether_vlan *) eth)->ether_vlan_encap_proto;
+        offset = sizeof(click_ether_vlan);
+    }
+    if (p->length() < offset + sizeof(click_ip) || type != htons(ETHERTYPE_IP)) {
+        _unmarked++;
+        return p;
+    }
+
+    int cls = _class_of[((const click_ip *) (p->data() + offset))->ip_tos >> 2];
+    int cap = (_map.value() >> (8 * cls)) & 0xFF;
+    uint8_t priority = plc_cap_priority[cap];
+    _packets[cls]++;
+
+    WritablePacket *q;
+    if (_mode == MODE_TOS) {
+        if (!(q = p->uniqueify()))
+            return 0;
+        click_ip *ip = (click_ip *) (q->data() + offset);
+        uint16_t old_hw = ((uint16_t *) ip)[0];
+        ip->ip_tos = (priority << 5) | (ip->ip_tos & 0x1F);
+        click_update_in_cksum(&ip->ip_sum, old_hw, ((uint16_t *) ip)[0]);
+    }
+    else if (tagged) {
+        if (!(q = p->uniqueify()))
+            return 0;
+        click_ether_vlan *vlan = (click_ether_vlan *) q->data();
+        vlan->ether_vlan_tci = htons((ntohs(vlan->ether_vlan_tci) & 0x1FFF) | priority << 13);
+    }
+    else {
+        // Priority tag between the addresses and the Ethernet type
+        if (!(q = p->push(4)))
+            return 0;
+        memmove(q->data(), q->data() + 4, 12);
+        click_ether_vlan *vlan = (click_ether_vlan *) q->data();
+        vlan->ether_vlan_proto = htons(ETHERTYPE_8021Q);
+        vlan->ether_vlan_tci = htons(priority << 13 | _vlan_id);
+    }
+    return q;
+}
+
+Packet *
+PLCPriorityMapper::handle(Packet *p)
+{
+    PLCMMEView mme(p);
+    if (!mme.is_hpav() || mme.mmtype() != ERROR_STATS_REP)
+        return p;
+    PLCErrorStatsRepView error_rep(mme);
+    if (!error_rep.valid()) {
+        click_chatter("[PLCPriorityMapper] Truncated error statistics reply of %u bytes", error_rep.length());
+        _stats.begin_write().malformed++;
+        _stats.end_write();
+        p->kill();
+        return 0;
+    }
+    // Only the transmission statistics of the CAPs are ours
+    int cap = error_rep.link_id();
+    if (error_rep.direction() != HPAV_SD_TX || cap >= PLC_NUM_CAPS)
+        return p;
+
+    PriorityMapSnapshot &st = _stats.begin_write();
+    ErrorStatsSnapshot &reply = _replies[cap];
+    uint64_t now_ns = Timestamp::now().nsecval();
+    st.replies++;
+    st.caps[cap].polls++;
+    if (plc_update_error_stats(reply, error_rep, now_ns) && reply.has_tx) {
+        update_cap(st, cap, now_ns);
+        rebalance(st);
+    }
+    else if (reply.mstatus != HPAV_SUC)
+        st.failures++;
+    _stats.end_write();
+    p->kill();
+    return 0;
+}
+
+void
+PLCPriorityMapper::push(int port, Packet *p)
+{
+    if (port == 0) {
+        if ((p = mark(p)))
+            output(0).push(p);
+    }
+    else if ((p = handle(p)))
+        output(1).push(p);
+}
+
+#if HAVE_BATCH
+void
+PLCPriorityMapper::push_batch(int port, PacketBatch *batch)
+{
+    if (port == 0)
+        plc_push_batch(output(0), batch, [this](Packet *p) { return mark(p); });
+    else
+        plc_push_batch(output(1), batch, [this](Packet *p) { return handle(p); });
+}
+#endif
+
+String
+PLCPriorityMapper::read_stats() const
+{
+    PriorityMapSnapshot st;
+    if (!_stats.read(st))
+        return String("busy\n");
+
+    StringAccum sa;
+    sa << "dst " << _dst.unparse() << "\n"
+       << "requests " << st.requests << "\n"
+       << "replies " << st.replies << "\n"
+       << "malformed " << st.malformed << "\n"
+       << "failures " << st.failures << "\n"
+       << "remaps " << st.remaps << "\n";
+    for (int i = 0; i < PLC_NUM_CAPS; i++) {
+        const PriorityCapStats &c = st.caps[i];
+        sa << "cap " << i << " polls " << c.polls << " attempts " << c.attempts
+           << " coll " << (c.coll_ppm / 10000.) << "% fail " << (c.fail_ppm / 10000.) << "%"
+           << " updated " << Timestamp::make_nsec(c.updated_ns).unparse() << "\n";
+    }
+    for (int i = 0; i < PLC_NUM_CLASSES; i++)
+        sa << "class " << plc_class_names[i] << " cap " << (int) st.map[i] << " packets " << _packets[i] << "\n";
+    sa << "unmarked " << _unmarked << "\n";
+    return sa.take_string();
+}
+
+String
+PLCPriorityMapper::read_map() const
+{
+    uint32_t map = _map.value();
+    StringAccum sa;
+    for (int i = 0; i < PLC_NUM_CLASSES; i++)
+        sa << plc_class_names[i] << " " << ((map >> (8 * i)) & 0xFF) << "\n";
+    return sa.take_string();
+}
+
+static String
+stats_handler(Element *e, void *)
+{
+    return ((PLCPriorityMapper *) e)->read_stats();
+}
+
+static String
+map_handler(Element *e, void *)
+{
+    return ((PLCPriorityMapper *) e)->read_map();
+}
+
+void
+PLCPriorityMapper::add_handlers()
+{
+    add_read_handler("stats", stats_handler);
+    add_read_handler("map", map_handler);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(PLCPriorityMapper)
+ELEMENT_REQUIRES(userlevel)
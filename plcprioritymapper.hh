@@ -0,0 +1,150 @@
+#ifndef CLICK_PLCPRIORITYMAPPER_HH
+#define CLICK_PLCPRIORITYMAPPER_HH
+#include <click/element.hh>
+#include <click/etheraddress.hh>
+#include <click/atomic.hh>
+#include <click/timer.hh>
+#include "PLCStats.h"
+#include "PLCView.h"
+#include "PLCChipset.h"
+#include "PLCSnapshot.h"
+#include "PLCBatch.h"
+#include "PLCPoll.h"
+CLICK_DECLS
+
+/*
+=c
+
+PLCPriorityMapper(DST, I<keywords> MODE, VLAN_ID, LATENCY, BULK, LATENCY_CAP, LATENCY_FLOOR, DEFAULT_CAP, BULK_CAP, INTERVAL, THRESHOLD, HYSTERESIS, MIN_MPDUS, CHIPSET)
+
+=s PLC
+
+Maps traffic classes to PLC channel access priorities from their measured collisions
+
+=d
+
+Marks the IP packets sent to the PLC interface so that the modem transmits
+them with the CSMA channel access priority (CAP 0 to 3) of their traffic
+class. The class is given by the DSCP: the DSCPs of LATENCY (repeatable,
+default 46, 40, 48 and 56) are latency-sensitive, those of BULK (repeatable,
+default 8) are bulk, all others are best effort. MODE VLAN (default) sets the
+priority of the 802.1Q tag, adding a priority tag with VLAN_ID (default 0) to
+untagged frames; MODE TOS rewrites the IP precedence, i.e. the upper three
+bits of the DSCP. Either way the priority is the one that the HomePlug AV
+default mapping puts on the CAP: 1 for CAP 0, 0 for CAP 1, 5 for CAP 2 and 7
+for CAP 3. Non-IP frames are not changed.
+
+Every INTERVAL ms (default 1000) the element sends to DST an ERROR_STATS_REQ
+for the transmission statistics of each of the four CAPs. From the increase
+of the MPDU counters between two replies it keeps, per CAP, the share of the
+transmission attempts that collided or failed (an average with a gain of
+1/4), as long as there were at least MIN_MPDUS (default 20) attempts. With
+fewer attempts the share decays by 1/16 per reply, so that traffic is tried
+again on a CAP that it left.
+
+Latency-sensitive traffic starts on LATENCY_CAP (default 3). When the
+collision and failure share of its CAP exceeds THRESHOLD percent (default 10),
+it moves to the least congested CAP between LATENCY_FLOOR (default 2) and 3
+whose share is lower by at least HYSTERESIS points (default 5); it returns to
+LATENCY_CAP once that CAP is below THRESHOLD again. Best effort and bulk
+traffic use DEFAULT_CAP (default 1) and BULK_CAP (default 0), except that they
+never share the CAP of the latency-sensitive traffic: they then use the
+highest CAP below it.
+
+Input 0 takes the Ethernet frames towards the interface; they leave marked on
+output 0. Input 1 takes the packets of the interface: the error statistics
+replies for the transmission on the four CAPs are consumed, everything else
+leaves on output 1. Output 2 emits the requests. An ErrorStatsReq polling the
+transmission of the CAPs of DST should not be on the same path.
+
+=h stats read-only
+
+Requests, replies, the measures of every CAP and the packets marked per class.
+
+=h map read-only
+
+The CAP of every class.
+
+=a ErrorStatsReq
+*/
+
+#define PLC_NUM_CAPS            4
+
+enum { PLC_CLASS_BULK, PLC_CLASS_DEFAULT, PLC_CLASS_LATENCY, PLC_NUM_CLASSES };
+
+// Measured on one CAP
+struct PriorityCapStats {
+    uint64_t updated_ns;        // Last reply with enough attempts
+    uint64_t attempts;          // MPDUs of the last window
+    uint32_t polls;
+    uint32_t coll_ppm;          // Averaged shares of the attempts
+    uint32_t fail_ppm;
+    uint32_t measured;
+};
+
+// Published by PLCPriorityMapper after every request and reply
+struct PriorityMapSnapshot {
+    uint32_t requests;
+    uint32_t replies;
+    uint32_t malformed;
+    uint32_t failures;          // Replies with an error status
+    uint32_t remaps;            // Moves of the latency-sensitive class
+    uint8_t map[PLC_NUM_CLASSES];
+    uint8_t reserved;
+    PriorityCapStats caps[PLC_NUM_CAPS];
+};
+
+class PLCPriorityMapper : public Element { public:
+
+    PLCPriorityMapper();
+    ~PLCPriorityMapper();
+
+    const char *class_name() const      { return "PLCPriorityMapper"; }
+    const char *port_count() const      { return "2/3"; }
+    const char *processing() const      { return PUSH; }
+    const char *flow_code() const       { return "xy/xyz"; }
+    void *cast(const char *name);
+    int configure(Vector<String> &, ErrorHandler *);
+    int initialize(ErrorHandler *errh);
+    void push(int port, Packet *p);
+#if HAVE_BATCH
+    void push_batch(int port, PacketBatch *batch);
+#endif
+    void run_timer(Timer *);
+    void add_handlers();
+
+    String read_stats() const;
+    String read_map() const;
+
+private:
+    enum { MODE_VLAN, MODE_TOS };
+
+    EtherAddress _dst;
+    const PLCChipset *_chip;
+    int _mode;
+    uint16_t _vlan_id;
+    uint8_t _class_of[64];          // By DSCP
+    uint8_t _cap[PLC_NUM_CLASSES];  // Configured
+    uint8_t _latency_floor;
+    uint32_t _interval_ms;
+    uint32_t _threshold_ppm;
+    uint32_t _hysteresis_ppm;
+    uint32_t _min_mpdus;
+    Timer _timer;
+
+    atomic_uint32_t _map;           // CAP of class i in byte i, read by the data path
+    uint64_t _packets[PLC_NUM_CLASSES];
+    uint64_t _unmarked;
+
+    ErrorStatsSnapshot _replies[PLC_NUM_CAPS];  // Last reply per CAP, for the deltas
+    PLCSnapshot<PriorityMapSnapshot> _stats;
+
+    Packet *mark(Packet *p);
+    Packet *handle(Packet *p);
+    void update_cap(PriorityMapSnapshot &st, int cap, uint64_t now_ns);
+    void rebalance(PriorityMapSnapshot &st);
+    void set_map(PriorityMapSnapshot &st, int latency_cap);
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,347 @@
+/*
+ * plcprober.{cc,hh} -- Active goodput measurement of a PLC link
+ *
+ * Paced trains of probes are reflected by the PLCProber of the peer; the
+ * reflected probes give the goodput, loss, round-trip time and delay
+ * variation of the train, which are put next to the statistics that
+ * ErrorStatsReq and PhyRatesReq received during the same window.
+ */
+
+#include <click/config.h>
+#include "plcprober.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/glue.hh>
+#include <click/straccum.hh>
+#include <clicknet/ether.h>
+CLICK_DECLS
+
+static inline void plc_put_le32(uint8_t *b, uint32_t v) {
+    b[0] = v;
+    b[1] = v >> 8;
+    b[2] = v >> 16;
+    b[3] = v >> 24;
+}
+
+static inline void plc_put_le64(uint8_t *b, uint64_t v) {
+    plc_put_le32(b, (uint32_t) v);
+    plc_put_le32(b + 4, (uint32_t) (v >> 32));
+}
+
+PLCProber::PLCProber()
+    : _rate_kbps(10000), _size(1400), _burst(8), _duration_ms(5000), _period_ms(30000),
+      _grace_ms(500), _errorstats(0), _phyrates(0),
+      _task(this), _pace_timer(&_task), _window_timer(this), _state(IDLE), _train(0),
+      _start_ns(0), _interval_ns(0), _last_transit_ns(0), _has_errors_start(false),
+      _rx_train(0), _rx_count(0)
+{
+    memset(&_w, 0, sizeof(_w));
+}
+
+PLCProber::~PLCProber()
+{
+}
+
+void *
+PLCProber::cast(const char *name)
+{
+    if (strcmp(name, "PLCProber") == 0)
+        return this;
+    else
+        return Element::cast(name);
+}
+
+int
+PLCProber::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    bool has_dst = false;
+    if (Args(conf, this, errh).read_mp("SRC", _src)
+                              .read_p("DST", _dst).read_status(has_dst)
+                              .read("RATE", _rate_kbps)
+                              .read("SIZE", _size)
+                              .read("BURST", _burst)
+                              .read("DURATION", _duration_ms)
+                              .read("PERIOD", _period_ms)
+                              .read("GRACE", _grace_ms)
+                              .read("ERRORSTATS", ElementCastArg("ErrorStatsReq"), _errorstats)
+                              .read("PHYRATES", ElementCastArg("PhyRatesReq"), _phyrates)
+                              .complete() < 0)
+        return -1;
+    if (_rate_kbps && !has_dst)
+        return errh->error("DST is required unless RATE is 0");
+    if (_size < sizeof(click_ether) + sizeof(click_plc_probe) || _size > 9000)
+        return errh->error("SIZE must be between %u and 9000", (unsigned) (sizeof(click_ether) + sizeof(click_plc_probe)));
+    if (_burst == 0)
+        return errh->error("BURST must be positive");
+    if (_rate_kbps && (_duration_ms == 0 || _period_ms < _duration_ms + _grace_ms))
+        return errh->error("PERIOD must be at least DURATION + GRACE");
+    if (_rate_kbps) {
+        _interval_ns = (uint64_t) _size * 8 * 1000000 / _rate_kbps;
+        // The probes are paced at nanosecond resolution
+        if (_interval_ns == 0)
+            return errh->error("RATE too high for SIZE: at most %llu kbps",
+                               (unsigned long long) _size * 8 * 1000000);
+    }
+    return 0;
+}
+
+int
+PLCProber::initialize(ErrorHandler *)
+{
+    _task.initialize(this, false);
+    _pace_timer.initialize(this);
+    _window_timer.initialize(this);
+    if (_rate_kbps)
+        _window_timer.schedule_after_msec(_period_ms);
+    return 0;
+}
+
+void
+PLCProber::send_probe()
+{
+    WritablePacket *q = Packet::make(Packet::default_headroom, 0, _size, 0);
+    if (!q) {
+        click_chatter("[PLCProber] cannot make packet!");
+        return;
+    }
+    memset(q->data(), 0, _size);
+    click_ether *eth = (click_ether *) q->data();
+    memcpy(eth->ether_dhost, _dst.data(), 6);
+    memcpy(eth->ether_shost, _src.data(), 6);
+    eth->ether_type = htons(PLC_PROBE_ETHERTYPE);
+    click_plc_probe *probe = (click_plc_probe *) (eth + 1);
+    plc_put_le32(probe->magic, PLC_PROBE_MAGIC);
+    probe->type = PLC_PROBE;
+    plc_put_le32(probe->train, _train);
+    plc_put_le32(probe->seq, _w.sent);
+    plc_put_le64(probe->tx_ns, plc_now_ns());
+    _w.sent++;
+    output(1).push(q);
+}
+
+bool
+PLCProber::run_task(Task *)
+{
+    if (_state != SENDING)
+        return false;
+    uint64_t now = plc_now_ns();
+    uint64_t end = _start_ns + (uint64_t) _duration_ms * 1000000;
+    // Probes due by now; a late task catches up in bursts, so the train
+    // keeps its rate
+    uint64_t due = ((now < end ? now : end) - _start_ns) / _interval_ns + 1;
+    uint32_t n = 0;
+    for (; _w.sent < due && n < _burst; n++)
+        send_probe();
+
+    if (_w.sent < due)
+        _task.fast_reschedule();
+    else if (now >= end) {
+        _state = DRAINING;
+        _window_timer.schedule_after_msec(_grace_ms);
+    }
+    else
+        _pace_timer.schedule_at(Timestamp::make_nsec(_start_ns + _w.sent * _interval_ns));
+    return n > 0;
+}
+
+void
+PLCProber::start_window()
+{
+    _train++;
+    memset(&_w, 0, sizeof(_w));
+    _start_ns = plc_now_ns();
+    _w.start_ns = _start_ns;
+    _w.train = _train;
+    _w.rate_kbps = _rate_kbps;
+    _w.size = _size;
+    _w.peer_first_ns = ~0ULL;
+    _has_errors_start = _errorstats && _errorstats->read_snapshot(_errors_start);
+    _state = SENDING;
+    _task.reschedule();
+}
+
+void
+PLCProber::finish_window()
+{
+    // Error counters of the replies received during the window, if they
+    // are from the same link as at its start
+    ErrorStatsSnapshot errors;
+    if (_has_errors_start && _errorstats->read_snapshot(errors)
+        && errors.has_tx && _errors_start.has_tx && errors.replies > _errors_start.replies
+        && errors.tei == _errors_start.tei && errors.link_id == _errors_start.link_id) {
+        _w.has_errors = 1;
+        _w.polls = errors.replies - _errors_start.replies;
+        plc_diff_tx_stats(_w.tx, errors.tx, _errors_start.tx);
+    }
+
+    // PHY rates towards DST, if polled during the window
+    PhyRatesSnapshot phy;
+    if (_phyrates && _phyrates->read_snapshot(phy) && phy.last_reply_ns >= _start_ns)
+        for (uint32_t i = 0; i < phy.num_stas; i++)
+            if (memcmp(phy.peers[i].mac, _dst.data(), 6) == 0) {
+                _w.has_phy = 1;
+                _w.phy_tx = phy.peers[i].tx;
+                _w.phy_rx = phy.peers[i].rx;
+            }
+
+    ProberSnapshot &st = _stats.begin_write();
+    st.w[st.windows % PLC_PROBER_WINDOWS] = _w;
+    st.windows++;
+    _stats.end_write();
+}
+
+void
+PLCProber::run_timer(Timer *t)
+{
+    if (_state == IDLE) {
+        start_window();
+        t->schedule_at(Timestamp::make_nsec(_start_ns + (uint64_t) _period_ms * 1000000));
+    }
+    else if (_state == DRAINING) {
+        finish_window();
+        _state = IDLE;
+        t->schedule_at(Timestamp::make_nsec(_start_ns + (uint64_t) _period_ms * 1000000));
+    }
+}
+
+// A probe of the peer: send it back with our time and count
+void
+PLCProber::reflect(WritablePacket *q)
+{
+    click_ether *eth = (click_ether *) q->data();
+    click_plc_probe *probe = (click_plc_probe *) (eth + 1);
+    uint32_t train = plc_le32(probe->train);
+    if (train != _rx_train) {
+        _rx_train = train;
+        _rx_count = 0;
+    }
+    memcpy(eth->ether_dhost, eth->ether_shost, 6);
+    memcpy(eth->ether_shost, _src.data(), 6);
+    probe->type = PLC_PROBE_REPLY;
+    plc_put_le64(probe->rx_ns, plc_now_ns());
+    plc_put_le32(probe->rx_count, ++_rx_count);
+    _stats.begin_write().reflected++;
+    _stats.end_write();
+    output(1).push(q);
+}
+
+// A reflected probe of ours
+void
+PLCProber::reply(const click_plc_probe *probe)
+{
+    if (_state == IDLE || plc_le32(probe->train) != _train) {
+        _stats.begin_write().stray++;
+        _stats.end_write();
+        return;
+    }
+    uint64_t now = plc_now_ns();
+    uint64_t tx_ns = plc_le64(probe->tx_ns), rx_ns = plc_le64(probe->rx_ns);
+    uint32_t rx_count = plc_le32(probe->rx_count);
+    _w.received++;
+    _w.rtt_sum_ns += now - tx_ns;
+    if (rx_count > _w.reflected)
+        _w.reflected = rx_count;
+    if (rx_ns < _w.peer_first_ns)
+        _w.peer_first_ns = rx_ns;
+    if (rx_ns > _w.peer_last_ns)
+        _w.peer_last_ns = rx_ns;
+    // The offset between the clocks cancels out in the difference
+    uint64_t transit = rx_ns - tx_ns;
+    if (_w.received > 1) {
+        int64_t d = (int64_t) (transit - _last_transit_ns);
+        _w.ipdv_sum_ns += d < 0 ? -d : d;
+        _w.ipdv_count++;
+    }
+    _last_transit_ns = transit;
+}
+
+Packet *
+PLCProber::handle(Packet *p)
+{
+    const click_ether *eth = (const click_ether *) p->data();
+    if (p->length() < sizeof(click_ether) + sizeof(click_plc_probe)
+        || eth->ether_type != htons(PLC_PROBE_ETHERTYPE)
+        || memcmp(eth->ether_dhost, _src.data(), 6) != 0)
+        return p;
+    const click_plc_probe *probe = (const click_plc_probe *) (eth + 1);
+    if (plc_le32(probe->magic) != PLC_PROBE_MAGIC)
+        return p;
+
+    if (probe->type == PLC_PROBE) {
+        if (WritablePacket *q = p->uniqueify())
+            reflect(q);
+        return 0;
+    }
+    if (probe->type == PLC_PROBE_REPLY)
+        reply(probe);
+    p->kill();
+    return 0;
+}
+
+void
+PLCProber::push(int, Packet *p)
+{
+    if ((p = handle(p)))
+        output(0).push(p);
+}
+
+#if HAVE_BATCH
+void
+PLCProber::push_batch(int, PacketBatch *batch)
+{
+    plc_push_batch(output(0), batch, [this](Packet *p) { return handle(p); });
+}
+#endif
+
+String
+PLCProber::read_results() const
+{
+    ProberSnapshot st;
+    if (!_stats.read(st))
+        return String("busy\n");
+
+    StringAccum sa;
+    sa << "windows " << st.windows << " reflected " << st.reflected << " stray " << st.stray << "\n";
+    uint32_t n = st.windows < PLC_PROBER_WINDOWS ? st.windows : PLC_PROBER_WINDOWS;
+    for (uint32_t i = st.windows - n; i < st.windows; i++) {
+        const ProbeWindow &w = st.w[i % PLC_PROBER_WINDOWS];
+        // Goodput between the first and the last probe at the peer
+        double goodput = 0;
+        if (w.reflected > 1 && w.peer_last_ns > w.peer_first_ns)
+            goodput = (double) (w.reflected - 1) * w.size * 8 * 1000000 / (w.peer_last_ns - w.peer_first_ns);
+        sa << "train " << w.train << " start " << Timestamp::make_nsec(w.start_ns)
+           << " offered_kbps " << w.rate_kbps << " goodput_kbps " << (uint32_t) goodput
+           << " sent " << w.sent << " loss_fwd " << (w.sent - w.reflected)
+           << " loss_ret " << (w.reflected > w.received ? w.reflected - w.received : 0)
+           << " rtt_us " << (w.received ? w.rtt_sum_ns / w.received / 1000 : 0)
+           << " ipdv_us " << (w.ipdv_count ? w.ipdv_sum_ns / w.ipdv_count / 1000 : 0);
+        if (w.has_phy)
+            sa << " phy_tx " << (int) w.phy_tx << " phy_rx " << (int) w.phy_rx
+               << " efficiency " << (w.phy_tx ? goodput / 10 / w.phy_tx : 0) << "%";
+        if (w.has_errors) {
+            uint64_t pbs = w.tx.pb_pass + w.tx.pb_fail;
+            sa << " polls " << w.polls << " mpdu_ack " << w.tx.mpdu_ack
+               << " mpdu_coll " << w.tx.mpdu_coll << " mpdu_fail " << w.tx.mpdu_fail
+               << " pb_err " << (pbs ? 100. * w.tx.pb_fail / pbs : 0) << "%";
+        }
+        sa << "\n";
+    }
+    return sa.take_string();
+}
+
+static String
+results_handler(Element *e, void *)
+{
+    return ((PLCProber *) e)->read_results();
+}
+
+void
+PLCProber::add_handlers()
+{
+    add_read_handler("results", results_handler);
+    add_task_handlers(&_task);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(PLCProber)
+ELEMENT_REQUIRES(userlevel)
@@ -0,0 +1,168 @@
+#ifndef CLICK_PLCPROBER_HH
+#define CLICK_PLCPROBER_HH
+#include <click/element.hh>
+#include <click/etheraddress.hh>
+#include <click/task.hh>
+#include <click/timer.hh>
+#include "PLCSnapshot.h"
+#include "PLCBatch.h"
+#include "errorstatsreq.hh"
+#include "phyratesreq.hh"
+CLICK_DECLS
+
+/*
+=c
+
+PLCProber(SRC, [DST, I<keywords> RATE, SIZE, BURST, DURATION, PERIOD, GRACE, ERRORSTATS, PHYRATES])
+
+=s PLC
+
+Measures the goodput of a PLC link with paced probe trains
+
+=d
+
+Sends a train of probes of SIZE bytes (default 1400) from SRC to DST for
+DURATION ms (default 5000) every PERIOD ms (default 30000), paced at RATE
+kbps (default 10000, 0 to only reflect). A task sends the probes in bursts
+of at most BURST (default 8) and sleeps on a timer until the next probe is
+due, so the offered rate holds over any interval longer than a burst.
+
+The PLCProber on the peer reflects every probe addressed to its SRC back,
+stamped with its own time of reception and the number of probes of the train
+that it has received. From the reflected probes the element computes, per
+train: the forward goodput (bytes received by the peer over the time between
+the first and last probe at the peer), the forward and return loss, the mean
+round-trip time and the mean one-way delay variation between consecutive
+probes (which does not need synchronized clocks). Replies are awaited GRACE ms
+(default 500) after the train.
+
+With ERRORSTATS (an ErrorStatsReq polling DST in transmission) and PHYRATES
+(a PhyRatesReq), the window is lined up with the MME statistics: the increase
+of the MPDU and PB counters of the replies received during the window, and
+the PHY rates towards DST of the last NW_STATS reply. The window should span
+several polls of those elements.
+
+Input 0 takes the packets of the interface; probes and replies are consumed,
+everything else leaves on output 0. Output 1 emits probes and reflected
+probes towards the interface.
+
+=h results read-only
+
+One line per recent window, newest last.
+
+=a ErrorStatsReq, PhyRatesReq
+*/
+
+#define PLC_PROBE_ETHERTYPE     0x88B5  // IEEE 802 local experimental
+#define PLC_PROBE_MAGIC         0x504C4350U // "PLCP"
+#define PLC_PROBER_WINDOWS      16
+
+enum { PLC_PROBE = 1, PLC_PROBE_REPLY = 2 };
+
+// Probe payload after the Ethernet header, little-endian
+struct click_plc_probe {
+    uint8_t magic[4];
+    uint8_t type;
+    uint8_t reserved[3];
+    uint8_t train[4];
+    uint8_t seq[4];
+    uint8_t tx_ns[8];           // Time of sending, clock of the prober
+    uint8_t rx_ns[8];           // Time of reception, clock of the reflector
+    uint8_t rx_count[4];        // Probes of the train received by the reflector
+    uint8_t reserved2[4];
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+struct ProbeWindow {
+    uint64_t start_ns;
+    uint32_t train;
+    uint32_t rate_kbps;         // Offered
+    uint32_t size;
+    uint32_t sent;
+    uint32_t reflected;         // Probes received by the peer
+    uint32_t received;          // Replies received
+    uint64_t peer_first_ns;     // First and last probe at the peer
+    uint64_t peer_last_ns;
+    uint64_t rtt_sum_ns;
+    uint64_t ipdv_sum_ns;       // Sum of |delay variation| between consecutive replies
+    uint32_t ipdv_count;
+    // MME statistics during the window
+    uint8_t has_phy;
+    uint8_t phy_tx;             // Mbps, PhyRatesReq
+    uint8_t phy_rx;
+    uint8_t has_errors;
+    uint32_t polls;             // ErrorStatsReq replies during the window
+    ErrorStatsTx tx;            // Increase of the TX counters
+};
+
+// Published by PLCProber after every window
+struct ProberSnapshot {
+    uint32_t windows;
+    uint32_t reflected;         // Probes of other probers reflected
+    uint32_t stray;             // Replies of no current train
+    uint32_t reserved;
+    ProbeWindow w[PLC_PROBER_WINDOWS];
+};
+
+class PLCProber : public Element { public:
+
+    PLCProber();
+    ~PLCProber();
+
+    const char *class_name() const      { return "PLCProber"; }
+    const char *port_count() const      { return "1/2"; }
+    const char *processing() const      { return PUSH; }
+    void *cast(const char *name);
+    int configure(Vector<String> &, ErrorHandler *);
+    int initialize(ErrorHandler *errh);
+    void push(int port, Packet *p);
+#if HAVE_BATCH
+    void push_batch(int port, PacketBatch *batch);
+#endif
+    bool run_task(Task *);
+    void run_timer(Timer *);
+    void add_handlers();
+
+    String read_results() const;
+
+private:
+    enum { IDLE, SENDING, DRAINING };
+
+    EtherAddress _src;
+    EtherAddress _dst;
+    uint32_t _rate_kbps;
+    uint32_t _size;
+    uint32_t _burst;
+    uint32_t _duration_ms;
+    uint32_t _period_ms;
+    uint32_t _grace_ms;
+    ErrorStatsReq *_errorstats;
+    PhyRatesReq *_phyrates;
+
+    Task _task;
+    Timer _pace_timer;              // Wakes the task when the next probe is due
+    Timer _window_timer;            // Starts and ends the windows
+    int _state;
+    uint32_t _train;
+    uint64_t _start_ns;
+    uint64_t _interval_ns;          // Between two probes at RATE
+    ProbeWindow _w;                 // Window being measured
+    uint64_t _last_transit_ns;
+    ErrorStatsSnapshot _errors_start;
+    bool _has_errors_start;
+
+    // Reflector side: the train being received
+    uint32_t _rx_train;
+    uint32_t _rx_count;
+
+    PLCSnapshot<ProberSnapshot> _stats;
+
+    Packet *handle(Packet *p);
+    void reflect(WritablePacket *q);
+    void reply(const click_plc_probe *probe);
+    void send_probe();
+    void start_window();
+    void finish_window();
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,172 @@
+/*
+ * plcstationtable.{cc,hh} -- TEI to Ethernet address mapping of the PLC stations
+ *
+ * Learned from the error statistics replies of ErrorStatsReq (which carry the
+ * TEI of the queried station), pruned with the NW_STATS replies, and read with one
+ * atomic load per TEI by the elements that only see TEIs.
+ */
+
+#include <click/config.h>
+#include "plcstationtable.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/glue.hh>
+#include <click/straccum.hh>
+#include <click/timestamp.hh>
+CLICK_DECLS
+
+PLCStationTable::PLCStationTable()
+{
+    memset(_entries, 0, sizeof(_entries));
+    memset(_learned, 0, sizeof(_learned));
+}
+
+PLCStationTable::~PLCStationTable()
+{
+}
+
+void *
+PLCStationTable::cast(const char *name)
+{
+    if (strcmp(name, "PLCStationTable") == 0)
+        return this;
+    else
+        return Element::cast(name);
+}
+
+int
+PLCStationTable::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    Vector<String> stations;
+    if (Args(conf, this, errh).read_all("STATION", AnyArg(), stations)
+                              .complete() < 0)
+        return -1;
+    for (int i = 0; i < stations.size(); i++) {
+        uint32_t tei;
+        EtherAddress mac;
+        if (Args(this, errh).push_back_words(stations[i])
+            .read_mp("TEI", tei)
+            .read_mp("ADDR", mac)
+            .complete() < 0)
+            return -1;
+        if (tei == 0 || tei > 0xFE)
+            return errh->error("STATION TEI must be between 1 and 254");
+        set(tei, PLC_STATION_VALID | PLC_STATION_STATIC | pack(mac.data()));
+    }
+    return 0;
+}
+
+uint64_t
+PLCStationTable::pack(const uint8_t *mac)
+{
+    uint64_t w = 0;
+    for (int i = 0; i < 6; i++)
+        w = (w << 8) | mac[i];
+    return w;
+}
+
+void
+PLCStationTable::set(uint8_t tei, uint64_t w)
+{
+    __atomic_store_n(&_entries[tei], w, __ATOMIC_RELEASE);
+    __atomic_store_n(&_learned[tei], (uint32_t) Timestamp::now().sec(), __ATOMIC_RELAXED);
+}
+
+int
+PLCStationTable::tei_of(const uint8_t *mac) const
+{
+    uint64_t m = pack(mac);
+    for (int tei = 1; tei < 0xFF; tei++) {
+        uint64_t w = __atomic_load_n(&_entries[tei], __ATOMIC_ACQUIRE);
+        if ((w & PLC_STATION_VALID) && (w & PLC_STATION_MAC_MASK) == m)
+            return tei;
+    }
+    return -1;
+}
+
+void
+PLCStationTable::learn(uint8_t tei, const uint8_t *mac)
+{
+    if (tei == 0 || tei == 0xFF)
+        return;
+    uint64_t m = pack(mac), w = PLC_STATION_VALID | m;
+    uint64_t old = __atomic_load_n(&_entries[tei], __ATOMIC_ACQUIRE);
+    if (old == w) {
+        __atomic_store_n(&_learned[tei], (uint32_t) Timestamp::now().sec(), __ATOMIC_RELAXED);
+        return;
+    }
+    // The station left its previous TEI
+    for (int other = 1; other < 0xFF; other++) {
+        uint64_t o = __atomic_load_n(&_entries[other], __ATOMIC_ACQUIRE);
+        if (other != tei && (o & PLC_STATION_VALID) && (o & PLC_STATION_MAC_MASK) == m)
+            __atomic_compare_exchange_n(&_entries[other], &o, 0, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    }
+    set(tei, w);
+    click_chatter("[PLCStationTable] TEI %d is %s", tei, EtherAddress(mac).unparse().c_str());
+}
+
+// Drops the learned stations that are not in the network any more
+void
+PLCStationTable::refresh(const PLCNwStatsConfView &nwstats)
+{
+    for (int tei = 1; tei < 0xFF; tei++) {
+        uint64_t w = __atomic_load_n(&_entries[tei], __ATOMIC_ACQUIRE);
+        if (!(w & PLC_STATION_VALID) || (w & PLC_STATION_STATIC))
+            continue;
+        bool present = false;
+        for (uint32_t i = 0; i < nwstats.num_stas() && !present; i++)
+            present = pack(nwstats.sta(i).DA) == (w & PLC_STATION_MAC_MASK);
+        if (!present && __atomic_compare_exchange_n(&_entries[tei], &w, 0, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            click_chatter("[PLCStationTable] TEI %d left the network", tei);
+    }
+}
+
+void
+PLCStationTable::clear()
+{
+    for (int tei = 0; tei < 256; tei++) {
+        uint64_t w = __atomic_load_n(&_entries[tei], __ATOMIC_ACQUIRE);
+        if (!(w & PLC_STATION_STATIC))
+            __atomic_compare_exchange_n(&_entries[tei], &w, 0, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    }
+}
+
+String
+PLCStationTable::read_stations() const
+{
+    StringAccum sa;
+    uint8_t mac[6];
+    for (int tei = 0; tei < 256; tei++)
+        if (lookup(tei, mac)) {
+            sa << tei << " " << EtherAddress(mac).unparse() << " learned "
+               << Timestamp(__atomic_load_n(&_learned[tei], __ATOMIC_RELAXED), 0);
+            if (__atomic_load_n(&_entries[tei], __ATOMIC_RELAXED) & PLC_STATION_STATIC)
+                sa << " static";
+            sa << "\n";
+        }
+    return sa.take_string();
+}
+
+static String
+stations_handler(Element *e, void *)
+{
+    return ((PLCStationTable *) e)->read_stations();
+}
+
+static int
+clear_handler(const String &, Element *e, void *, ErrorHandler *)
+{
+    ((PLCStationTable *) e)->clear();
+    return 0;
+}
+
+void
+PLCStationTable::add_handlers()
+{
+    add_read_handler("stations", stations_handler);
+    add_write_handler("clear", clear_handler);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(PLCStationTable)
+ELEMENT_REQUIRES(userlevel)
@@ -0,0 +1,96 @@
+#ifndef CLICK_PLCSTATIONTABLE_HH
+#define CLICK_PLCSTATIONTABLE_HH
+#include <click/element.hh>
+#include <click/etheraddress.hh>
+#include "PLCStats.h"
+#include "PLCView.h"
+CLICK_DECLS
+
+/*
+=c
+
+PLCStationTable([I<keywords> STATION])
+
+=s PLC
+
+TEI to Ethernet address mapping shared by the PLC elements
+
+=d
+
+Sniffer indications name the stations by their 8-bit TEI, the request
+elements by their Ethernet address. The table maps each TEI to the address
+of its station, so that the elements given STATIONS (the name of this
+element) key and join their statistics by address without sending any MME:
+
+ErrorStatsReq learns the TEI of its DST from every successful reply. It is
+the only element that learns, so the table holds the TEIs of the peers that
+ErrorStatsReq polls or has polled, until they leave the network, and the
+STATION entries; the TEIs of other stations are not resolved.
+
+PhyRatesReq drops the learned stations that are no longer in the NW_STATS
+replies, so that a TEI given to another station is not resolved to the old
+one. SniffPackets prints the addresses of the TEIs it resolves and records
+the MPDUs of a resolved TEI in the store under its address.
+
+STATION "TEI ADDR" (repeatable) adds a static entry, e.g. for a station that
+is never polled; NW_STATS replies do not remove it, a learned address for the
+same TEI replaces it. A station learned with a new TEI loses its old one.
+
+A TEI is resolved with one atomic load of a 64-bit word holding the address
+and flags, so any element can look up TEIs on its fast path, on any thread.
+
+=h stations read-only
+
+One line per known TEI: "TEI ADDR learned TIME [static]".
+
+=h clear write-only
+
+Forgets all the learned entries.
+
+=a SniffPackets, ErrorStatsReq, PhyRatesReq
+*/
+
+#define PLC_STATION_VALID       (1ULL << 63)
+#define PLC_STATION_STATIC      (1ULL << 62)
+#define PLC_STATION_MAC_MASK    0xFFFFFFFFFFFFULL
+
+class PLCStationTable : public Element { public:
+
+    PLCStationTable();
+    ~PLCStationTable();
+
+    const char *class_name() const      { return "PLCStationTable"; }
+    const char *port_count() const      { return PORTS_0_0; }
+    void *cast(const char *name);
+    int configure(Vector<String> &, ErrorHandler *);
+    void add_handlers();
+
+    // Address of the station of tei, if known
+    bool lookup(uint8_t tei, uint8_t *mac) const {
+        uint64_t w = __atomic_load_n(&_entries[tei], __ATOMIC_ACQUIRE);
+        if (!(w & PLC_STATION_VALID))
+            return false;
+        for (int i = 5; i >= 0; i--, w >>= 8)
+            mac[i] = w & 0xFF;
+        return true;
+    }
+    // TEI of the station of mac, or -1
+    int tei_of(const uint8_t *mac) const;
+
+    // Writers, on any thread
+    void learn(uint8_t tei, const uint8_t *mac);
+    void refresh(const PLCNwStatsConfView &nwstats);
+    void clear();
+
+    String read_stations() const;
+
+private:
+    uint64_t _entries[256];
+    uint32_t _learned[256];         // Second of the last learn, for the handler; atomic
+
+    static uint64_t pack(const uint8_t *mac);
+    void set(uint8_t tei, uint64_t w);
+};
+
+CLICK_ENDDECLS
+#endif
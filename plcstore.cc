@@ -0,0 +1,391 @@
+/*
+ * plcstore.{cc,hh} -- Multi-resolution time-series store for PLC statistics
+ *
+ * The PLC elements record here the values they decode (PHY rates per station,
+ * PHY rate per tonemap slot, error counter increases, sniffed frames). Every
+ * series keeps a ring of raw samples and three rings of rollup buckets. A
+ * bucket is addressed directly by its start time, so recording costs a
+ * constant number of operations and a query only visits the buckets of the
+ * requested range.
+ */
+
+#include <click/config.h>
+#include "plcstore.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/glue.hh>
+#include <click/straccum.hh>
+#include <float.h>
+CLICK_DECLS
+
+#define PLC_STORE_READ_TRIES 64
+
+// 10 s buckets for 1 hour, 1 min buckets for 1 day, 1 h buckets for 30 days
+const uint32_t PLCStore::level_width[PLC_STORE_LEVELS] = {10, 60, 3600};
+const uint32_t PLCStore::level_size[PLC_STORE_LEVELS] = {360, 1440, 720};
+
+static const char * const metric_names[PLC_METRIC_COUNT] = {
+    "phy_tx", "phy_rx",
+    "tm_rate0", "tm_rate1", "tm_rate2", "tm_rate3", "tm_rate4", "tm_rate5",
+    "tx_ack", "tx_coll", "tx_fail", "tx_pb_fail", "rx_pb_pass", "rx_pb_fail",
+    "sniff_frames"
+};
+
+static const char * const level_names[PLC_STORE_LEVELS] = {"10s", "1m", "1h"};
+
+PLCStore::PLCStore()
+    : _max_series(64), _raw_size(120), _nseries(0), _dropped(0),
+      _series(0), _slab(0), _index_keys(0), _index_series(0), _index_mask(0)
+{
+}
+
+PLCStore::~PLCStore()
+{
+}
+
+void *
+PLCStore::cast(const char *name)
+{
+    if (strcmp(name, "PLCStore") == 0)
+        return this;
+    else
+        return Element::cast(name);
+}
+
+int
+PLCStore::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    if (Args(conf, this, errh).read("SERIES", _max_series)
+                              .read("RAW", _raw_size)
+                              .complete() < 0)
+        return -1;
+    if (_max_series == 0 || _max_series > 65536 || _raw_size == 0)
+        return errh->error("SERIES must be between 1 and 65536 and RAW positive");
+    return 0;
+}
+
+int
+PLCStore::initialize(ErrorHandler *errh)
+{
+    // One slab for all the rings of all series
+    size_t per_series = sizeof(Sample) * _raw_size;
+    for (int l = 0; l < PLC_STORE_LEVELS; l++)
+        per_series += sizeof(Bucket) * level_size[l];
+
+    uint32_t index_size = 1;
+    while (index_size < 2 * _max_series)
+        index_size <<= 1;
+    _index_mask = index_size - 1;
+
+    _series = new Series[_max_series];
+    _slab = new char[per_series * _max_series];
+    _index_keys = new uint64_t[index_size];
+    _index_series = new uint32_t[index_size];
+    if (!_series || !_slab || !_index_keys || !_index_series)
+        return errh->error("out of memory");
+    memset(_index_keys, 0, sizeof(uint64_t) * index_size);
+
+    char *p = _slab;
+    for (uint32_t i = 0; i < _max_series; i++) {
+        Series &s = _series[i];
+        s.raw = (Sample *) p;
+        p += sizeof(Sample) * _raw_size;
+        for (int l = 0; l < PLC_STORE_LEVELS; l++) {
+            s.levels[l] = (Bucket *) p;
+            p += sizeof(Bucket) * level_size[l];
+        }
+    }
+    return 0;
+}
+
+void
+PLCStore::cleanup(CleanupStage)
+{
+    delete[] _series;
+    delete[] _slab;
+    delete[] _index_keys;
+    delete[] _index_series;
+    _series = 0;
+    _slab = 0;
+    _index_keys = 0;
+    _index_series = 0;
+}
+
+uint64_t
+PLCStore::peer_key(const uint8_t *mac)
+{
+    uint64_t key = 0;
+    for (int i = 0; i < 6; i++)
+        key = (key << 8) | mac[i];
+    return key;
+}
+
+String
+PLCStore::unparse_peer(uint64_t peer)
+{
+    if (peer & 0x1000000000000ULL)
+        return String("tei:") + String((int) (peer & 0xFF));
+    uint8_t mac[6];
+    for (int i = 5; i >= 0; i--, peer >>= 8)
+        mac[i] = peer & 0xFF;
+    return EtherAddress(mac).unparse();
+}
+
+const char *
+PLCStore::metric_name(int metric)
+{
+    return metric >= 0 && metric < PLC_METRIC_COUNT ? metric_names[metric] : "unknown";
+}
+
+PLCStore::Series *
+PLCStore::lookup(int metric, uint64_t peer) const
+{
+    uint64_t key = series_key(metric, peer) + 1;
+    for (uint32_t i = (uint32_t) ((key * 0x9E3779B97F4A7C15ULL) >> 40), n = 0; n <= _index_mask; i++, n++) {
+        uint64_t k = __atomic_load_n(&_index_keys[i & _index_mask], __ATOMIC_ACQUIRE);
+        if (k == key)
+            return &_series[_index_series[i & _index_mask]];
+        if (k == 0)
+            return 0;
+    }
+    return 0;
+}
+
+// Adds the series under the lock, so that elements on several threads may
+// add series at the same time; lookup() does not take it
+PLCStore::Series *
+PLCStore::insert(int metric, uint64_t peer)
+{
+    uint64_t key = series_key(metric, peer) + 1;
+    Series *found = 0;
+    _insert_lock.acquire();
+    for (uint32_t i = (uint32_t) ((key * 0x9E3779B97F4A7C15ULL) >> 40), n = 0; n <= _index_mask; i++, n++) {
+        uint32_t slot = i & _index_mask;
+        if (_index_keys[slot] == key) {
+            found = &_series[_index_series[slot]];
+            break;
+        }
+        if (_index_keys[slot] == 0) {
+            if (_nseries == _max_series)
+                break;
+            Series &s = _series[_nseries];
+            s.peer = peer;
+            s.metric = metric;
+            s.seq = 0;
+            s.raw_head = s.raw_count = 0;
+            for (int l = 0; l < PLC_STORE_LEVELS; l++)
+                memset(s.levels[l], 0, sizeof(Bucket) * level_size[l]);
+            _index_series[slot] = _nseries;
+            __atomic_store_n(&_nseries, _nseries + 1, __ATOMIC_RELEASE);
+            __atomic_store_n(&_index_keys[slot], key, __ATOMIC_RELEASE);
+            found = &s;
+            break;
+        }
+    }
+    _insert_lock.release();
+    return found;
+}
+
+void
+PLCStore::record(int metric, uint64_t peer, const Timestamp &t, double v)
+{
+    if (!_series)
+        return;
+    Series *s = lookup(metric, peer);
+    if (!s && !(s = insert(metric, peer))) {
+        __atomic_fetch_add(&_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // Two elements may record the same series, e.g. two TonemapReq polling
+    // the same peer: the writers take turns on its sequence number
+    uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+    while ((seq & 1) || !__atomic_compare_exchange_n(&s->seq, &seq, seq + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    Sample &r = s->raw[s->raw_head];
+    r.t_ns = t.nsecval();
+    r.v = v;
+    s->raw_head = (s->raw_head + 1) % _raw_size;
+    if (s->raw_count < _raw_size)
+        s->raw_count++;
+
+    for (int l = 0; l < PLC_STORE_LEVELS; l++) {
+        uint32_t epoch = t.sec() / level_width[l];
+        Bucket &b = s->levels[l][epoch % level_size[l]];
+        if (b.epoch != epoch || b.count == 0) {
+            b.epoch = epoch;
+            b.count = 0;
+            b.min = DBL_MAX;
+            b.max = -DBL_MAX;
+            b.sum = 0;
+        }
+        b.count++;
+        b.sum += v;
+        if (v < b.min)
+            b.min = v;
+        if (v > b.max)
+            b.max = v;
+    }
+
+    __atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void
+PLCStore::query_raw(const Series *s, int64_t t0, int64_t t1, StringAccum &sa) const
+{
+    // The ring is in time order: binary search for the first sample >= t0
+    uint32_t count = s->raw_count;
+    uint32_t first = (s->raw_head + _raw_size - count) % _raw_size;
+    uint32_t lo = 0, hi = count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (s->raw[(first + mid) % _raw_size].t_ns < t0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (uint32_t i = lo; i < count; i++) {
+        const Sample &r = s->raw[(first + i) % _raw_size];
+        if (r.t_ns > t1)
+            break;
+        sa << Timestamp::make_nsec(r.t_ns).unparse() << " 1 " << r.v << " " << r.v << " " << r.v << "\n";
+    }
+}
+
+void
+PLCStore::query_level(const Series *s, int level, int64_t t0, int64_t t1, StringAccum &sa) const
+{
+    int64_t width = level_width[level];
+    int64_t e0 = t0 / 1000000000 / width;
+    int64_t e1 = t1 / 1000000000 / width;
+    // Older epochs have been overwritten anyway
+    if (e1 - e0 >= (int64_t) level_size[level])
+        e0 = e1 - level_size[level] + 1;
+    for (int64_t e = e0; e <= e1; e++) {
+        const Bucket &b = s->levels[level][e % level_size[level]];
+        if (b.epoch != (uint32_t) e || b.count == 0)
+            continue;
+        sa << Timestamp::make_sec(e * width).unparse() << " " << b.count << " " << b.min
+           << " " << b.max << " " << (b.sum / b.count) << "\n";
+    }
+}
+
+int
+PLCStore::query(const String &arg, String &result, ErrorHandler *errh) const
+{
+    String metric_name, peer_name, res = "auto";
+    Timestamp t0, t1;
+    if (Args(this, errh).push_back_words(arg)
+                        .read_mp("METRIC", WordArg(), metric_name)
+                        .read_mp("PEER", WordArg(), peer_name)
+                        .read_mp("T0", t0)
+                        .read_mp("T1", t1)
+                        .read_p("RES", WordArg(), res)
+                        .complete() < 0)
+        return -1;
+
+    int metric = -1;
+    for (int i = 0; i < PLC_METRIC_COUNT; i++)
+        if (metric_name == metric_names[i])
+            metric = i;
+    if (metric < 0)
+        return errh->error("unknown metric %s", metric_name.c_str());
+
+    uint64_t peer;
+    EtherAddress mac;
+    int tei;
+    if (peer_name.length() > 4 && peer_name.substring(0, 4) == "tei:"
+        && IntArg().parse(peer_name.substring(4), tei) && tei >= 0 && tei < 256)
+        peer = tei_key(tei);
+    else if (EtherAddressArg().parse(peer_name, mac))
+        peer = peer_key(mac);
+    else
+        return errh->error("bad peer %s", peer_name.c_str());
+
+    int level = -2;             // -1: raw
+    if (res == "raw")
+        level = -1;
+    for (int l = 0; l < PLC_STORE_LEVELS; l++)
+        if (res == level_names[l])
+            level = l;
+    if (level == -2 && res != "auto")
+        return errh->error("bad resolution %s", res.c_str());
+
+    const Series *s = lookup(metric, peer);
+    if (!s) {
+        result = String();
+        return 0;
+    }
+
+    int64_t ns0 = t0.nsecval(), ns1 = t1.nsecval();
+    if (level == -2) {
+        // Finest resolution whose history still reaches t0
+        int64_t now = Timestamp::now().nsecval();
+        uint32_t count = s->raw_count;
+        if (count && s->raw[(s->raw_head + _raw_size - count) % _raw_size].t_ns <= ns0)
+            level = -1;
+        else {
+            level = PLC_STORE_LEVELS - 1;
+            for (int l = 0; l < PLC_STORE_LEVELS; l++)
+                if (now - ns0 <= (int64_t) level_width[l] * level_size[l] * 1000000000) {
+                    level = l;
+                    break;
+                }
+        }
+    }
+
+    // Same sequence protocol as PLCSnapshot: retry if the series was written
+    for (int i = 0; i < PLC_STORE_READ_TRIES; i++) {
+        uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+        StringAccum sa;
+        if (level < 0)
+            query_raw(s, ns0, ns1, sa);
+        else
+            query_level(s, level, ns0, ns1, sa);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq) {
+            result = sa.take_string();
+            return 0;
+        }
+    }
+    return errh->error("series busy");
+}
+
+String
+PLCStore::read_series() const
+{
+    StringAccum sa;
+    uint32_t n = __atomic_load_n(&_nseries, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < n; i++)
+        sa << metric_names[_series[i].metric] << " " << unparse_peer(_series[i].peer)
+           << " " << _series[i].raw_count << "\n";
+    if (uint32_t dropped = __atomic_load_n(&_dropped, __ATOMIC_RELAXED))
+        sa << "dropped " << dropped << "\n";
+    return sa.take_string();
+}
+
+static int
+query_handler(int, String &data, Element *e, const Handler *, ErrorHandler *errh)
+{
+    return ((PLCStore *) e)->query(data, data, errh);
+}
+
+static String
+series_handler(Element *e, void *)
+{
+    return ((PLCStore *) e)->read_series();
+}
+
+void
+PLCStore::add_handlers()
+{
+    set_handler("query", Handler::f_read | Handler::f_read_param, query_handler);
+    add_read_handler("series", series_handler);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(PLCStore)
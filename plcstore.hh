@@ -0,0 +1,141 @@
+#ifndef CLICK_PLCSTORE_HH
+#define CLICK_PLCSTORE_HH
+#include <click/element.hh>
+#include <click/etheraddress.hh>
+#include <click/straccum.hh>
+#include <click/timestamp.hh>
+#include <click/sync.hh>
+CLICK_DECLS
+
+/*
+=c
+
+PLCStore([I<keywords> SERIES, RAW])
+
+=s PLC
+
+Time-series store for the statistics of the PLC elements
+
+=d
+
+Keeps the values that PhyRatesReq, TonemapReq, ErrorStatsReq and SniffPackets
+learn (elements given STORE pointing to this element). For every (metric,
+peer) series it keeps the last RAW raw samples and rollups (min, max, mean,
+count) over 10 s, 1 min and 1 h that cover 1 h, 1 day and 30 days. All memory
+is allocated at initialization for SERIES series (default 64); values of new
+series beyond that are dropped and counted.
+
+One store may be shared by elements running on different threads. A new
+series is added under a lock, taken only the first time a (metric, peer)
+pair is seen; the writers of an existing series take turns on its sequence
+number, which the handlers use to detect concurrent writes.
+
+=h query read-only with parameter
+
+"METRIC PEER T0 T1 [RES]": values of METRIC for PEER (an Ethernet address or
+tei:N) between the timestamps T0 and T1. RES is raw, 10s, 1m, 1h or auto
+(default: the finest resolution that still covers T0). Prints one line
+"TIME COUNT MIN MAX MEAN" per sample or rollup bucket.
+
+=h series read-only
+
+Lists the series with their number of samples.
+*/
+
+enum plc_metric {
+    PLC_METRIC_PHY_TX = 0,      // PhyRatesReq: average PHY rate STA -> peer
+    PLC_METRIC_PHY_RX,          // PhyRatesReq: average PHY rate peer -> STA
+    PLC_METRIC_TM_RATE0,        // TonemapReq: PHY rate of tonemap slot 0..5 in Mbps
+    PLC_METRIC_TM_RATE5 = PLC_METRIC_TM_RATE0 + 5,
+    PLC_METRIC_TX_ACK,          // ErrorStatsReq: increase since the previous reply
+    PLC_METRIC_TX_COLL,
+    PLC_METRIC_TX_FAIL,
+    PLC_METRIC_TX_PB_FAIL,
+    PLC_METRIC_RX_PB_PASS,
+    PLC_METRIC_RX_PB_FAIL,
+    PLC_METRIC_SNIFF_FRAMES,    // SniffPackets: MPDUs per second sent by a TEI
+    PLC_METRIC_COUNT
+};
+
+#define PLC_STORE_LEVELS 3
+
+class PLCStore : public Element { public:
+
+    PLCStore();
+    ~PLCStore();
+
+    const char *class_name() const      { return "PLCStore"; }
+    const char *port_count() const      { return PORTS_0_0; }
+    void *cast(const char *name);
+    int configure(Vector<String> &, ErrorHandler *);
+    int initialize(ErrorHandler *errh);
+    void cleanup(CleanupStage);
+    void add_handlers();
+
+    // Peer keys: an Ethernet address, or a TEI for frames seen by the sniffer
+    static uint64_t peer_key(const uint8_t *mac);
+    static uint64_t peer_key(const EtherAddress &mac)  { return peer_key(mac.data()); }
+    static uint64_t tei_key(uint8_t tei)               { return 0x1000000000000ULL | tei; }
+    static String unparse_peer(uint64_t peer);
+    static const char *metric_name(int metric);
+
+    // Records value v of metric for peer at time t. Called by the elements
+    // on their own threads: any number of elements may share the store.
+    void record(int metric, uint64_t peer, const Timestamp &t, double v);
+
+    int query(const String &arg, String &result, ErrorHandler *errh) const;
+    String read_series() const;
+
+private:
+    struct Sample {
+        int64_t t_ns;
+        double v;
+    };
+
+    struct Bucket {
+        uint32_t epoch;         // Start time / width of the level
+        uint32_t count;
+        double min;
+        double max;
+        double sum;
+    };
+
+    struct Series {
+        uint64_t peer;
+        uint32_t metric;
+        uint32_t seq;           // Odd while the series is written
+        uint32_t raw_head;      // Next raw slot
+        uint32_t raw_count;
+        Sample *raw;
+        Bucket *levels[PLC_STORE_LEVELS];
+    };
+
+    static const uint32_t level_width[PLC_STORE_LEVELS];
+    static const uint32_t level_size[PLC_STORE_LEVELS];
+
+    uint32_t _max_series;
+    uint32_t _raw_size;
+    uint32_t _nseries;
+    uint32_t _dropped;          // Atomic
+    Series *_series;
+    char *_slab;
+
+    // Open-addressed index (metric, peer) -> series. Entries are only ever
+    // added, key last and under _insert_lock, so that handlers and recording
+    // elements probe it without the lock while another element adds.
+    uint64_t *_index_keys;
+    uint32_t *_index_series;
+    uint32_t _index_mask;
+    Spinlock _insert_lock;
+
+    Series *lookup(int metric, uint64_t peer) const;
+    Series *insert(int metric, uint64_t peer);
+    static uint64_t series_key(int metric, uint64_t peer) {
+        return ((uint64_t) metric << 49) | peer;
+    }
+    void query_raw(const Series *s, int64_t t0, int64_t t1, StringAccum &sa) const;
+    void query_level(const Series *s, int level, int64_t t0, int64_t t1, StringAccum &sa) const;
+};
+
+CLICK_ENDDECLS
+#endif
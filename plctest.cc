@@ -0,0 +1,273 @@
+/*
+ * plctest.{cc,hh} -- Regression tests of the PLC helpers
+ *
+ * Every test is a function of its own returning errh->error() at the first
+ * failed check; PLCTest::initialize() runs them all.
+ */
+
+#include <click/config.h>
+#include "plctest.hh"
+#include <click/error.hh>
+#include <click/glue.hh>
+#include "PLCArchive.h"
+#include "PLCSampler.h"
+CLICK_DECLS
+
+#define CHECK(x) if (!(x)) return errh->error("%s:%d: test '%s' failed", __FILE__, __LINE__, #x);
+
+PLCTest::PLCTest()
+{
+}
+
+PLCTest::~PLCTest()
+{
+}
+
+// Codes in[n], checks the length against the bound and that XORing the code
+// onto zeros gives in back
+static int
+archive_roundtrip(const uint8_t *in, uint32_t n, ErrorHandler *errh)
+{
+    uint8_t coded[PLC_ARCHIVE_MAX_BYTES * 2], out[PLC_ARCHIVE_MAX_BYTES];
+    uint32_t bound = plc_archive_rle_bound(n);
+    CHECK(bound <= sizeof(coded));
+    // Guard bytes past the bound catch an overflow of the caller's buffer
+    memset(coded, 0xA5, sizeof(coded));
+    uint32_t len = plc_archive_rle_encode(coded, in, n);
+    CHECK(len <= bound);
+    for (uint32_t i = bound; i < sizeof(coded); i++)
+        CHECK(coded[i] == 0xA5);
+    memset(out, 0, n);
+    CHECK(plc_archive_rle_xor(out, n, coded, len));
+    CHECK(memcmp(out, in, n) == 0);
+    // A truncated code never decodes
+    if (len > 1) {
+        memset(out, 0, n);
+        CHECK(!plc_archive_rle_xor(out, n, coded, len - 1));
+    }
+    return 0;
+}
+
+// Repeats pattern over n bytes
+static int
+archive_pattern(const char *pattern, uint32_t n, ErrorHandler *errh)
+{
+    uint8_t in[PLC_ARCHIVE_MAX_BYTES];
+    uint32_t plen = strlen(pattern);
+    for (uint32_t i = 0; i < n; i++)
+        in[i] = pattern[i % plen] == '0' ? 0 : pattern[i % plen];
+    return archive_roundtrip(in, n, errh);
+}
+
+static int
+test_archive_rle(ErrorHandler *errh)
+{
+    // Short runs between literals cost the most: every nonzero run of 3,
+    // zero run of 2, alternations and single changes
+    static const char * const patterns[] = {
+        "aaab", "aaabb", "aab", "ab", "a", "0", "00a", "000a", "0a", "aaaab",
+        "aaaabc", "000ab", "aaa0", "aaa00", "aaaa0", "0000000000000000000x"
+    };
+    static const uint32_t sizes[] = {
+        1, 2, 3, 4, 5, 127, 128, 129, 130, 255, 256, 257, 1024, 1728, 2047, PLC_ARCHIVE_MAX_BYTES
+    };
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++)
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+            if (archive_pattern(patterns[p], sizes[s], errh) < 0)
+                return errh->error("pattern %s, %u bytes", patterns[p], sizes[s]);
+
+    // Every string of up to 10 bytes over {0, 1, 2}
+    uint8_t in[PLC_ARCHIVE_MAX_BYTES];
+    for (uint32_t n = 1; n <= 10; n++) {
+        uint32_t total = 1;
+        for (uint32_t i = 0; i < n; i++)
+            total *= 3;
+        for (uint32_t x = 0; x < total; x++) {
+            for (uint32_t i = 0, y = x; i < n; i++, y /= 3)
+                in[i] = y % 3;
+            if (archive_roundtrip(in, n, errh) < 0)
+                return -1;
+        }
+    }
+
+    // Random runs of random lengths
+    uint32_t seed = 1;
+    for (int k = 0; k < 2000; k++) {
+        uint32_t n = 1 + (seed = seed * 1103515245 + 12345) % PLC_ARCHIVE_MAX_BYTES;
+        for (uint32_t i = 0; i < n; ) {
+            seed = seed * 1103515245 + 12345;
+            uint32_t run = 1 + (seed >> 16) % 6;
+            uint8_t v = (seed >> 8) & 3 ? (seed >> 24) & 3 : 0;
+            for (; run && i < n; run--)
+                in[i++] = v;
+        }
+        if (archive_roundtrip(in, n, errh) < 0)
+            return -1;
+    }
+
+    // Runs longer than the longest run code
+    uint8_t zero[PLC_ARCHIVE_MAX_BYTES] = {0};
+    uint8_t coded[8];
+    CHECK(plc_archive_rle_encode(coded, zero, PLC_ARCHIVE_MAX_BYTES) == 2);
+    return 0;
+}
+
+static int
+test_archive_block(ErrorHandler *errh)
+{
+    // A block of three tonemaps of 5 carriers (3 bytes)
+    union {
+        uint8_t b[256];
+        uint64_t align;
+    } u;
+    memset(&u, 0, sizeof(u));
+    plc_archive_block *h = (plc_archive_block *) u.b;
+    plc_archive_entry *e = (plc_archive_entry *) (h + 1);
+    h->magic = PLC_ARCHIVE_BLOCK_MAGIC;
+    h->ncarriers = 5;
+    h->nbytes = 3;
+    h->count = 3;
+    h->first_ns = 1000000000;
+    uint8_t *data = (uint8_t *) (e + h->count);
+    static const uint8_t tonemaps[3][3] = {{0x21, 0x43, 0x05}, {0x21, 0x43, 0x06}, {0x21, 0x43, 0x06}};
+    uint8_t prev[3] = {0, 0, 0}, delta[3], out[PLC_ARCHIVE_MAX_BYTES];
+    for (int k = 0; k < 3; k++) {
+        for (int i = 0; i < 3; i++) {
+            delta[i] = tonemaps[k][i] ^ prev[i];
+            prev[i] = tonemaps[k][i];
+        }
+        h->size += plc_archive_rle_encode(data + h->size, delta, 3);
+        e[k].dt_ms = k * 10;
+        e[k].end = h->size;
+    }
+    uint64_t size = sizeof(*h) + h->count * sizeof(*e) + h->size;
+
+    CHECK(plc_archive_check_block(u.b, size) == h);
+    for (int k = 0; k < 3; k++) {
+        CHECK(plc_archive_decode(h, k, out));
+        CHECK(memcmp(out, tonemaps[k], 3) == 0);
+    }
+    CHECK(!plc_archive_decode(h, 3, out));
+    CHECK(plc_archive_find(h, 999999999) == -1);
+    CHECK(plc_archive_find(h, 1000000000) == 0);
+    CHECK(plc_archive_find(h, 1015000000) == 1);
+    CHECK(plc_archive_find(h, 2000000000) == 2);
+
+    // Blocks that would make the readers overrun their buffers
+    CHECK(!plc_archive_check_block(u.b, size - 1));
+    h->ncarriers = 7;
+    CHECK(!plc_archive_check_block(u.b, size));
+    h->ncarriers = 0;
+    CHECK(!plc_archive_check_block(u.b, size));
+    h->ncarriers = 5;
+    h->nbytes = PLC_ARCHIVE_MAX_BYTES + 1;
+    CHECK(!plc_archive_check_block(u.b, size));
+    h->nbytes = 3;
+    e[1].end = h->size + 1;
+    CHECK(!plc_archive_decode(h, 2, out));
+    e[1].end = 0;
+    CHECK(!plc_archive_decode(h, 2, out));
+    return 0;
+}
+
+// Writes records up to index n with v[0] = index
+static void
+sample_fill(PLCSampleRing &ring, uint64_t n)
+{
+    while (ring.newest() < n) {
+        click_plc_sample &s = ring.next();
+        s.v[0] = s.index;
+        ring.publish();
+    }
+}
+
+// The records read from from on are consecutive, consistent, start at first
+// and number count
+static int
+sample_check(const PLCSampleRing &ring, uint64_t from, uint64_t first, uint32_t count, ErrorHandler *errh)
+{
+    click_plc_sample out[64];
+    uint32_t k = ring.read(from, out, 64);
+    if (k != count) return errh->error("from %llu: %u records, not %u", (unsigned long long) from, k, count);
+    for (uint32_t i = 0; i < k; i++) {
+        CHECK(out[i].index == first + i);
+        CHECK(out[i].v[0] == out[i].index);
+    }
+    return 0;
+}
+
+static int
+test_sample_ring(ErrorHandler *errh)
+{
+    PLCSampleRing ring;
+    click_plc_sample out[64];
+    CHECK(ring.read(0, out, 64) == 0);
+    CHECK(ring.init(5));
+    CHECK(ring.depth() == 8);
+    CHECK(ring.read(0, out, 64) == 0);
+
+    // Partly filled: from 0 and 1 give all, past the newest none
+    sample_fill(ring, 3);
+    if (sample_check(ring, 0, 1, 3, errh) < 0 || sample_check(ring, 1, 1, 3, errh) < 0
+        || sample_check(ring, 3, 3, 1, errh) < 0 || sample_check(ring, 4, 0, 0, errh) < 0)
+        return -1;
+
+    // Wrapped: the record the writer would overwrite next is not returned,
+    // so a full ring gives depth - 1 records
+    sample_fill(ring, 20);
+    if (sample_check(ring, 0, 14, 7, errh) < 0 || sample_check(ring, 13, 14, 7, errh) < 0
+        || sample_check(ring, 14, 14, 7, errh) < 0 || sample_check(ring, 18, 18, 3, errh) < 0)
+        return -1;
+    CHECK(ring.read(0, out, 2) == 2 && out[0].index == 14 && out[1].index == 15);
+
+    // A record being written is not returned, nor is the one it replaces
+    click_plc_sample &s = ring.next();
+    CHECK(s.index == 21);
+    s.v[0] = 0xDEAD;
+    if (sample_check(ring, 0, 14, 7, errh) < 0)
+        return -1;
+    s.v[0] = s.index;
+    ring.publish();
+    if (sample_check(ring, 0, 15, 7, errh) < 0)
+        return -1;
+
+    // The depth is bounded, whatever SAMPLES asks for
+    CHECK(PLC_SAMPLE_MAX_DEPTH <= 0x80000000U);
+    return 0;
+}
+
+static int
+test_tick_clock(ErrorHandler *errh)
+{
+    const int64_t ms = 1000000;
+    PLCTickClock clock;
+    // The first tick starts from now
+    CHECK(clock.next_ns(0, 1000 * ms, 10) == 1010 * ms);
+    // A late hook does not move the next tick
+    CHECK(clock.next_ns(1010 * ms, 1013 * ms, 10) == 1020 * ms);
+    CHECK(clock.next_ns(1020 * ms, 1020 * ms, 10) == 1030 * ms);
+    CHECK(clock.skipped() == 0);
+    // Ticks missed by more than a period are skipped, not run in a burst
+    CHECK(clock.next_ns(1030 * ms, 1065 * ms, 10) == 1070 * ms);
+    CHECK(clock.skipped() == 3);
+    CHECK(clock.next_ns(1070 * ms, 1080 * ms, 10) == 1090 * ms);
+    CHECK(clock.skipped() == 4);
+    // A jump of the clock restarts from now
+    CHECK(clock.next_ns(1090 * ms, 100000 * ms, 10) == 100010 * ms);
+    CHECK(clock.ticks() == 6);
+    return 0;
+}
+
+int
+PLCTest::initialize(ErrorHandler *errh)
+{
+    if (test_archive_rle(errh) < 0 || test_archive_block(errh) < 0
+        || test_sample_ring(errh) < 0 || test_tick_clock(errh) < 0)
+        return -1;
+    errh->message("All tests pass!");
+    return 0;
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(PLCTest)
+ELEMENT_REQUIRES(userlevel)
@@ -0,0 +1,41 @@
+#ifndef CLICK_PLCTEST_HH
+#define CLICK_PLCTEST_HH
+#include <click/element.hh>
+CLICK_DECLS
+
+/*
+=c
+
+PLCTest()
+
+=s PLC
+
+Runs the regression tests of the PLC helpers
+
+=d
+
+This element routes no packets and does all its work at initialization
+time: it checks the self-contained code of the PLC headers on boundary and
+worst-case inputs, and fails the router with the first failed check. Run it
+with "click -e 'PLCTest()'"; it prints "All tests pass!" on success.
+
+Covered: the run-length code of the tonemap archive (PLCArchive.h), whose
+output must fit the bound its buffers are sized with, and the checks of the
+archive blocks; the sample ring and the tick clock of the high-frequency
+sampling (PLCSampler.h) at their boundaries.
+
+=a PLCTonemapArchive
+*/
+
+class PLCTest : public Element { public:
+
+    PLCTest();
+    ~PLCTest();
+
+    const char *class_name() const      { return "PLCTest"; }
+    const char *port_count() const      { return PORTS_0_0; }
+    int initialize(ErrorHandler *errh);
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,420 @@
+/*
+ * plctonemaparchive.{cc,hh} -- Compressed long-term archive of the tonemaps
+ *
+ * Tonemaps are coded as run-length coded XOR deltas in blocks per (peer,
+ * slot) stream (PLCArchive.h); every block written is indexed, so that a
+ * single tonemap is found by binary search and decoded from its block.
+ */
+
+#include <click/config.h>
+#include "plctonemaparchive.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/glue.hh>
+#include <click/straccum.hh>
+#include <click/timestamp.hh>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include "plcstore.hh"
+CLICK_DECLS
+
+static int
+archive_pwrite(int fd, const void *buf, size_t len, uint64_t offset)
+{
+    const uint8_t *b = (const uint8_t *) buf;
+    while (len > 0) {
+        ssize_t w = pwrite(fd, b, len, offset);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        b += w;
+        len -= w;
+        offset += w;
+    }
+    return 0;
+}
+
+static int
+archive_pread(int fd, void *buf, size_t len, uint64_t offset)
+{
+    uint8_t *b = (uint8_t *) buf;
+    while (len > 0) {
+        ssize_t r = pread(fd, b, len, offset);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        b += r;
+        len -= r;
+        offset += r;
+    }
+    return 0;
+}
+
+// Keeps the blocks of a stream in first_ns order for the binary search of
+// the lookups: a step back of the clock starts a block older than the
+// blocks already written
+static void
+insert_block(Vector<plc_archive_index> &blocks, const plc_archive_index &rec)
+{
+    blocks.push_back(rec);
+    int i = blocks.size() - 1;
+    for (; i > 0 && blocks[i - 1].first_ns > rec.first_ns; i--)
+        blocks[i] = blocks[i - 1];
+    blocks[i] = rec;
+}
+
+PLCTonemapArchive::PLCTonemapArchive()
+    : _block(64), _max_streams(64), _flush_sec(300), _fd(-1), _index_fd(-1),
+      _size(0), _index_size(0), _streams(0)
+{
+}
+
+PLCTonemapArchive::~PLCTonemapArchive()
+{
+}
+
+void *
+PLCTonemapArchive::cast(const char *name)
+{
+    if (strcmp(name, "PLCTonemapArchive") == 0)
+        return this;
+    else
+        return Element::cast(name);
+}
+
+int
+PLCTonemapArchive::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    if (Args(conf, this, errh).read_mp("FILENAME", FilenameArg(), _filename)
+                              .read("BLOCK", _block)
+                              .read("STREAMS", _max_streams)
+                              .read("FLUSH", _flush_sec)
+                              .complete() < 0)
+        return -1;
+    if (_block == 0 || _block > 4096)
+        return errh->error("BLOCK must be between 1 and 4096");
+    if (_max_streams == 0)
+        return errh->error("STREAMS must be positive");
+    if (_flush_sec == 0)
+        return errh->error("FLUSH must be positive");
+    return 0;
+}
+
+// Opens or creates a file of the archive; size is its current size
+int
+PLCTonemapArchive::open_file(const String &filename, uint32_t magic, int &fd, uint64_t &size, ErrorHandler *errh)
+{
+    fd = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+        return errh->error("%s: %s", filename.c_str(), strerror(errno));
+    plc_archive_header h;
+    if (st.st_size == 0) {
+        memset(&h, 0, sizeof(h));
+        h.magic = magic;
+        h.version = PLC_ARCHIVE_VERSION;
+        h.created_ns = Timestamp::now().nsecval();
+        if (archive_pwrite(fd, &h, sizeof(h), 0) < 0)
+            return errh->error("%s: %s", filename.c_str(), strerror(errno));
+        size = sizeof(h);
+        return 0;
+    }
+    if (archive_pread(fd, &h, sizeof(h), 0) < 0 || h.magic != magic || h.version != PLC_ARCHIVE_VERSION)
+        return errh->error("%s: not a tonemap archive of version %d", filename.c_str(), PLC_ARCHIVE_VERSION);
+    size = st.st_size;
+    return 0;
+}
+
+// Blocks of earlier runs. A block written without its index record (the
+// router stopped in between) is left as garbage in the data file.
+int
+PLCTonemapArchive::load_index(ErrorHandler *errh)
+{
+    uint32_t nrec = (_index_size - sizeof(plc_archive_header)) / sizeof(plc_archive_index);
+    uint64_t blocks = 0;
+    plc_archive_index rec;
+    for (uint32_t i = 0; i < nrec; i++) {
+        if (archive_pread(_index_fd, &rec, sizeof(rec), sizeof(plc_archive_header) + (uint64_t) i * sizeof(rec)) < 0)
+            return errh->error("%s.idx: %s", _filename.c_str(), strerror(errno));
+        if (rec.offset + rec.size > _size)
+            continue;
+        if (Stream *s = stream(stream_key(rec.peer, rec.slot), true)) {
+            insert_block(s->blocks, rec);
+            blocks++;
+        }
+    }
+    // A torn last record is overwritten by the next one
+    _index_size = sizeof(plc_archive_header) + (uint64_t) nrec * sizeof(plc_archive_index);
+    _stats.begin_write().blocks = blocks;
+    _stats.end_write();
+    return 0;
+}
+
+int
+PLCTonemapArchive::initialize(ErrorHandler *errh)
+{
+    if (!(_streams = new Stream[_max_streams]))
+        return errh->error("out of memory");
+    for (uint32_t i = 0; i < _max_streams; i++) {
+        _streams[i].key = 0;
+        _streams[i].block.count = 0;
+        _streams[i].entries = 0;
+        _streams[i].data = 0;
+    }
+    if (open_file(_filename, PLC_ARCHIVE_MAGIC, _fd, _size, errh) < 0
+        || open_file(_filename + ".idx", PLC_ARCHIVE_INDEX_MAGIC, _index_fd, _index_size, errh) < 0)
+        return -1;
+    return load_index(errh);
+}
+
+void
+PLCTonemapArchive::cleanup(CleanupStage)
+{
+    if (_streams) {
+        for (uint32_t i = 0; i < _max_streams; i++) {
+            if (_streams[i].block.count && _fd >= 0)
+                write_block(&_streams[i]);
+            delete[] _streams[i].entries;
+            delete[] _streams[i].data;
+        }
+        delete[] _streams;
+        _streams = 0;
+    }
+    if (_fd >= 0)
+        close(_fd);
+    if (_index_fd >= 0)
+        close(_index_fd);
+    _fd = _index_fd = -1;
+}
+
+uint64_t
+PLCTonemapArchive::stream_key(const uint8_t *peer, int slot)
+{
+    return (PLCStore::peer_key(peer) << 8 | slot) + 1;
+}
+
+PLCTonemapArchive::Stream *
+PLCTonemapArchive::stream(uint64_t key, bool create)
+{
+    for (uint32_t i = 0; i < _max_streams; i++) {
+        Stream *s = &_streams[i];
+        if (s->key == key)
+            return s;
+        if (s->key == 0) {
+            if (!create)
+                return 0;
+            // Published under the lock, as the lookups scan the keys
+            _lock.acquire();
+            s->key = key;
+            _lock.release();
+            _stats.begin_write().streams++;
+            _stats.end_write();
+            return s;
+        }
+    }
+    return 0;
+}
+
+void
+PLCTonemapArchive::write_block(Stream *s)
+{
+    plc_archive_block &h = s->block;
+    plc_archive_index rec;
+    memcpy(rec.peer, h.peer, 6);
+    rec.slot = h.slot;
+    rec.reserved = 0;
+    rec.count = h.count;
+    rec.size = sizeof(h) + h.count * sizeof(plc_archive_entry) + h.size;
+    rec.first_ns = h.first_ns;
+    rec.last_ns = s->last_ns;
+    rec.offset = _size;
+
+    ArchiveSnapshot &st = _stats.begin_write();
+    if (archive_pwrite(_fd, &h, sizeof(h), _size) < 0
+        || archive_pwrite(_fd, s->entries, h.count * sizeof(plc_archive_entry), _size + sizeof(h)) < 0
+        || archive_pwrite(_fd, s->data, h.size, _size + sizeof(h) + h.count * sizeof(plc_archive_entry)) < 0
+        || archive_pwrite(_index_fd, &rec, sizeof(rec), _index_size) < 0) {
+        click_chatter("[PLCTonemapArchive] %s: %s", _filename.c_str(), strerror(errno));
+        st.errors++;
+    }
+    else {
+        _size += rec.size;
+        _index_size += sizeof(rec);
+        _lock.acquire();
+        insert_block(s->blocks, rec);
+        _lock.release();
+        st.blocks++;
+    }
+    _stats.end_write();
+    h.count = 0;
+}
+
+void
+PLCTonemapArchive::add(const uint8_t *peer, int slot, uint64_t time_ns, const uint8_t *carriers, uint32_t ncarriers)
+{
+    if (_fd < 0 || ncarriers == 0)
+        return;
+    uint32_t nbytes = (ncarriers + 1) / 2;
+    if (nbytes > PLC_ARCHIVE_MAX_BYTES) {
+        nbytes = PLC_ARCHIVE_MAX_BYTES;
+        ncarriers = nbytes * 2;
+    }
+    Stream *s = stream(stream_key(peer, slot), true);
+    if (!s) {
+        _stats.begin_write().dropped++;
+        _stats.end_write();
+        return;
+    }
+    if (!s->entries) {
+        s->entries = new plc_archive_entry[_block];
+        s->data = new uint8_t[(size_t) _block * plc_archive_rle_bound(PLC_ARCHIVE_MAX_BYTES)];
+        if (!s->entries || !s->data)
+            return;
+    }
+
+    plc_archive_block &h = s->block;
+    if (h.count && (h.count == _block || h.ncarriers != ncarriers || time_ns < s->last_ns
+                    || time_ns - h.first_ns >= (uint64_t) _flush_sec * 1000000000))
+        write_block(s);
+    if (!h.count) {
+        memset(&h, 0, sizeof(h));
+        h.magic = PLC_ARCHIVE_BLOCK_MAGIC;
+        memcpy(h.peer, peer, 6);
+        h.slot = slot;
+        h.ncarriers = ncarriers;
+        h.nbytes = nbytes;
+        h.first_ns = time_ns;
+        memset(s->prev, 0, nbytes);
+    }
+
+    // Delta against the previous tonemap, which becomes this one. The high
+    // nibble past an odd last carrier is not a carrier.
+    uint8_t delta[PLC_ARCHIVE_MAX_BYTES];
+    for (uint32_t i = 0; i < nbytes; i++) {
+        uint8_t c = carriers[i];
+        if (i == nbytes - 1 && (ncarriers & 1))
+            c &= 0x0F;
+        delta[i] = c ^ s->prev[i];
+        s->prev[i] = c;
+    }
+    uint32_t len = plc_archive_rle_encode(s->data + h.size, delta, nbytes);
+    h.size += len;
+    s->entries[h.count].dt_ms = (time_ns - h.first_ns) / 1000000;
+    s->entries[h.count].end = h.size;
+    h.count++;
+    s->last_ns = time_ns;
+
+    ArchiveSnapshot &st = _stats.begin_write();
+    st.tonemaps++;
+    st.raw_bytes += nbytes;
+    st.coded_bytes += len + sizeof(plc_archive_entry);
+    _stats.end_write();
+}
+
+int
+PLCTonemapArchive::lookup(const String &arg, String &result, ErrorHandler *errh) const
+{
+    EtherAddress peer;
+    int slot;
+    Timestamp t = Timestamp::now();
+    if (Args(this, errh).push_back_words(arg)
+        .read_mp("PEER", peer)
+        .read_mp("SLOT", slot)
+        .read_p("TIME", t)
+        .complete() < 0)
+        return -1;
+    if (slot < 0 || slot > 255)
+        return errh->error("bad SLOT");
+
+    // Last block of the stream that starts at or before t
+    uint64_t key = stream_key(peer.data(), slot), t_ns = t.nsecval();
+    plc_archive_index rec;
+    bool found = false;
+    _lock.acquire();
+    for (uint32_t i = 0; i < _max_streams && _streams[i].key; i++)
+        if (_streams[i].key == key) {
+            const Vector<plc_archive_index> &b = _streams[i].blocks;
+            int lo = 0, hi = b.size();
+            while (lo < hi) {
+                int mid = (lo + hi) / 2;
+                if (b[mid].first_ns <= t_ns)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            if ((found = lo > 0))
+                rec = b[lo - 1];
+            break;
+        }
+    _lock.release();
+    if (!found)
+        return errh->error("no archived tonemap of %s in slot %d before %s", peer.unparse().c_str(), slot, t.unparse().c_str());
+
+    uint8_t *buf = new uint8_t[rec.size];
+    uint8_t tonemap[PLC_ARCHIVE_MAX_BYTES];
+    const plc_archive_block *h;
+    int k = -1;
+    bool ok = buf && archive_pread(_fd, buf, rec.size, rec.offset) == 0
+        && (h = plc_archive_check_block(buf, rec.size))
+        && (k = plc_archive_find(h, t_ns)) >= 0
+        && plc_archive_decode(h, k, tonemap);
+    if (ok) {
+        static const char hex[] = "0123456789ABCDEF";
+        StringAccum sa;
+        sa << "time " << Timestamp::make_nsec(h->first_ns + (uint64_t) plc_archive_entries(h)[k].dt_ms * 1000000)
+           << " peer " << peer.unparse() << " slot " << slot << " carriers " << h->ncarriers << "\n";
+        for (uint32_t i = 0; i < h->ncarriers; i++)
+            sa << hex[(tonemap[i >> 1] >> ((i & 1) << 2)) & 0x0F];
+        sa << "\n";
+        result = sa.take_string();
+    }
+    delete[] buf;
+    return ok ? 0 : errh->error("corrupt block at offset %llu", (unsigned long long) rec.offset);
+}
+
+String
+PLCTonemapArchive::read_stats() const
+{
+    ArchiveSnapshot st;
+    if (!_stats.read(st))
+        return String("busy\n");
+
+    StringAccum sa;
+    sa << "streams " << st.streams << "\n"
+       << "blocks " << st.blocks << "\n"
+       << "tonemaps " << st.tonemaps << "\n"
+       << "raw_bytes " << st.raw_bytes << "\n"
+       << "coded_bytes " << st.coded_bytes << "\n"
+       << "ratio " << (st.coded_bytes ? (double) st.raw_bytes / st.coded_bytes : 0) << "\n"
+       << "dropped " << st.dropped << "\n"
+       << "errors " << st.errors << "\n";
+    return sa.take_string();
+}
+
+static int
+tonemap_handler(int, String &data, Element *e, const Handler *, ErrorHandler *errh)
+{
+    return ((PLCTonemapArchive *) e)->lookup(data, data, errh);
+}
+
+static String
+stats_handler(Element *e, void *)
+{
+    return ((PLCTonemapArchive *) e)->read_stats();
+}
+
+void
+PLCTonemapArchive::add_handlers()
+{
+    set_handler("tonemap", Handler::f_read | Handler::f_read_param, tonemap_handler);
+    add_read_handler("stats", stats_handler);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(PLCTonemapArchive)
+ELEMENT_REQUIRES(userlevel)
@@ -0,0 +1,114 @@
+#ifndef CLICK_PLCTONEMAPARCHIVE_HH
+#define CLICK_PLCTONEMAPARCHIVE_HH
+#include <click/element.hh>
+#include <click/etheraddress.hh>
+#include <click/sync.hh>
+#include <click/vector.hh>
+#include "PLCArchive.h"
+#include "PLCSnapshot.h"
+CLICK_DECLS
+
+/*
+=c
+
+PLCTonemapArchive(FILENAME, [I<keywords> BLOCK, STREAMS, FLUSH])
+
+=s PLC
+
+Compressed long-term archive of the tonemaps
+
+=d
+
+Archives every tonemap that the TonemapReq elements given ARCHIVE (the name
+of this element) receive, for months of channel history. The tonemaps of a
+(peer, slot) stream are coded as XOR deltas against the previous one,
+run-length coded, in blocks of up to BLOCK tonemaps (default 64); a block is
+written to FILENAME when it is full, when the number of carriers changes, on
+the first tonemap FLUSH seconds (default 300) after it started, and at
+cleanup. Every written block is appended to the index FILENAME.idx. Existing
+files are appended to. STREAMS (default 64) is the number of streams kept;
+tonemaps of more streams are dropped and counted.
+
+The format is described in PLCArchive.h; tools/plcarchive.cc decodes whole
+ranges offline. There must be a single writer: all the TonemapReq elements
+of an archive run on the same thread.
+
+=h tonemap read-only with parameter
+
+"PEER SLOT [TIME]": the last archived tonemap of PEER in SLOT at or before
+the timestamp TIME (default now), as a line "time TIME peer PEER slot SLOT
+carriers N" and a line of N hexadecimal digits, the modulation of every
+carrier. Only blocks already written are searched.
+
+=h stats read-only
+
+Streams, blocks and tonemaps written, and the size of the tonemaps as
+received and as archived.
+
+=a TonemapReq
+*/
+
+// Published by PLCTonemapArchive after every tonemap
+struct ArchiveSnapshot {
+    uint32_t streams;
+    uint32_t dropped;           // Tonemaps of streams beyond STREAMS
+    uint32_t errors;            // Blocks that could not be written
+    uint32_t reserved;
+    uint64_t blocks;            // Written, including those of earlier runs
+    uint64_t tonemaps;          // Archived by this run
+    uint64_t raw_bytes;         // Nibble-packed size of these tonemaps
+    uint64_t coded_bytes;       // Their size once coded, with the entries
+};
+
+class PLCTonemapArchive : public Element { public:
+
+    PLCTonemapArchive();
+    ~PLCTonemapArchive();
+
+    const char *class_name() const      { return "PLCTonemapArchive"; }
+    const char *port_count() const      { return PORTS_0_0; }
+    void *cast(const char *name);
+    int configure(Vector<String> &, ErrorHandler *);
+    int initialize(ErrorHandler *errh);
+    void cleanup(CleanupStage);
+    void add_handlers();
+
+    // Archives a tonemap of peer in slot received at time_ns. Called by the
+    // TonemapReq elements on the writer thread.
+    void add(const uint8_t *peer, int slot, uint64_t time_ns, const uint8_t *carriers, uint32_t ncarriers);
+
+    int lookup(const String &arg, String &result, ErrorHandler *errh) const;
+    String read_stats() const;
+
+private:
+    struct Stream {
+        uint64_t key;               // Peer and slot, 0 if unused
+        plc_archive_block block;    // Open block, none if count is 0
+        uint64_t last_ns;
+        uint8_t prev[PLC_ARCHIVE_MAX_BYTES];
+        plc_archive_entry *entries;
+        uint8_t *data;
+        Vector<plc_archive_index> blocks;   // Written, by first_ns; guarded by _lock
+    };
+
+    String _filename;
+    uint32_t _block;
+    uint32_t _max_streams;
+    uint32_t _flush_sec;
+    int _fd;
+    int _index_fd;
+    uint64_t _size;
+    uint64_t _index_size;
+    Stream *_streams;
+    mutable Spinlock _lock;
+    PLCSnapshot<ArchiveSnapshot> _stats;
+
+    static uint64_t stream_key(const uint8_t *peer, int slot);
+    Stream *stream(uint64_t key, bool create);
+    int open_file(const String &filename, uint32_t magic, int &fd, uint64_t &size, ErrorHandler *errh);
+    int load_index(ErrorHandler *errh);
+    void write_block(Stream *s);
+};
+
+CLICK_ENDDECLS
+#endif
@@ -8,6 +8,14 @@
  * it activates the sniffer mode of the device by sending a management message.
  * Similarly, the destructor sends a management message that disables the sniffer mode
  * of the PLC device.
+ * For every link (STEI -> DTEI) the element keeps log-bucketed histograms of the
+ * bit-loading estimate and of the duration of the overheard MPDUs; the "histograms"
+ * handler prints them, so VERBOSE false can turn off the per-frame output.
+ * Counters and histograms are updated in place under a sequence lock, so the
+ * handlers read a consistent copy without ever blocking push().
+ * The bit-loading estimates also feed a matrix of the capacity between every
+ * pair of TEIs (PLCMatrix.h), read through the "matrix" and "path" handlers.
+ * With STATIONS, the TEIs are resolved to Ethernet addresses.
  * Christina Vlachou, 2016
  */
 
@@ -20,6 +28,9 @@
 CLICK_DECLS
 
 SniffPackets::SniffPackets()
+    : _chip(&PLCChipsetInfo<PLCDefaultChipset>::info), _verbose(true),
+      _links(0), _nlinks(64), _reset_pending(0), _store(0), _store_timer(this),
+      _correlator(0), _stations(0), _matrix_on(true), _matrix_gain(4)
 {
 }
 
@@ -38,124 +49,391 @@ SniffPackets::cast(const char *name)
 
 
 int
-SniffPackets::initialize(ErrorHandler *)
+SniffPackets::configure(Vector<String> &conf, ErrorHandler *errh)
 {
-    return enable_sniffer_mode();
+    String chipset = PLCDefaultChipset::name;
+    if (Args(conf, this, errh).read("CHIPSET", WordArg(), chipset)
+                              .read("VERBOSE", _verbose)
+                              .read("TELEMETRY", WordArg(), _telemetry_name)
+                              .read("STORE", ElementCastArg("PLCStore"), _store)
+                              .read("CORRELATOR", ElementCastArg("PLCCorrelator"), _correlator)
+                              .read("STATIONS", ElementCastArg("PLCStationTable"), _stations)
+                              .read("LINKS", _nlinks)
+                              .read("MATRIX", _matrix_on)
+                              .read("MATRIX_GAIN", _matrix_gain)
+                              .complete() < 0)
+        return -1;
+    if (!(_chip = plc_find_chipset(chipset)))
+        return errh->error("unknown CHIPSET %s", chipset.c_str());
+    if (_nlinks == 0 || (_nlinks & (_nlinks - 1)) || _nlinks > 65536)
+        return errh->error("LINKS must be a power of two up to 65536");
+    if (_matrix_gain > 16)
+        return errh->error("MATRIX_GAIN must be at most 16");
+    return 0;
 }
 
+int
+SniffPackets::initialize(ErrorHandler *errh)
+{
+    // With TELEMETRY, the link table lives in the segment after the snapshot
+    if (_telemetry_name) {
+        if (_telemetry.export_snapshot(_telemetry_name, PLC_TELEMETRY_SNIFFER, name(), _stats,
+                                       sizeof(SniffLinkStats) * _nlinks, errh) < 0)
+            return -1;
+        _links = (SniffLinkStats *) _telemetry.extra();
+    }
+    else if (!(_links = new SniffLinkStats[_nlinks]))
+        return errh->error("out of memory");
+    if (_matrix_on && !_matrix.init(_matrix_gain))
+        return errh->error("out of memory");
+    reset_histograms(_stats.begin_write());
+    _stats.end_write();
+    memset(_tei_frames, 0, sizeof(_tei_frames));
+    memset(_tei_frames_recorded, 0, sizeof(_tei_frames_recorded));
+    if (_store) {
+        _store_timer.initialize(this);
+        _store_timer.schedule_after_sec(1);
+    }
+    return enable_sniffer_mode();
+}
 
 void
-SniffPackets::push(int, Packet *p) {
+SniffPackets::cleanup(CleanupStage)
+{
+    if (!_telemetry.active())
+        delete[] _links;
+    _links = 0;
+    _telemetry.close(_stats);
+}
 
-    click_ether *eth_hdr = (click_ether *) p->data();
 
-    if(eth_hdr->ether_type == htons(ETHERTYPE_HP_AV)) {
-        click_hp_av_header *hpavh = (click_hp_av_header *) (eth_hdr + 1);
-        if(ntohs(hpavh->MMType) == SNIFFER_IND) {
-            click_hp_av_sniffer_indicate *hpavh_sniff = (click_hp_av_sniffer_indicate *) (hpavh + 1);
-            parse_plc_packet(hpavh_sniff);
-            p->kill();
+Packet *
+SniffPackets::handle(Packet *p)
+{
+    PLCMMEView mme(p);
+
+    if(mme.is_hpav() && mme.mmtype() == SNIFFER_IND) {
+        PLCSnifferIndView ind(mme);
+        SniffSnapshot &st = _stats.begin_write();
+        if (unlikely(_reset_pending) && __atomic_exchange_n(&_reset_pending, 0, __ATOMIC_ACQUIRE))
+            reset_histograms(st);
+        st.indications++;
+        if (ind.valid()) {
+            uint64_t now_ns = plc_now_ns();
+            _beacon_clock.update(now_ns, ind.since_beacon_ns(), ind.beacontime());
+            parse_plc_packet(ind, st, now_ns);
         }
         else
-            output(0).push(p);
+            st.malformed++;
+        uint32_t malformed = ind.valid() ? 0 : st.malformed;
+        _stats.end_write();
+        // Dropped and counted; printed on the 1st, 2nd, 4th, 8th... so that a
+        // device sending only short indications does not flood the log
+        if (malformed && !(malformed & (malformed - 1)))
+            click_chatter("[SniffPackets] Truncated sniffer indication of %u bytes (%u so far)",
+                          ind.length(), malformed);
+        p->kill();
+        return 0;
     }
-    else
+    return p;
+}
+
+void
+SniffPackets::push(int, Packet *p)
+{
+    if ((p = handle(p)))
         output(0).push(p);
+}
+
+#if HAVE_BATCH
+void
+SniffPackets::push_batch(int, PacketBatch *batch)
+{
+    plc_push_batch(output(0), batch, [this](Packet *p) { return handle(p); });
+}
+#endif
 
+SniffLinkStats *
+SniffPackets::lookup_link(uint8_t stei, uint8_t dtei) {
+    uint32_t key = ((stei << 8) | dtei) + 1;
+    uint32_t mask = _nlinks - 1;
+    for (uint32_t i = (key * 0x9E3779B1U) >> 16, n = 0; n < _nlinks; i++, n++) {
+        SniffLinkStats *l = &_links[i & mask];
+        if (l->key == key)
+            return l;
+        if (l->key == 0) {
+            l->key = key;
+            return l;
+        }
+    }
+    return 0;
 }
 
 void
-SniffPackets::parse_plc_packet(click_hp_av_sniffer_indicate *p) {
-    click_hp_av_fc fc = p->fc;
-    Timestamp _now;
-    _now.assign_now();
-    
-    if(fc.del_type == 0) { // beacon
+SniffPackets::parse_plc_packet(const PLCSnifferIndView &ind, SniffSnapshot &st, uint64_t now_ns) {
+    PLCFrameControlView fc = ind.fc();
+    uint8_t del_type = fc.del_type();
+    st.frames[del_type]++;
+
+    if (del_type == 1) { // data or management frames
+        uint32_t duration = fc.duration_usec();
+        uint32_t ble = fc.ble_q5();
+        _tei_frames[fc.stei()]++;
+        if (_correlator)
+            _correlator->add_mpdu(ind.since_beacon_ns(), fc.stei(), duration);
+        if (SniffLinkStats *l = lookup_link(fc.stei(), fc.dtei())) {
+            l->frames++;
+            l->ble.add(ble);
+            l->duration.add(duration);
+        }
+        else
+            st.link_overflow++;
+        if (_matrix.active())
+            _matrix.update(fc.stei(), fc.dtei(), ble, now_ns / 1000000000);
+
+        if (_verbose) {
+            Timestamp _now = Timestamp::now();
+            StringAccum stei, dtei;
+            unparse_tei(stei, fc.stei());
+            unparse_tei(dtei, fc.dtei());
+            click_chatter("[SniffPackets %s] The STA overheard MPDU from STEI %s to %s, duration %u, priority %d, bit-loading estimate %u, MPDU sequence in the burst %d.",
+                          _now.unparse().c_str(), stei.c_str(), dtei.c_str(), duration, (int) fc.lid(), ble >> 5, (int) fc.mpdu_cnt());
+        }
+        return;
+    }
+
+    if (!_verbose)
+        return;
+    Timestamp _now = Timestamp::now();
+    if(del_type == 0) { // beacon
         click_chatter("[SniffPackets %s] The STA overheard a beacon.", _now.unparse().c_str());
     }
-    else if (fc.del_type == 2) { // ACK
+    else if (del_type == 2) { // ACK
         click_chatter("[SniffPackets %s] The STA overheard an ACK.", _now.unparse().c_str());
     }
-    else if (fc.del_type == 3) { // RTS/CTS
+    else if (del_type == 3) { // RTS/CTS
         click_chatter("[SniffPackets %s] The STA overheard an RTS/CTS.", _now.unparse().c_str());
     }
-    else if (fc.del_type == 4) { // sounding message for channel estimation
+    else if (del_type == 4) { // sounding message for channel estimation
         click_chatter("[SniffPackets %s] The STA overheard a sounding message.", _now.unparse().c_str());
     }
-    else if (fc.del_type == 1) { // data or management frames
-        uint16_t frame_length = fc.fl_av * 1.28;
-        // Formula given by IEEE 1901 standard
-        uint16_t mant = fc.ble >> 3;
-        uint16_t exp = fc.ble & 7;
-
-        uint16_t ble = (32 + mant) * power(2, exp - 4) + power(2, exp - 5);
-        click_chatter("[SniffPackets %s] The STA overheard MPDU from STEI %d to %d, duration %d, priority %d, bit-loading estimate %d, MPDU sequence in the burst %d.",
-                                  _now.unparse().c_str(), (int) fc.stei, (int) fc.dtei, frame_length, (int) fc.lid, (int) ble, (int) fc.mpdu_cnt);
-    }
     else
-        click_chatter("[SniffPackets %s] The STA overheard an unknown message type.");
+        click_chatter("[SniffPackets %s] The STA overheard an unknown message type.", _now.unparse().c_str());
 }
 
-int 
-SniffPackets::enable_sniffer_mode() {
-    const unsigned char dst[6] = {0x00, 0xB0, 0x52, 0x00, 0x00, 0x01};
-    static_assert(Packet::default_headroom >= sizeof(click_ether));
-    WritablePacket *q = Packet::make(Packet::default_headroom - sizeof(click_ether),
-                                     NULL, sizeof(click_ether) + sizeof(click_hp_av_header) + sizeof(click_sniffer_request), 0);
-    if (!q) {
-        click_chatter("[SniffPackets] Cannot make packet!");
-        return -1;
+void
+SniffPackets::run_timer(Timer *t) {
+    Timestamp now = Timestamp::now();
+    uint8_t mac[6];
+    for (int tei = 0; tei < 256; tei++) {
+        uint32_t frames = __atomic_load_n(&_tei_frames[tei], __ATOMIC_RELAXED);
+        if (frames != _tei_frames_recorded[tei]) {
+            // Under the address of the station once its TEI is known
+            uint64_t peer = _stations && _stations->lookup(tei, mac) ? PLCStore::peer_key(mac) : PLCStore::tei_key(tei);
+            _store->record(PLC_METRIC_SNIFF_FRAMES, peer, now, frames - _tei_frames_recorded[tei]);
+            _tei_frames_recorded[tei] = frames;
+        }
     }
+    t->reschedule_after_sec(1);
+}
 
-    click_ether *e = (click_ether *) q->data();
-    q->set_ether_header(e);
-    memset(e->ether_shost, 0x00, 6);
-    memcpy(e->ether_dhost, dst, 6);
-    e->ether_type = htons(ETHERTYPE_HP_AV);
-    
-    click_hp_av_header *hpavh = (click_hp_av_header *) (e + 1);
-    hpavh->version = 0;
-    hpavh->MMType = htons(SNIFFER_REQ);
-
-    click_sniffer_request *hpavh_sniff = (click_sniffer_request *) (hpavh + 1);
-    const unsigned char oui[3] = {0x00, 0xB0, 0x52};
-    hpavh_sniff->control = HPAV_SC_ENABLE;
-    memcpy(hpavh_sniff->oui, oui, 3);
-    q->timestamp_anno().assign_now();
-    output(1).push(q);
+// The TEI, and the address of its station if known
+void
+SniffPackets::unparse_tei(StringAccum &sa, uint8_t tei) const {
+    uint8_t mac[6];
+    sa << (int) tei;
+    if (_stations && _stations->lookup(tei, mac))
+        sa << " (" << EtherAddress(mac).unparse() << ")";
+}
+
+bool
+SniffPackets::read_links(SniffSnapshot &st, SniffLinkStats *links) const {
+    // Link by link: a copy of the whole table, taken while indications
+    // arrive, would be torn by one of them nearly every time
+    if (!_stats.read(st))
+        return false;
+    for (uint32_t i = 0; i < _nlinks; i++)
+        if (!_stats.read_region(&_links[i], &links[i], sizeof(SniffLinkStats)))
+            return false;
+    return true;
+}
+
+String
+SniffPackets::read_stats() const {
+    SniffSnapshot st;
+    if (!_stats.read(st))
+        return String("busy\n");
+
+    static const char * const names[] = {"beacon", "mpdu", "ack", "rts_cts", "sounding", "type5", "type6", "type7"};
+    StringAccum sa;
+    sa << "indications " << st.indications << "\n"
+       << "malformed " << st.malformed << "\n";
+    for (int i = 0; i < 8; i++)
+        sa << names[i] << " " << st.frames[i] << "\n";
+    sa << "untracked " << st.link_overflow << "\n";
+    return sa.take_string();
+}
+
+String
+SniffPackets::read_histograms() const {
+    SniffSnapshot st;
+    SniffLinkStats *links = new SniffLinkStats[_nlinks];
+    if (!links || !read_links(st, links)) {
+        delete[] links;
+        return String("busy\n");
+    }
+
+    StringAccum sa;
+    for (uint32_t i = 0; i < _nlinks; i++) {
+        const SniffLinkStats &l = links[i];
+        if (l.key == 0)
+            continue;
+        sa << "link ";
+        unparse_tei(sa, (l.key - 1) >> 8);
+        sa << " ";
+        unparse_tei(sa, (l.key - 1) & 0xFF);
+        sa << " frames " << l.frames << "\n";
+        sa << "  ble_q5";
+        l.ble.unparse(sa);
+        sa << "\n  duration_us";
+        l.duration.unparse(sa);
+        sa << "\n";
+    }
+    if (st.link_overflow)
+        sa << "untracked " << st.link_overflow << "\n";
+    delete[] links;
+    return sa.take_string();
+}
+
+// Copy of the matrix, consistent row by row; 0 if busy
+PLCLinkCell *
+SniffPackets::copy_matrix() const {
+    PLCLinkCell *cells = new PLCLinkCell[PLC_MATRIX_TEIS * PLC_MATRIX_TEIS];
+    if (cells && !_matrix.copy(cells)) {
+        delete[] cells;
+        return 0;
+    }
+    return cells;
+}
+
+// "[MAXAGE]": the pairs heard within MAXAGE seconds (default 300)
+int
+SniffPackets::read_matrix(const String &arg, String &result, ErrorHandler *errh) const {
+    uint32_t maxage = 300;
+    if (Args(this, errh).push_back_words(arg).read_p("MAXAGE", maxage).complete() < 0)
+        return -1;
+    if (!_matrix.active())
+        return errh->error("MATRIX is off");
+    PLCLinkCell *cells = copy_matrix();
+    if (!cells)
+        return errh->error("busy");
+
+    uint32_t now = plc_now_ns() / 1000000000;
+    StringAccum sa;
+    for (int i = 0; i < PLC_MATRIX_TEIS * PLC_MATRIX_TEIS; i++)
+        if (cells[i].seen && now - cells[i].seen <= maxage) {
+            unparse_tei(sa, i >> 8);
+            sa << " ";
+            unparse_tei(sa, i & 0xFF);
+            sa << " ble_mbps " << PLCLinkMatrix::mbps(cells[i]) << " age " << (now - cells[i].seen) << "\n";
+        }
+    delete[] cells;
+    result = sa.take_string();
     return 0;
 }
 
-int 
-SniffPackets::disable_sniffer_mode() {
-    const unsigned char dst[6] = {0x00, 0xB0, 0x52, 0x00, 0x00, 0x01};
-    static_assert(Packet::default_headroom >= sizeof(click_ether));
-    WritablePacket *q = Packet::make(Packet::default_headroom - sizeof(click_ether),
-                                     NULL, sizeof(click_ether) + sizeof(click_hp_av_header) +sizeof(click_sniffer_request), 0);
-    if (!q) {
-        click_chatter("[SniffPackets] cannot make packet!");
+// "STEI DTEI [MAXAGE]": the capacity of the direct link and of the best
+// relay between two TEIs, from the pairs heard within MAXAGE seconds
+int
+SniffPackets::read_path(const String &arg, String &result, ErrorHandler *errh) const {
+    uint32_t stei, dtei, maxage = 300;
+    if (Args(this, errh).push_back_words(arg)
+        .read_mp("STEI", stei)
+        .read_mp("DTEI", dtei)
+        .read_p("MAXAGE", maxage)
+        .complete() < 0)
         return -1;
+    if (stei > 0xFE || dtei > 0xFE)
+        return errh->error("TEIs must be below 255");
+    if (!_matrix.active())
+        return errh->error("MATRIX is off");
+    PLCLinkCell *cells = copy_matrix();
+    if (!cells)
+        return errh->error("busy");
+
+    uint32_t now = plc_now_ns() / 1000000000;
+    for (int i = 0; i < PLC_MATRIX_TEIS * PLC_MATRIX_TEIS; i++)
+        if (cells[i].seen && now - cells[i].seen > maxage)
+            cells[i].ble = 0;
+    const PLCLinkCell &direct = cells[stei << 8 | dtei];
+    int relay = -1;
+    double best = 0;
+    for (uint32_t r = 1; r < 0xFF; r++)
+        if (r != stei && r != dtei) {
+            double c = PLCLinkMatrix::relay_mbps(cells[stei << 8 | r], cells[r << 8 | dtei]);
+            if (c > best) {
+                best = c;
+                relay = r;
+            }
+        }
+
+    StringAccum sa;
+    sa << "direct_mbps " << (direct.ble ? PLCLinkMatrix::mbps(direct) : 0) << "\n";
+    if (relay >= 0) {
+        sa << "relay ";
+        unparse_tei(sa, relay);
+        sa << " relay_mbps " << best << "\n";
     }
+    else
+        sa << "relay none\n";
+    delete[] cells;
+    result = sa.take_string();
+    return 0;
+}
 
-    click_ether *e = (click_ether *) q->data();
-    q->set_ether_header(e);
-    memset(e->ether_shost, 0x00, 6);
-    memcpy(e->ether_dhost, dst, 6);
-    e->ether_type = htons(ETHERTYPE_HP_AV);
+String
+SniffPackets::read_beacon_clock() const {
+    PLCBeaconClockState s;
+    if (!_beacon_clock.read(s))
+        return String("busy\n");
+    StringAccum sa;
+    sa << "beacons " << s.beacons << "\n"
+       << "period_us " << s.period_ns / 1000. << "\n"
+       << "last_beacon " << Timestamp::make_nsec(s.anchor_ns).unparse() << "\n"
+       << "updated " << Timestamp::make_nsec(s.updated_ns).unparse() << "\n";
+    return sa.take_string();
+}
 
-    click_hp_av_header *hpavh = (click_hp_av_header *) (e + 1);
-    hpavh->version = 0;
-    hpavh->MMType = htons(SNIFFER_REQ);
+void
+SniffPackets::reset_histograms(SniffSnapshot &st) {
+    memset(_links, 0, sizeof(SniffLinkStats) * _nlinks);
+    st.link_overflow = 0;
+}
 
-    click_sniffer_request *hpavh_sniff = (click_sniffer_request *) (hpavh + 1);
-    const unsigned char oui[3] = {0x00, 0xB0, 0x52};
-    hpavh_sniff->control = HPAV_SC_DISABLE;
-    memcpy(hpavh_sniff->oui, oui, 3);
+int 
+SniffPackets::send_sniffer_request(uint8_t control) {
+    WritablePacket *q = plc_make_mme(_chip, NULL, SNIFFER_REQ, true, sizeof(click_sniffer_request));
+    if (!q) {
+        click_chatter("[SniffPackets] Cannot make packet!");
+        return -1;
+    }
 
+    click_sniffer_request *hpavh_sniff = (click_sniffer_request *) (q->data() + PLCMMEView::header_size);
+    hpavh_sniff->control = control;
     output(1).push(q);
     return 0;
 }
 
+int 
+SniffPackets::enable_sniffer_mode() {
+    return send_sniffer_request(HPAV_SC_ENABLE);
+}
+
+int 
+SniffPackets::disable_sniffer_mode() {
+    return send_sniffer_request(HPAV_SC_DISABLE);
+}
+
 
 static String
 enable_sniffer_handler(Element *e, void *) {
@@ -174,10 +452,55 @@ disable_sniffer_handler(Element *e, void *) {
 }
 
 
+static String
+stats_handler(Element *e, void *) {
+    SniffPackets *elmt = (SniffPackets *)e;
+    return elmt->read_stats();
+}
+
+static String
+histograms_handler(Element *e, void *) {
+    SniffPackets *elmt = (SniffPackets *)e;
+    return elmt->read_histograms();
+}
+
+static String
+beacon_clock_handler(Element *e, void *) {
+    SniffPackets *elmt = (SniffPackets *)e;
+    return elmt->read_beacon_clock();
+}
+
+static int
+matrix_handler(int, String &data, Element *e, const Handler *, ErrorHandler *errh) {
+    return ((SniffPackets *) e)->read_matrix(data, data, errh);
+}
+
+static int
+path_handler(int, String &data, Element *e, const Handler *, ErrorHandler *errh) {
+    return ((SniffPackets *) e)->read_path(data, data, errh);
+}
+
+static int
+reset_histograms_handler(const String &, Element *e, void *, ErrorHandler *) {
+    SniffPackets *elmt = (SniffPackets *)e;
+    // Applied by push() so that the table keeps a single writer
+    elmt->request_reset();
+    return 0;
+}
+
+
 void SniffPackets::add_handlers() {
     add_read_handler("enable", enable_sniffer_handler);
     add_read_handler("disable", disable_sniffer_handler);
+    add_read_handler("stats", stats_handler);
+    add_read_handler("histograms", histograms_handler);
+    add_read_handler("beacon_clock", beacon_clock_handler);
+    set_handler("matrix", Handler::f_read | Handler::f_read_param, matrix_handler);
+    set_handler("path", Handler::f_read | Handler::f_read_param, path_handler);
+    add_write_handler("reset_histograms", reset_histograms_handler);
 }
 
 EXPORT_ELEMENT(SniffPackets)
+ELEMENT_REQUIRES(userlevel)
+ELEMENT_LIBS(-lrt)
 CLICK_ENDDECLS
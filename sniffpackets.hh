@@ -4,6 +4,17 @@
 #include <click/etheraddress.hh>
 #include <click/notifier.hh>
 #include "PLCStats.h"
+#include "PLCView.h"
+#include "PLCChipset.h"
+#include "PLCHistogram.h"
+#include "PLCMatrix.h"
+#include "PLCSnapshot.h"
+#include "PLCBatch.h"
+#include "PLCTelemetry.h"
+#include "PLCSync.h"
+#include "plcstore.hh"
+#include "plccorrelator.hh"
+#include "plcstationtable.hh"
 #include <click/args.hh>
 #include <clicknet/ether.h>
 #include <click/confparse.hh>
@@ -16,6 +27,23 @@
 
 CLICK_DECLS
 
+// Distributions of the MPDUs overheard on one link (STEI -> DTEI)
+struct SniffLinkStats {
+    uint32_t key;               // (stei << 8 | dtei) + 1, 0 if the entry is free
+    uint32_t frames;
+    PLCLogHistogram ble;        // Bit-loading estimate in 1/32 Mbps
+    PLCLogHistogram duration;   // Frame duration in us
+};
+
+// Published by SniffPackets after every sniffer indication, together with
+// the link table
+struct SniffSnapshot {
+    uint32_t indications;
+    uint32_t malformed;         // Indications too short for the parser, dropped
+    uint32_t frames[8];         // By delimiter type
+    uint32_t link_overflow;     // MPDUs of links that did not fit in the table
+};
+
 class SniffPackets : public Element { public:
 
     SniffPackets();
@@ -27,17 +55,65 @@ class SniffPackets : public Element { public:
     const char *flow_code() const       { return "x/xx"; }
     const char *flags() const           { return "L2"; }
     void *cast(const char *name);
+    int configure(Vector<String> &, ErrorHandler *);
     int initialize(ErrorHandler *errh);
+    void cleanup(CleanupStage);
     void push(int port, Packet *p);
+#if HAVE_BATCH
+    void push_batch(int port, PacketBatch *batch);
+#endif
     int enable_sniffer_mode();
     int disable_sniffer_mode();
 //    static String enable_sniffer_handler(Element *, void *);
 //    static String disable_sniffer_handler(Element *, void *);
     void add_handlers();
+    void run_timer(Timer *);
+    String read_stats() const;
+    String read_histograms() const;
+    int read_matrix(const String &arg, String &result, ErrorHandler *errh) const;
+    int read_path(const String &arg, String &result, ErrorHandler *errh) const;
+    void request_reset()                { __atomic_store_n(&_reset_pending, 1, __ATOMIC_RELEASE); }
+    const PLCBeaconClock *beacon_clock() const { return &_beacon_clock; }
+    String read_beacon_clock() const;
 
 
 private:
-    void parse_plc_packet(click_hp_av_sniffer_indicate *p);
+    const PLCChipset *_chip;
+    bool _verbose;
+
+    // Open-addressed table of links, _nlinks is a power of two. Written
+    // under _stats so that handlers read it consistently.
+    SniffLinkStats *_links;
+    uint32_t _nlinks;
+    PLCSnapshot<SniffSnapshot> _stats;
+    uint32_t _reset_pending;
+    String _telemetry_name;
+    PLCTelemetrySegment _telemetry;
+
+    // MPDUs sent per TEI, sampled into the store every second
+    PLCStore *_store;
+    Timer _store_timer;
+    uint32_t _tei_frames[256];
+    uint32_t _tei_frames_recorded[256];
+
+    PLCCorrelator *_correlator;
+    PLCBeaconClock _beacon_clock;
+    PLCStationTable *_stations;
+
+    // Capacity of every (STEI, DTEI) pair, written under _stats
+    bool _matrix_on;
+    uint32_t _matrix_gain;
+    PLCLinkMatrix _matrix;
+
+    Packet *handle(Packet *p);
+    SniffLinkStats *lookup_link(uint8_t stei, uint8_t dtei);
+    void reset_histograms(SniffSnapshot &st);
+    bool read_links(SniffSnapshot &, SniffLinkStats *) const;
+    PLCLinkCell *copy_matrix() const;
+    void unparse_tei(StringAccum &sa, uint8_t tei) const;
+
+    int send_sniffer_request(uint8_t control);
+    void parse_plc_packet(const PLCSnifferIndView &ind, SniffSnapshot &st, uint64_t now_ns);
 };
 
 CLICK_ENDDECLS
@@ -3,6 +3,8 @@
  *
  * This click element periodically sends tonemap requests for a specific slot and destination
  * and dumps the statistics.
+ * With SAMPLES, every reply is also kept as a binary record for polling at
+ * intervals down to the mains cycle (PLCSampler.h).
  * Christina Vlachou, 2016
 */
 #include <iostream>
@@ -18,6 +20,7 @@
 #include <click/packet_anno.hh>
 #include <clicknet/llc.h>
 #include <click/handlercall.hh>
+#include <click/confparse.hh>
 #include <click/straccum.hh>
 
 
@@ -25,12 +28,15 @@
 CLICK_DECLS
 
 #define TIMER_INTERVAL 1000 // timer interval in ms
-#define NUMBER_OF_SLOTS 6 // The number of tonemap slots according to IEEE 1901
-#define NUM_AVG_INTERVALS 23 // number of intervals to average for frequency response graph
-#define NUM_CAR_INTERVALS 40 // number of carriers per interval
+#define PLOT_WIDTH 23 // default number of bars of the frequency response plot
 
 TonemapReq::TonemapReq()
-     :_expire_timer_ms(this)
+     :_expire_timer_ms(this), _chip(&PLCChipsetInfo<PLCDefaultChipset>::info),
+      _process_tm_rep(&TonemapReq::processToneMapRep<PLCDefaultChipset>),
+      _send_tm_req(&TonemapReq::sendToneMapReq<PLCDefaultChipset>), _store(0), _archive(0),
+      _checkpoint_interval(10), _checkpoint_maxage(3600), _checkpoint_ms(0), _sync_timer(this),
+      _waterfall_depth(64), _slots((1 << NUMBER_OF_SLOTS) - 1), _interval_ms(TIMER_INTERVAL),
+      _requests_base(0), _verbose(true), _samples_depth(0)
 {
 }
 
@@ -49,10 +55,28 @@ TonemapReq::cast(const char *name)
 }
 
 int
-TonemapReq::initialize(ErrorHandler *)
+TonemapReq::initialize(ErrorHandler *errh)
 {
+    if (_telemetry_name
+        && _telemetry.export_snapshot(_telemetry_name, PLC_TELEMETRY_TONEMAP, name(), _stats, 0, errh) < 0)
+        return -1;
+    if (_checkpoint_name) {
+        if (_checkpoint.open(_checkpoint_name, PLC_TELEMETRY_TONEMAP, name(), _dst.data(), sizeof(TonemapSnapshot), errh) < 0)
+            return -1;
+        if (_checkpoint.restore(_stats, _checkpoint_maxage, errh))
+            click_chatter("[TonemapReq] Restored state from %s", _checkpoint_name.c_str());
+    }
+    if (_waterfall_depth && !_waterfall.init(NUMBER_OF_SLOTS, _waterfall_depth, _chip->max_carriers))
+        return errh->error("out of memory");
+    if (_samples_depth && !_samples.init(_samples_depth))
+        return errh->error("out of memory");
+    TonemapTarget t = {_dst, _slots, _interval_ms};
+    _target.init(t);
+    _switch.init(_dst);
+    _requests_base = _stats.data().requests;
     _expire_timer_ms.initialize(this);
-    _expire_timer_ms.schedule_after_msec(TIMER_INTERVAL);
+    _sync_timer.initialize(this);
+    _expire_timer_ms.schedule_after_msec(_interval_ms);
     return 0;
 }
 
@@ -60,169 +84,487 @@ TonemapReq::initialize(ErrorHandler *)
 int
 TonemapReq::configure(Vector<String> &conf, ErrorHandler *errh)
 {
-    return Args(conf, this, errh).read_m("SRC", _src)
-                                 .read_m("DST", _dst)
-                                 .complete();
+    String chipset = PLCDefaultChipset::name;
+    SniffPackets *sync = 0;
+    uint32_t sync_offset = 0, sync_baseline = 8;
+    if (Args(conf, this, errh).read_m("SRC", _src)
+                              .read_m("DST", _dst)
+                              .read("CHIPSET", WordArg(), chipset)
+                              .read("TELEMETRY", WordArg(), _telemetry_name)
+                              .read("STORE", ElementCastArg("PLCStore"), _store)
+                              .read("ARCHIVE", ElementCastArg("PLCTonemapArchive"), _archive)
+                              .read("CHECKPOINT", FilenameArg(), _checkpoint_name)
+                              .read("CHECKPOINT_INTERVAL", _checkpoint_interval)
+                              .read("CHECKPOINT_MAXAGE", _checkpoint_maxage)
+                              .read("SYNC", ElementCastArg("SniffPackets"), sync)
+                              .read("SYNC_OFFSET", sync_offset)
+                              .read("SYNC_BASELINE", sync_baseline)
+                              .read("WATERFALL", _waterfall_depth)
+                              .read("INTERVAL", _interval_ms)
+                              .read("CHANGE_THRESHOLD", _changes.params.threshold)
+                              .read("CHANGE_DRIFT", _changes.params.drift)
+                              .read("CHANGE_WARMUP", _changes.params.warmup)
+                              .read("SAMPLES", _samples_depth)
+                              .read("VERBOSE", _verbose)
+                              .complete() < 0)
+        return -1;
+    if (_changes.params.threshold <= 0)
+        return errh->error("CHANGE_THRESHOLD must be positive");
+    if (sync_offset >= 1000000)
+        return errh->error("SYNC_OFFSET must be below 1000000 us");
+    if (_samples_depth > PLC_SAMPLE_MAX_DEPTH)
+        return errh->error("SAMPLES must be at most %u", PLC_SAMPLE_MAX_DEPTH);
+    // Aligned requests leave once per beacon period, whatever INTERVAL is
+    if (_samples_depth && sync)
+        return errh->error("SAMPLES cannot be used with SYNC");
+    _sync.configure(sync ? sync->beacon_clock() : 0, sync_offset, sync_baseline);
+    if (_sync.check_interval(_interval_ms, errh) < 0)
+        return -1;
+
+    // Select the constants, the request builder and the reply parser of the chipset once
+    if (!plc_dispatch_chipset(chipset, [&](auto chip) {
+            typedef decltype(chip) Chip;
+            _chip = &PLCChipsetInfo<Chip>::info;
+            _process_tm_rep = &TonemapReq::processToneMapRep<Chip>;
+            _send_tm_req = &TonemapReq::sendToneMapReq<Chip>;
+        }, PLCChipsets()))
+        return errh->error("unknown CHIPSET %s", chipset.c_str());
+    return 0;
 }
 
 void
 TonemapReq::run_timer(Timer *t)
 {   
+    if (t == &_sync_timer) {
+        send_requests(true);
+        return;
+    }
+    // Settings written by the handlers since the last tick
+    TonemapTarget target;
+    if (_target.take(target))
+        apply(target);
     // Get statistics for PLC rates. Send the management message with request.
+    Timestamp at;
+    if (_sync_timer.scheduled())
+        _sync.skip();
+    else if (_sync.schedule(at))
+        _sync_timer.schedule_at(at);
+    else
+        send_requests(false);
+    _checkpoint_ms += _interval_ms;
+    // Not while the state is still that of the previous DST
+    if (_checkpoint.active() && _checkpoint_ms >= _checkpoint_interval * 1000 && _switch.settled()) {
+        _checkpoint.save(_stats);
+        _checkpoint_ms = 0;
+    }
+    // A period after the previous tick, not after this hook
+    t->schedule_at(_clock.next(t->expiry(), _interval_ms));
+}
+
+void
+TonemapReq::send_requests(bool aligned)
+{
     for (int s = 0; s < NUMBER_OF_SLOTS; s++)
-        sendToneMapReq(s);
-    t->schedule_after_msec(TIMER_INTERVAL);
+        if (_slots & (1 << s)) {
+            _sync.sent(s, aligned);
+            (this->*_send_tm_req)(s);
+        }
 }
 
+void
+TonemapReq::apply(const TonemapTarget &t)
+{
+    if (t.dst != _dst) {
+        click_chatter("[TonemapReq] Now polling %s", t.dst.unparse().c_str());
+        _checkpoint.set_peer(t.dst.data());
+        // The push side resets the state of the previous peer
+        _switch.change(t.dst, Timestamp::now().nsecval());
+    }
+    _dst = t.dst;
+    _slots = t.slots;
+    _interval_ms = t.interval_ms;
+}
+
+// Push side, on the first reply after a change of DST
+void
+TonemapReq::reset_peer()
+{
+    plc_reset_tonemap_peer(_stats.begin_write());
+    _stats.end_write();
+    // The rates of the new peer are a new baseline, not a change
+    for (int i = 0; i < NUMBER_OF_SLOTS; i++)
+        _change_slots[i].reset();
+}
 
 void
-TonemapReq::push(int port,Packet *p)
-{	
-    click_ether *e = (click_ether *) p->data();
-    click_hp_av_header *hpavh = (click_hp_av_header *) (e + 1);
+TonemapReq::cleanup(CleanupStage stage)
+{
+    // Keep the replies received since the last periodic checkpoint
+    if (stage >= CLEANUP_INITIALIZED && _checkpoint.active() && _switch.settled())
+        _checkpoint.save(_stats);
+    _checkpoint.close();
+    // Unmap and remove the telemetry object
+    _telemetry.close(_stats);
+}
+
 
-    if((e->ether_type == htons(ETHERTYPE_HP_AV)) && (hpavh->MMType == htons(TONE_MAP_REP))) {
-        processToneMapRep((click_hp_av_tone_map_rep*)(hpavh + 1));
+Packet *
+TonemapReq::handle(Packet *p)
+{
+    PLCMMEView mme(p);
+
+    if(mme.is_hpav() && (mme.mmtype() == TONE_MAP_REP)) {
+        PLCToneMapRepView tm_rep(mme);
+        bool changed;
+        bool current = _switch.reply(Timestamp::now().nsecval(), changed);
+        if (changed)
+            reset_peer();
+        if (!current) {
+            // Answers a request sent to the previous DST
+            if (_verbose)
+                click_chatter("[TonemapReq] Dropped a reply for the previous DST");
+        }
+        else if (tm_rep.valid()) {
+            _sync.replied(tm_rep.tmslot());
+            (this->*_process_tm_rep)(tm_rep);
+        }
+        else {
+            click_chatter("[TonemapReq] Truncated tonemap reply of %u bytes", tm_rep.length());
+            _stats.begin_write().malformed++;
+            _stats.end_write();
+        }
         p->kill();
+        return 0;
     }
-    else 
+    return p;
+}
+
+void
+TonemapReq::push(int, Packet *p)
+{
+    if ((p = handle(p)))
         output(0).push(p);
 }
 
+#if HAVE_BATCH
+void
+TonemapReq::push_batch(int, PacketBatch *batch)
+{
+    plc_push_batch(output(0), batch, [this](Packet *p) { return handle(p); });
+}
+#endif
+
 
+template <typename Chip>
 void
 TonemapReq::sendToneMapReq(int slot){
-    const unsigned char dst[6] = {0x00, 0xB0, 0x52, 0x00, 0x00, 0x01};
-
-    static_assert(Packet::default_headroom >= sizeof(click_ether));
-    WritablePacket *q = Packet::make(Packet::default_headroom,
-            NULL, sizeof(click_ether) + sizeof(click_hp_av_header) + sizeof(click_hp_av_tone_map_req), 0);
+    WritablePacket *q = plc_make_tone_map_req(&PLCChipsetInfo<Chip>::info, _src.data(), _dst.data(), slot);
     if (!q) {
         click_chatter("TonemapReq: cannot make packet!");
         return;
     }
-
-    click_ether *e = (click_ether *) q->data();
-    q->set_ether_header(e);
-    memcpy(e->ether_shost, &_src, 6);
-    memcpy(e->ether_dhost, dst, 6);
-    e->ether_type = htons(ETHERTYPE_HP_AV);
-
-    click_hp_av_header *hpav = (click_hp_av_header *) (e + 1);
-    hpav->version = 0;
-    hpav->MMType = htons(TONE_MAP_REQ);
-
-
-    click_hp_av_tone_map_req *tm_req = (click_hp_av_tone_map_req *) (hpav + 1);
-    memcpy(tm_req->macaddr, &_dst, 6);
-    tm_req->tmslot = slot;
-    const unsigned char oui[3] = {0x00, 0xB0, 0x52};
-    memcpy(tm_req->oui, oui, 3);
-    q->timestamp_anno().assign_now();
+    // Counted in the snapshot by the push side, its only writer
+    _switch.sent();
     output(1).push(q); 
 }
 
 
+template <typename Chip>
 void
-TonemapReq::processToneMapRep(click_hp_av_tone_map_rep *tm_rep){
-    uint16_t max_carriers;
+TonemapReq::processToneMapRep(const PLCToneMapRepView &tm_rep){
     double plc_rate;
 
+    TonemapSnapshot &st = _stats.begin_write();
+    st.requests = _requests_base + _switch.requests();
+    plc_count_tonemap_reply(st, tm_rep);
+    _stats.end_write();
 
-    switch (tm_rep->mstatus) {
+    switch (tm_rep.mstatus()) {
     case 0x00:
-      click_chatter("[TonemapReq] Status: Success");
+      if (_verbose)
+          click_chatter("[TonemapReq] Status: Success");
       break;
     case 0x01:
-      click_chatter("[TonemapReq] Status: Unknown MAC address");
+      if (_verbose)
+          click_chatter("[TonemapReq] Status: Unknown MAC address");
       return;
       break;
     case 0x02:
-      click_chatter("[TonemapReq] Status: Unknown Tonemap slot");
+      if (_verbose)
+          click_chatter("[TonemapReq] Status: Unknown Tonemap slot");
       return;
       break;
     }
-    click_chatter("[TonemapReq] Tonemap slot: %d", tm_rep->tmslot);
-    click_chatter("[TonemapReq] Number of tone maps: %d", tm_rep->num_tms);
-    click_chatter("[TonemapReq] Tonemap number of active carriers: %d", tm_rep->tm_num_act_carrier);
+    if (_verbose) {
+        click_chatter("[TonemapReq] Tonemap slot: %d", tm_rep.tmslot());
+        click_chatter("[TonemapReq] Number of tone maps: %d", tm_rep.num_tms());
+        click_chatter("[TonemapReq] Tonemap number of active carriers: %d", tm_rep.num_act_carrier());
+    }
+
+    uint32_t ncarriers = plc_min(tm_rep.ncarriers(), Chip::max_carriers);
+    if (ncarriers == 0)
+        return;
+
+    plc_rate = plc_tonemap_rate<Chip>(tm_rep);
+
+    if (_verbose)
+        click_chatter("[TonemapReq] PHY rate: %f", plc_rate);
+
+    if (tm_rep.tmslot() < NUMBER_OF_SLOTS) {
+        Timestamp now = Timestamp::now();
+        if (_samples.active()) {
+            uint64_t before = _stats.data().slots[tm_rep.tmslot()].updated_ns;
+            click_plc_sample &s = _samples.next();
+            s.time_ns = now.nsecval();
+            s.delta_us = before ? (now.nsecval() - before) / 1000 : 0;
+            s.kind = PLC_SAMPLE_TONEMAP;
+            s.slot = tm_rep.tmslot();
+            s.status = tm_rep.mstatus();
+            s.flags = 0;
+            memset(s.v, 0, sizeof(s.v));
+            s.v[0] = plc_rate * 1000;
+            s.v[1] = tm_rep.num_act_carrier();
+            s.v[2] = tm_rep.num_tms();
+            _samples.publish();
+        }
+        if (_store)
+            _store->record(PLC_METRIC_TM_RATE0 + tm_rep.tmslot(), PLCStore::peer_key(_switch.dst()), now, plc_rate);
+        plc_update_tonemap_slot(_stats.begin_write(), tm_rep, plc_rate, now.nsecval());
+        _stats.end_write();
+        // Kept as received; the spectra are computed by the handlers
+        _waterfall.add(tm_rep.tmslot(), _switch.dst().data(), now.nsecval(), tm_rep.carriers(), ncarriers);
+        if (_archive)
+            _archive->add(_switch.dst().data(), tm_rep.tmslot(), now.nsecval(), tm_rep.carriers(), ncarriers);
+        _changes.update(this, 2, _change_slots[tm_rep.tmslot()], PLC_METRIC_TM_RATE0 + tm_rep.tmslot(),
+                        _switch.dst().data(), plc_rate, 1, now.nsecval());
+    }
+}
 
 
-    max_carriers = tm_rep->tm_num_act_carrier / 2;
-    if (tm_rep->tm_num_act_carrier & 1)
-       max_carriers += 1;
 
-    uint32_t sum_bit_per_carrier = 0;
-    int modulation_stats[NUM_AVG_INTERVALS] = {};
+String
+TonemapReq::read_stats() const
+{
+    TonemapSnapshot st;
+    if (!_stats.read(st))
+        return String("busy\n");
+    st.requests = _requests_base + _switch.requests();
+
+    StringAccum sa;
+    sa << "dst " << _target.active().dst.unparse() << "\n";
+    plc_unparse_tonemap(sa, st);
+    sa << "stale " << _switch.dropped() << "\n";
+    return sa.take_string();
+}
 
-    for (int i = 0; i < max_carriers * 2; i = i + 2) {
-        int low_carr = get_carrier_modulation(tm_rep->carriers[i / 2].mod_carrier_lo);
-        int high_carr = get_carrier_modulation(tm_rep->carriers[i / 2].mod_carrier_hi);
-        sum_bit_per_carrier += low_carr + high_carr;
-        if ((i + 1) / NUM_CAR_INTERVALS < NUM_AVG_INTERVALS)  {
-            modulation_stats[ i / NUM_CAR_INTERVALS ] += low_carr;
-            modulation_stats[ (i + 1) / NUM_CAR_INTERVALS ] += high_carr;       
-        }
-        else
-           modulation_stats[NUM_AVG_INTERVALS - 1] += (low_carr + high_carr); 
+enum { h_dst, h_slots, h_interval };
+
+String
+TonemapReq::read_target(int what) const
+{
+    TonemapTarget t = _target.active();
+    switch (what) {
+    case h_dst:
+        return t.dst.unparse();
+    case h_slots: {
+        StringAccum sa;
+        for (int s = 0; s < NUMBER_OF_SLOTS; s++)
+            if (t.slots & (1 << s))
+                sa << (sa.length() ? " " : "") << s;
+        return sa.take_string();
     }
-    // Effective symbol duration and guard interval used by most HPAV devices
-    double symbol_duration = 40.96 + 5.56;
-    // Multiply FEC rate with total bits per symbol and devide by symbol duration in \mu s
-    plc_rate = (double) 16 / 21 * (double) sum_bit_per_carrier / symbol_duration;
-
-    click_chatter("[TonemapReq] PHY rate: %f", plc_rate);
-    print_frequency_response(modulation_stats, max_carriers);
-}
-
-
-
-uint8_t TonemapReq::get_carrier_modulation(short unsigned int modulation)
-{
-    switch(modulation) {
-    case NO:
-      return 0;
-    case BPSK:
-      return 1;
-    case QPSK:
-      return 2;
-    case QAM_8:
-      return 3;
-    case QAM_16:
-      return 4;
-    case QAM_64:
-      return 6;
-    case QAM_256:
-      return 8;
-    case QAM_1024:
-      return 10;
     default:
-      return 0;
+        return String(t.interval_ms);
     }
 }
 
-void
-TonemapReq::print_frequency_response(int * modulation_stats, int max_carriers) {
-    // First compute average bits per symbol, per NUM_CAR_INTERVALS carriers
-    for (int i = 0; i < NUM_AVG_INTERVALS - 1; i++) 
-        modulation_stats[i] = modulation_stats[i] / NUM_CAR_INTERVALS;
-    modulation_stats[NUM_AVG_INTERVALS - 1] = modulation_stats[NUM_AVG_INTERVALS - 1] / ((max_carriers *2 - 1) % NUM_CAR_INTERVALS);
-
-   // Now plot an approximate frequency response based on tonemaps
-    for (int i = MAX_BITS_PER_CARRIER; i > 0; i--) {
-        StringAccum modul_line;
-        for (int j = 0; j < NUM_AVG_INTERVALS; j++) {
-            if (modulation_stats[j] >= i)
-                modul_line << "|  ";
-            else
-                modul_line << "   ";
+// Stages the new value; it is used from the next poll on
+int
+TonemapReq::reconfigure(int what, const String &str, ErrorHandler *errh)
+{
+    String s = cp_uncomment(str);
+    return _target.modify([&](TonemapTarget &t) {
+        switch (what) {
+        case h_dst:
+            return Args(this, errh).push_back_words(s).read_mp("DST", t.dst).complete();
+        case h_slots: {
+            // "all" or a list of slot numbers
+            Vector<String> words;
+            cp_spacevec(s, words);
+            t.slots = 0;
+            for (int i = 0; i < words.size(); i++) {
+                int slot;
+                if (words[i] == "all")
+                    t.slots = (1 << NUMBER_OF_SLOTS) - 1;
+                else if (IntArg().parse(words[i], slot) && slot >= 0 && slot < NUMBER_OF_SLOTS)
+                    t.slots |= 1 << slot;
+                else
+                    return errh->error("bad tonemap slot %s", words[i].c_str());
+            }
+            return t.slots ? 0 : errh->error("no tonemap slot");
+        }
+        default:
+            if (Args(this, errh).push_back_words(s).read_mp("INTERVAL", t.interval_ms).complete() < 0)
+                return -1;
+            return _sync.check_interval(t.interval_ms, errh);
         }
-        String linetoprint = modul_line.take_string();
-        click_chatter(linetoprint.c_str());
+    });
+}
+
+static String
+stats_handler(Element *e, void *)
+{
+    return ((TonemapReq *) e)->read_stats();
+}
+
+// Parses "[SLOT] [RES] [FORMAT] [SINCE] [PEER addr]" of the spectrum handlers;
+// PEER defaults to the DST polled
+int
+TonemapReq::read_spectrum(const String &arg, String &result, bool all, ErrorHandler *errh) const
+{
+    int slot = 0;
+    uint32_t res = 1;
+    String format = "csv";
+    Timestamp since;
+    EtherAddress peer = _target.active().dst;
+    Args args(this, errh);
+    args.push_back_words(arg).read_p("SLOT", slot).read_p("RES", res).read_p("FORMAT", WordArg(), format);
+    if (all)
+        args.read_p("SINCE", since);
+    args.read("PEER", peer);
+    if (args.complete() < 0)
+        return -1;
+    if (slot < 0 || slot >= NUMBER_OF_SLOTS)
+        return errh->error("SLOT must be between 0 and %d", NUMBER_OF_SLOTS - 1);
+    if (res == 0 || res > 0xFFFF)
+        return errh->error("RES must be between 1 and 65535");
+    bool binary = (format == "binary");
+    if (!binary && format != "csv")
+        return errh->error("FORMAT must be csv or binary");
+    if (!_waterfall.active())
+        return errh->error("no waterfall, WATERFALL is 0");
+
+    PLCWaterfallEntry e;
+    uint8_t carriers[(PLC_MAX_CARRIERS + 1) / 2];
+    uint64_t newest = _waterfall.newest(slot), oldest = _waterfall.oldest(slot);
+    if (!all) {
+        // The last tonemap of the peer, which may be older than the last one
+        for (; newest && newest >= oldest; newest--)
+            if (_waterfall.read(slot, newest, e, carriers) && memcmp(e.peer, peer.data(), 6) == 0)
+                break;
+        oldest = newest;
+    }
+    StringAccum sa;
+    for (uint64_t i = oldest; i && i <= newest; i++) {
+        if (!_waterfall.read(slot, i, e, carriers) || memcmp(e.peer, peer.data(), 6) != 0
+            || (since && e.time_ns <= (uint64_t) since.nsecval()))
+            continue;
+        if (binary)
+            plc_unparse_spectrum_binary(sa, e, carriers, res);
+        else
+            plc_unparse_spectrum_csv(sa, e, carriers, res);
+    }
+    result = sa.take_string();
+    return 0;
+}
+
+int
+TonemapReq::read_plot(const String &arg, String &result, ErrorHandler *errh) const
+{
+    int slot = 0;
+    uint32_t width = PLOT_WIDTH;
+    EtherAddress peer = _target.active().dst;
+    if (Args(this, errh).push_back_words(arg)
+                        .read_p("SLOT", slot)
+                        .read_p("WIDTH", width)
+                        .read("PEER", peer)
+                        .complete() < 0)
+        return -1;
+    if (slot < 0 || slot >= NUMBER_OF_SLOTS)
+        return errh->error("SLOT must be between 0 and %d", NUMBER_OF_SLOTS - 1);
+
+    PLCWaterfallEntry e;
+    uint8_t carriers[(PLC_MAX_CARRIERS + 1) / 2];
+    uint64_t i = _waterfall.newest(slot), oldest = _waterfall.oldest(slot);
+    for (; i && i >= oldest; i--)
+        if (_waterfall.read(slot, i, e, carriers) && memcmp(e.peer, peer.data(), 6) == 0)
+            break;
+    if (!i || i < oldest)
+        return errh->error("no tonemap of %s for slot %d", peer.unparse().c_str(), slot);
+    StringAccum sa;
+    plc_unparse_spectrum_plot(sa, e, carriers, width);
+    result = sa.take_string();
+    return 0;
+}
+
+static String
+latency_handler(Element *e, void *)
+{
+    return ((TonemapReq *) e)->read_latency();
+}
+
+static String
+events_handler(Element *e, void *)
+{
+    return ((TonemapReq *) e)->read_events();
+}
+
+static int
+spectrum_handler(int, String &data, Element *e, const Handler *h, ErrorHandler *errh)
+{
+    return ((TonemapReq *) e)->read_spectrum(data, data, h->read_user_data() != 0, errh);
+}
+
+static int
+plot_handler(int, String &data, Element *e, const Handler *, ErrorHandler *errh)
+{
+    return ((TonemapReq *) e)->read_plot(data, data, errh);
+}
+
+static int
+samples_handler(int, String &data, Element *e, const Handler *, ErrorHandler *errh)
+{
+    return ((TonemapReq *) e)->read_samples(data, data, errh);
+}
+
+static String
+sampling_handler(Element *e, void *)
+{
+    return ((TonemapReq *) e)->read_sampling();
+}
+
+static String
+read_target_handler(Element *e, void *user_data)
+{
+    return ((TonemapReq *) e)->read_target((intptr_t) user_data);
+}
+
+static int
+reconfigure_handler(const String &str, Element *e, void *user_data, ErrorHandler *errh)
+{
+    return ((TonemapReq *) e)->reconfigure((intptr_t) user_data, str, errh);
+}
+
+void
+TonemapReq::add_handlers()
+{
+    add_read_handler("stats", stats_handler);
+    add_read_handler("latency", latency_handler);
+    add_read_handler("events", events_handler);
+    set_handler("spectrum", Handler::f_read | Handler::f_read_param, spectrum_handler, 0);
+    set_handler("waterfall", Handler::f_read | Handler::f_read_param, spectrum_handler, (void *) 1);
+    set_handler("plot", Handler::f_read | Handler::f_read_param, plot_handler);
+    add_read_handler("sampling", sampling_handler);
+    set_handler("samples", Handler::f_read | Handler::f_read_param, samples_handler);
+    static const char * const names[] = {"dst", "slots", "interval"};
+    for (int i = h_dst; i <= h_interval; i++) {
+        add_read_handler(names[i], read_target_handler, i);
+        add_write_handler(names[i], reconfigure_handler, i);
     }
-    click_chatter("----------------------------------------------------------------->");
-    click_chatter("                          Frequency                               ");
 }
 
 CLICK_ENDDECLS
 EXPORT_ELEMENT(TonemapReq)
+ELEMENT_REQUIRES(userlevel)
+ELEMENT_LIBS(-lrt)
 
@@ -6,9 +6,30 @@
 #include <click/sync.hh>
 #include <click/timer.hh>
 #include "PLCStats.h"
+#include "PLCView.h"
+#include "PLCChipset.h"
+#include "PLCSnapshot.h"
+#include "PLCBatch.h"
+#include "PLCPoll.h"
+#include "PLCTelemetry.h"
+#include "PLCCheckpoint.h"
+#include "PLCSync.h"
+#include "PLCWaterfall.h"
+#include "PLCReconfig.h"
+#include "PLCChange.h"
+#include "PLCSampler.h"
+#include "plcstore.hh"
+#include "plctonemaparchive.hh"
+#include "sniffpackets.hh"
 
 CLICK_DECLS
 
+// Settings that the write handlers change at run time
+struct TonemapTarget {
+    EtherAddress dst;
+    uint32_t slots;             // Bitmask of the tonemap slots polled
+    uint32_t interval_ms;
+};
 
 class TonemapReq : public Element { public:
 
@@ -19,22 +40,70 @@ class TonemapReq : public Element { public:
     EtherAddress _dst;
 
     const char *class_name() const	{ return "TonemapReq"; }
-    const char *port_count() const	{ return "1/2"; }
+    const char *port_count() const	{ return "1/2-3"; }
     const char *processing() const	{ return PUSH; }
     void *cast(const char *name);
     void run_timer(Timer *);
     int initialize(ErrorHandler *errh);
+    void cleanup(CleanupStage);
     int configure(Vector<String> &, ErrorHandler *);
     void push(int,Packet *);
-    //void add_handlers();
+#if HAVE_BATCH
+    void push_batch(int port, PacketBatch *batch);
+#endif
+    void add_handlers();
+    String read_stats() const;
+    String read_latency() const        { return _sync.unparse(); }
+    int read_spectrum(const String &arg, String &result, bool all, ErrorHandler *errh) const;
+    int read_plot(const String &arg, String &result, ErrorHandler *errh) const;
+    String read_target(int what) const;
+    String read_events() const          { return _changes.unparse(); }
+    int read_samples(const String &arg, String &result, ErrorHandler *errh) const {
+        return _samples.unparse(this, arg, result, errh);
+    }
+    String read_sampling() const        { return plc_unparse_sampling(_target.active().interval_ms, _clock, _samples); }
+    int reconfigure(int what, const String &str, ErrorHandler *errh);
 
 private:
     Timer _expire_timer_ms;
+    const PLCChipset *_chip;
+    // processToneMapRep instantiated for the configured chipset
+    void (TonemapReq::*_process_tm_rep)(const PLCToneMapRepView &);
+    // sendToneMapReq instantiated for the configured chipset
+    void (TonemapReq::*_send_tm_req)(int);
+    PLCSnapshot<TonemapSnapshot> _stats;
+    String _telemetry_name;
+    PLCTelemetrySegment _telemetry;
+    PLCStore *_store;
+    PLCTonemapArchive *_archive;
+    String _checkpoint_name;
+    uint32_t _checkpoint_interval;  // Seconds
+    uint32_t _checkpoint_maxage;    // Seconds, 0 for no limit
+    uint32_t _checkpoint_ms;        // Polled since the last checkpoint
+    PLCCheckpoint _checkpoint;
+    PLCRequestSync _sync;
+    Timer _sync_timer;             // Sends the requests of a poll at the aligned time
+    uint32_t _waterfall_depth;     // Tonemaps kept per slot
+    PLCWaterfall _waterfall;
+    uint32_t _slots;
+    uint32_t _interval_ms;
+    PLCStaged<TonemapTarget> _target;
+    PLCPeerSwitch _switch;
+    uint32_t _requests_base;       // Requests restored from the checkpoint
+    PLCChangeEvents _changes;
+    PLCChangeDetector _change_slots[NUMBER_OF_SLOTS];
+    bool _verbose;
+    uint32_t _samples_depth;
+    PLCSampleRing _samples;
+    PLCTickClock _clock;
+
+    Packet *handle(Packet *p);
+    void send_requests(bool aligned);
+    void apply(const TonemapTarget &t);
+    void reset_peer();
 
-    uint8_t get_carrier_modulation(short unsigned int);
-    void sendToneMapReq(int);
-    void processToneMapRep(click_hp_av_tone_map_rep *); 
-    void print_frequency_response(int*, int);  
+    template <typename Chip> void sendToneMapReq(int);
+    template <typename Chip> void processToneMapRep(const PLCToneMapRepView &);
 
 };
 
@@ -0,0 +1,201 @@
+/*
+ * plcarchive -- Offline decoder of the tonemap archives of PLCTonemapArchive
+ *
+ * Prints the tonemaps of an archive, one line per tonemap:
+ *   TIME PEER SLOT MODULATIONS
+ * with TIME in seconds, and one hexadecimal digit per carrier. Blocks are
+ * decoded in a single pass each, the data file being mapped in memory.
+ *
+ * Usage: plcarchive [-p PEER] [-s SLOT] [-f FROM] [-t TO] [-l | -c] FILE
+ *   -p, -s   only the tonemaps of this peer, of this slot
+ *   -f, -t   only the tonemaps between these times, in seconds since the epoch
+ *   -l       list the blocks instead
+ *   -c       count the tonemaps only
+ *
+ * Build: g++ -O2 -o plcarchive tools/plcarchive.cc
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "../PLCArchive.h"
+
+static void
+usage()
+{
+    fprintf(stderr, "usage: plcarchive [-p PEER] [-s SLOT] [-f FROM] [-t TO] [-l | -c] FILE\n");
+    exit(2);
+}
+
+static bool
+parse_mac(const char *s, uint8_t *mac)
+{
+    unsigned v[6];
+    if (sscanf(s, "%x:%x:%x:%x:%x:%x", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) != 6)
+        return false;
+    for (int i = 0; i < 6; i++) {
+        if (v[i] > 255)
+            return false;
+        mac[i] = v[i];
+    }
+    return true;
+}
+
+static void
+unparse_mac(char *out, const uint8_t *mac)
+{
+    sprintf(out, "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+static bool
+by_stream_and_time(const plc_archive_index &a, const plc_archive_index &b)
+{
+    int c = memcmp(a.peer, b.peer, 6);
+    if (c != 0)
+        return c < 0;
+    if (a.slot != b.slot)
+        return a.slot < b.slot;
+    return a.first_ns < b.first_ns;
+}
+
+static const uint8_t *
+map_file(const std::string &filename, uint32_t magic, uint64_t &size)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "plcarchive: %s: %s\n", filename.c_str(), strerror(errno));
+        exit(1);
+    }
+    size = st.st_size;
+    void *p = size ? mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    const plc_archive_header *h = (const plc_archive_header *) p;
+    if (p == MAP_FAILED || size < sizeof(*h) || h->magic != magic || h->version != PLC_ARCHIVE_VERSION) {
+        fprintf(stderr, "plcarchive: %s: not a tonemap archive of version %d\n", filename.c_str(), PLC_ARCHIVE_VERSION);
+        exit(1);
+    }
+    madvise(p, size, MADV_SEQUENTIAL);
+    return (const uint8_t *) p;
+}
+
+int
+main(int argc, char **argv)
+{
+    uint8_t peer[6];
+    bool has_peer = false, list = false, count_only = false;
+    int slot = -1;
+    uint64_t from_ns = 0, to_ns = ~0ULL;
+    int c;
+    while ((c = getopt(argc, argv, "p:s:f:t:lc")) != -1)
+        switch (c) {
+        case 'p':
+            if (!(has_peer = parse_mac(optarg, peer)))
+                usage();
+            break;
+        case 's':
+            slot = atoi(optarg);
+            break;
+        case 'f':
+            from_ns = (uint64_t) (strtod(optarg, 0) * 1e9);
+            break;
+        case 't':
+            to_ns = (uint64_t) (strtod(optarg, 0) * 1e9);
+            break;
+        case 'l':
+            list = true;
+            break;
+        case 'c':
+            count_only = true;
+            break;
+        default:
+            usage();
+        }
+    if (optind != argc - 1)
+        usage();
+
+    uint64_t size, index_size;
+    const uint8_t *data = map_file(argv[optind], PLC_ARCHIVE_MAGIC, size);
+    const uint8_t *index = map_file(std::string(argv[optind]) + ".idx", PLC_ARCHIVE_INDEX_MAGIC, index_size);
+
+    // Blocks of the selected streams that overlap [from, to], in the order
+    // of their streams and times
+    std::vector<plc_archive_index> blocks;
+    const plc_archive_index *rec = (const plc_archive_index *) (index + sizeof(plc_archive_header));
+    uint64_t nrec = (index_size - sizeof(plc_archive_header)) / sizeof(plc_archive_index);
+    for (uint64_t i = 0; i < nrec; i++)
+        if (rec[i].offset <= size && rec[i].size <= size - rec[i].offset
+            && (!has_peer || memcmp(rec[i].peer, peer, 6) == 0)
+            && (slot < 0 || rec[i].slot == slot)
+            && rec[i].last_ns >= from_ns && rec[i].first_ns <= to_ns)
+            blocks.push_back(rec[i]);
+    std::sort(blocks.begin(), blocks.end(), by_stream_and_time);
+
+    static const char hex[] = "0123456789ABCDEF";
+    static char out[1 << 20];
+    setvbuf(stdout, out, _IOFBF, sizeof(out));
+    char mac[18];
+    char line[64 + 2 * PLC_ARCHIVE_MAX_BYTES + 2];
+    uint8_t tonemap[PLC_ARCHIVE_MAX_BYTES];
+    uint64_t count = 0, corrupt = 0;
+    // Blocks lie at any byte offset of the data file, so each one is copied
+    // to aligned storage before its header and entries are read
+    std::vector<uint64_t> block;
+
+    for (size_t i = 0; i < blocks.size(); i++) {
+        const plc_archive_index &b = blocks[i];
+        unparse_mac(mac, b.peer);
+        block.resize((b.size + 7) / 8);
+        memcpy(block.data(), data + b.offset, b.size);
+        const plc_archive_block *h = plc_archive_check_block((const uint8_t *) block.data(), b.size);
+        if (!h) {
+            corrupt++;
+            continue;
+        }
+        if (list) {
+            printf("%.3f %.3f %s %d tonemaps %u carriers %u bytes %u offset %llu\n",
+                   h->first_ns / 1e9, b.last_ns / 1e9, mac, h->slot, h->count, h->ncarriers, b.size,
+                   (unsigned long long) b.offset);
+            continue;
+        }
+
+        // All the tonemaps of the block in one pass over its deltas
+        const plc_archive_entry *e = plc_archive_entries(h);
+        const uint8_t *coded = (const uint8_t *) (e + h->count);
+        memset(tonemap, 0, h->nbytes);
+        for (uint32_t k = 0, start = 0; k < h->count; start = e[k].end, k++) {
+            if (e[k].end < start || e[k].end > h->size
+                || !plc_archive_rle_xor(tonemap, h->nbytes, coded + start, e[k].end - start)) {
+                corrupt++;
+                break;
+            }
+            uint64_t t = h->first_ns + (uint64_t) e[k].dt_ms * 1000000;
+            if (t < from_ns || t > to_ns)
+                continue;
+            count++;
+            if (count_only)
+                continue;
+            int n = sprintf(line, "%llu.%03u %s %d ", (unsigned long long) (t / 1000000000),
+                            (unsigned) (t % 1000000000 / 1000000), mac, h->slot);
+            for (uint32_t j = 0; j < h->ncarriers; j++)
+                line[n++] = hex[(tonemap[j >> 1] >> ((j & 1) << 2)) & 0x0F];
+            line[n++] = '\n';
+            fwrite(line, 1, n, stdout);
+        }
+    }
+    if (count_only)
+        printf("%llu\n", (unsigned long long) count);
+    fflush(stdout);
+    if (corrupt)
+        fprintf(stderr, "plcarchive: %llu corrupt blocks\n", (unsigned long long) corrupt);
+    return corrupt ? 1 : 0;
+}